@@ -0,0 +1,174 @@
+/*
+ * Aggregation of the sensor values over a time window.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * In the aggregation mode the sensor tasks add each sample to running
+ * statistics, and a summary event is logged at the end of each window. This
+ * greatly reduces the data logged for long term monitoring. The raw samples
+ * may still be logged at a reduced duty, or not at all.
+ *
+ * The summary event holds the event code of the samples summarized, the count
+ * of samples, and the RTC time since the first sample. Then for each channel:
+ * the mean rounded to an integer; the minimum and maximum as the signed
+ * difference from the mean; and the sum of the squared deviations from the
+ * mean. These are leb128 encoded and stand alone, not delta encoded.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "espressif/esp_common.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "buffer.h"
+#include "config.h"
+#include "aggregate.h"
+
+/* The largest summary event, with 5 bytes for the header values and 25 bytes
+ * per channel. */
+#define AGGREGATE_EVENT_MAX_SIZE(n) (15 + (n) * 25)
+
+void init_aggregate(aggregate_t *agg, uint16_t code, uint32_t num_channels,
+                    aggregate_channel_t *channels)
+{
+    agg->code = code;
+    agg->num_channels = num_channels;
+    agg->channels = channels;
+    agg->count = 0;
+    agg->segment = 0;
+    agg->raw_count = 0;
+}
+
+static int32_t aggregate_mean(aggregate_channel_t *channel, uint32_t count)
+{
+    int64_t sum = channel->sum;
+    if (sum >= 0)
+        return channel->first + (int32_t)((sum + count / 2) / count);
+    return channel->first - (int32_t)((-sum + count / 2) / count);
+}
+
+/*
+ * The sum of the squared deviations from the mean, which is sum_sq - sum^2 /
+ * count. This is computed in integers as the core has no FPU, splitting the
+ * division so that the product does not overflow. It can not be negative but
+ * guard against rounding.
+ */
+static uint64_t aggregate_m2(aggregate_channel_t *channel, uint32_t count)
+{
+    uint64_t sum = channel->sum >= 0 ? channel->sum : -channel->sum;
+    uint64_t q = sum / count;
+    uint64_t r = sum % count;
+    uint64_t sq = q * sum + r * sum / count;
+    return channel->sum_sq > sq ? channel->sum_sq - sq : 0;
+}
+
+static void log_aggregate(aggregate_t *agg)
+{
+    while (1) {
+        uint32_t new_segment = agg->segment;
+        uint8_t *buf = dbuf_reserve(&new_segment, DBUF_EVENT_AGGREGATE,
+                                    AGGREGATE_EVENT_MAX_SIZE(agg->num_channels), 1);
+        if (new_segment != agg->segment) {
+            /* The summary is not delta encoded, so just retry. */
+            agg->segment = new_segment;
+            continue;
+        }
+
+        if (buf) {
+            uint32_t len = emit_leb128(buf, 0, agg->code);
+            len = emit_leb128(buf, len, agg->count);
+            len = emit_leb128(buf, len, RTC.COUNTER - agg->start_time);
+            uint32_t i;
+            for (i = 0; i < agg->num_channels; i++) {
+                aggregate_channel_t *channel = &agg->channels[i];
+                int32_t mean = aggregate_mean(channel, agg->count);
+                len = emit_leb128_signed(buf, len, mean);
+                len = emit_leb128_signed(buf, len, channel->min - mean);
+                len = emit_leb128_signed(buf, len, channel->max - mean);
+                uint64_t m2 = aggregate_m2(channel, agg->count);
+                len = emit_leb128(buf, len, m2);
+            }
+            dbuf_commit(len);
+        }
+        break;
+    }
+}
+
+/*
+ * Add a sample to the current window, logging the summary if the window has
+ * ended. Does nothing unless the aggregation mode is enabled.
+ */
+void aggregate_add(aggregate_t *agg, int32_t *values)
+{
+    uint32_t i;
+
+    if (!param_aggregate_period)
+        return;
+
+    if (agg->count == 0) {
+        agg->start_ticks = xTaskGetTickCount();
+        agg->start_time = RTC.COUNTER;
+        for (i = 0; i < agg->num_channels; i++) {
+            aggregate_channel_t *channel = &agg->channels[i];
+            channel->first = values[i];
+            channel->min = values[i];
+            channel->max = values[i];
+            channel->sum = 0;
+            channel->sum_sq = 0;
+        }
+    }
+
+    for (i = 0; i < agg->num_channels; i++) {
+        aggregate_channel_t *channel = &agg->channels[i];
+        int32_t v = values[i];
+        if (v < channel->min)
+            channel->min = v;
+        if (v > channel->max)
+            channel->max = v;
+        int64_t d = (int64_t)v - channel->first;
+        channel->sum += d;
+        channel->sum_sq += (uint64_t)(d * d);
+    }
+    agg->count++;
+
+    if (xTaskGetTickCount() - agg->start_ticks >=
+        param_aggregate_period * (1000 / portTICK_PERIOD_MS)) {
+        log_aggregate(agg);
+        agg->count = 0;
+    }
+}
+
+/*
+ * Return true if the raw sample is to be logged, which is always unless the
+ * aggregation mode is enabled.
+ */
+bool aggregate_raw_sample(aggregate_t *agg)
+{
+    if (!param_aggregate_period)
+        return true;
+
+    if (!param_aggregate_raw)
+        return false;
+
+    if (++agg->raw_count < param_aggregate_raw)
+        return false;
+
+    agg->raw_count = 0;
+    return true;
+}
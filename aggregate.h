@@ -0,0 +1,52 @@
+/*
+ * Aggregation of the sensor values over a time window.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ */
+
+/*
+ * The running statistics for one channel. The sums are of the deviations from
+ * the first value in the window, to keep them small.
+ */
+typedef struct {
+    int32_t first;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint64_t sum_sq;
+} aggregate_channel_t;
+
+typedef struct {
+    /* The event code of the samples summarized. */
+    uint16_t code;
+    uint32_t num_channels;
+    aggregate_channel_t *channels;
+    /* The number of samples in the current window. */
+    uint32_t count;
+    /* The tick count and RTC time of the first sample in the window. */
+    TickType_t start_ticks;
+    uint32_t start_time;
+    uint32_t segment;
+    /* The number of samples since the last raw sample logged. */
+    uint32_t raw_count;
+} aggregate_t;
+
+void init_aggregate(aggregate_t *agg, uint16_t code, uint32_t num_channels,
+                    aggregate_channel_t *channels);
+void aggregate_add(aggregate_t *agg, int32_t *values);
+bool aggregate_raw_sample(aggregate_t *agg);
@@ -0,0 +1,136 @@
+/*
+ * Bit packing support for the variable bit length encoders.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The bits are packed least significant bit first. The writer accumulates the
+ * bits in a 64 bit word and stores them 32 bits at a time, so each emit has a
+ * single branch and can take up to 32 bits, and a short code costs little
+ * more than a shift and an or. The four bytes are stored separately as the
+ * event data in the buffers is not word aligned. The final flush stores only
+ * the whole bytes, dropping any final partial byte, so the caller emits its
+ * own padding.
+ *
+ * These are small and on the encoding fast path so they are defined here to be
+ * inlined.
+ */
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t len;
+    uint64_t bits;
+    uint32_t nbits;
+} bitwriter_t;
+
+static inline void bitwriter_init(bitwriter_t *writer, uint8_t *buf)
+{
+    writer->buf = buf;
+    writer->len = 0;
+    writer->bits = 0;
+    writer->nbits = 0;
+}
+
+/* Emit the low nbits of bits, up to 32 bits, and the higher bits must be
+ * zero. */
+static inline void bitwriter_emit(bitwriter_t *writer, uint32_t bits, uint32_t nbits)
+{
+    writer->bits |= (uint64_t)bits << writer->nbits;
+    writer->nbits += nbits;
+    if (writer->nbits >= 32) {
+        uint8_t *dest = &writer->buf[writer->len];
+        uint32_t word = writer->bits;
+        dest[0] = word;
+        dest[1] = word >> 8;
+        dest[2] = word >> 16;
+        dest[3] = word >> 24;
+        writer->len += 4;
+        writer->bits >>= 32;
+        writer->nbits -= 32;
+    }
+}
+
+/* Emit a run of n one bits followed by a zero bit, a unary code, for n up
+ * to 31. */
+static inline void bitwriter_emit_unary(bitwriter_t *writer, uint32_t n)
+{
+    bitwriter_emit(writer, (1U << n) - 1, n + 1);
+}
+
+/* Store the whole bytes accumulated, returning the total number of bytes
+ * stored. */
+static inline uint32_t bitwriter_flush(bitwriter_t *writer)
+{
+    while (writer->nbits >= 8) {
+        writer->buf[writer->len++] = writer->bits;
+        writer->bits >>= 8;
+        writer->nbits -= 8;
+    }
+    return writer->len;
+}
+
+
+/* The matching reader, used to decode the events on the host, see test/. */
+typedef struct {
+    const uint8_t *buf;
+    uint32_t size;
+    uint32_t pos;
+    uint64_t bits;
+    uint32_t nbits;
+} bitreader_t;
+
+static inline void bitreader_init(bitreader_t *reader, const uint8_t *buf, uint32_t size)
+{
+    reader->buf = buf;
+    reader->size = size;
+    reader->pos = 0;
+    reader->bits = 0;
+    reader->nbits = 0;
+}
+
+/* Read nbits, up to 32 bits. Reading past the end returns zero bits, which
+ * the caller can detect with bitreader_overrun(). */
+static inline uint32_t bitreader_read(bitreader_t *reader, uint32_t nbits)
+{
+    if (reader->nbits < nbits) {
+        while (reader->nbits <= 56) {
+            uint64_t byte = reader->pos < reader->size ? reader->buf[reader->pos] : 0;
+            reader->bits |= byte << reader->nbits;
+            reader->pos++;
+            reader->nbits += 8;
+        }
+    }
+    uint32_t v = reader->bits & (((uint64_t)1 << nbits) - 1);
+    reader->bits >>= nbits;
+    reader->nbits -= nbits;
+    return v;
+}
+
+/* Read a unary code, a run of one bits terminated by a zero bit, of up to
+ * max one bits, returning the number of one bits. */
+static inline uint32_t bitreader_read_unary(bitreader_t *reader, uint32_t max)
+{
+    uint32_t n = 0;
+    while (n < max && bitreader_read(reader, 1))
+        n++;
+    return n;
+}
+
+/* Return true if more bits have been read than are available. */
+static inline bool bitreader_overrun(bitreader_t *reader)
+{
+    return reader->pos * 8 - reader->nbits > reader->size * 8;
+}
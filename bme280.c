@@ -38,6 +38,9 @@
 #include "buffer.h"
 #include "i2c.h"
 #include "leds.h"
+#include "config.h"
+#include "aggregate.h"
+#include "delta.h"
 
 
 
@@ -62,102 +65,150 @@ bool bme280_temp_press_rh(uint32_t *counter, float *temp, float *press, float *r
     return true;
 }
 
-static void bme280_read_task(void *pvParameters)
-{
-    /* Delta encoding state. */
-    uint32_t last_segment = 0;
-    uint32_t last_bme280_temp = 0;
-    uint32_t last_bme280_pressure = 0;
-    uint32_t last_bme280_humidity = 0;
+static aggregate_channel_t bme280_aggregate_channels[3];
+static aggregate_t bme280_aggregate;
 
-    xSemaphoreTake(i2c_sem, portMAX_DELAY);
+static delta_channel_t bme280_delta_channels[3];
+static delta_set_t bme280_delta;
+
+static bmp280_t bme280_dev;
+static bool bme280p;
+
+/* The oversampling applied, and the forced mode measurement time in ticks. */
+static uint8_t bme280_oversampling;
+static int32_t bme280_measure_ticks;
+
+static i2c_sensor_t bme280_sensor;
+
+/* Configure the sensor, and detect it. */
+static bool bme280_configure(void)
+{
+    bme280_oversampling = param_bme280_oversampling;
+    BMP280_Oversampling oversampling = bme280_oversampling;
+    if (oversampling < BMP280_ULTRA_LOW_POWER || oversampling > BMP280_ULTRA_HIGH_RES)
+        oversampling = BMP280_ULTRA_HIGH_RES;
 
     bmp280_params_t bme280_params;
     bmp280_init_default_params(&bme280_params);
-    bme280_params.mode = BMP280_MODE_NORMAL;
-    bme280_params.filter = BMP280_FILTER_16;
-    bme280_params.oversampling_pressure = BMP280_ULTRA_HIGH_RES;
-    bme280_params.oversampling_temperature = BMP280_ULTRA_HIGH_RES;
-    bme280_params.oversampling_humidity = BMP280_ULTRA_HIGH_RES;
+    if (param_bme280_forced) {
+        /* Each sample is a single conversion, so no filtering. */
+        bme280_params.mode = BMP280_MODE_FORCED;
+        bme280_params.filter = BMP280_FILTER_OFF;
+    } else {
+        bme280_params.mode = BMP280_MODE_NORMAL;
+        bme280_params.filter = BMP280_FILTER_16;
+    }
+    bme280_params.oversampling_pressure = oversampling;
+    bme280_params.oversampling_temperature = oversampling;
+    bme280_params.oversampling_humidity = oversampling;
     bme280_params.standby = BMP280_STANDBY_250;
 
-    bmp280_t bme280_dev;
     bme280_dev.i2c_dev.bus = I2C_BUS;
     bme280_dev.i2c_dev.addr = BMP280_I2C_ADDRESS_0;
-    bool available = bmp280_init(&bme280_dev, &bme280_params);
-    xSemaphoreGive(i2c_sem);
+    if (!bmp280_init(&bme280_dev, &bme280_params))
+        return false;
+
+    bme280p = bme280_dev.id == BME280_CHIP_ID;
 
-    if (!available)
-        vTaskDelete(NULL);
-
-    bool bme280p = bme280_dev.id == BME280_CHIP_ID;
-    
-    for (;;) {
-        vTaskDelay(10000 / portTICK_PERIOD_MS);
-
-        xSemaphoreTake(i2c_sem, portMAX_DELAY);
-
-        int32_t temperature;
-        uint32_t pressure;
-        uint32_t humidity = 0;
-        if (!bmp280_read_fixed(&bme280_dev, &temperature, &pressure,
-                               bme280p ? &humidity : NULL)) {
-            xSemaphoreGive(i2c_sem);
-            blink_red();
-            continue;
-        }
-
-        bme280_available = true;
-        bme280_counter = RTC.COUNTER;
-        bme280_temperature = temperature;
-        bme280_pressure = pressure;
-        bme280_rh = humidity;
-
-        xSemaphoreGive(i2c_sem);
-
-        while (1) {
-            uint8_t outbuf[15];
-            /* Delta encoding */
-            int32_t temp_delta = (int32_t)temperature - (int32_t)last_bme280_temp;
-            uint32_t len = emit_leb128_signed(outbuf, 0, temp_delta);
-            int32_t pressure_delta = (int32_t)pressure - (int32_t)last_bme280_pressure;
-            len = emit_leb128_signed(outbuf, len, pressure_delta);
-            int32_t code = DBUF_EVENT_BMP280_TEMP_PRESSURE;
-
-            if (bme280p) {
-                int32_t humidity_delta = (int32_t)humidity - (int32_t)last_bme280_humidity;
-                len = emit_leb128_signed(outbuf, len, humidity_delta);
-                code = DBUF_EVENT_BME280_TEMP_PRESSURE_RH;
-            }
-
-            uint32_t new_segment = dbuf_append(last_segment, code, outbuf, len, 1);
-            if (new_segment == last_segment) {
-                /*
-                 * Commit the values logged. Note this is the only task
-                 * accessing this state so these updates are synchronized with
-                 * the last event of this class append.
-                 */
-                last_bme280_temp = temperature;
-                last_bme280_pressure = pressure;
-                last_bme280_humidity = humidity;
-                break;
-            }
-
-            /* Moved on to a new buffer. Reset the delta encoding state and
-             * retry. */
-            last_segment = new_segment;
-            last_bme280_temp = 0;
-            last_bme280_pressure = 0;
-            last_bme280_humidity = 0;
-        };
-
-        blink_green();
+    /* The maximum measurement time from the datasheet, in usec, for the
+     * temperature, pressure, and humidity at an oversampling of 1 << (n - 1). */
+    uint32_t samples = 1 << (oversampling - 1);
+    uint32_t usec = 1250 + 2300 * samples + 2300 * samples + 575;
+    if (bme280p)
+        usec += 2300 * samples + 575;
+    bme280_measure_ticks = (usec + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+
+    return true;
+}
+
+static bool bme280_init(void)
+{
+    if (!bme280_configure())
+        return false;
+
+    bme280_sensor.sync = param_bme280_forced && param_pms_uart;
+
+    if (bme280p) {
+        init_aggregate(&bme280_aggregate, DBUF_EVENT_BME280_TEMP_PRESSURE_RH, 3,
+                       bme280_aggregate_channels);
+        init_delta_set(&bme280_delta, DBUF_EVENT_BME280_TEMP_PRESSURE_RH, 3,
+                       bme280_delta_channels);
+    } else {
+        init_aggregate(&bme280_aggregate, DBUF_EVENT_BMP280_TEMP_PRESSURE, 2,
+                       bme280_aggregate_channels);
+        init_delta_set(&bme280_delta, DBUF_EVENT_BMP280_TEMP_PRESSURE, 2,
+                       bme280_delta_channels);
     }
+
+    return true;
 }
 
-
+static int32_t bme280_start(void)
+{
+    /* Apply an oversampling change. */
+    if (bme280_oversampling != param_bme280_oversampling && !bme280_configure())
+        return -1;
+
+    /* Converting continuously in the normal mode. */
+    if (!param_bme280_forced)
+        return 0;
+
+    if (!bmp280_force_measurement(&bme280_dev))
+        return -1;
+
+    return bme280_measure_ticks;
+}
+
+static int32_t bme280_poll(void)
+{
+    if (param_bme280_forced && bmp280_is_measuring(&bme280_dev))
+        return 1;
+
+    int32_t temperature;
+    uint32_t pressure;
+    uint32_t humidity = 0;
+    if (!bmp280_read_fixed(&bme280_dev, &temperature, &pressure,
+                           bme280p ? &humidity : NULL)) {
+        return -1;
+    }
+
+    bme280_available = true;
+    bme280_counter = RTC.COUNTER;
+    bme280_temperature = temperature;
+    bme280_pressure = pressure;
+    bme280_rh = humidity;
+
+    return 0;
+}
+
+/*
+ * Log the measurement. Note this task is the only writer of the measurement
+ * so it can be read without holding the i2c_sem.
+ */
+static void bme280_log(void)
+{
+    int32_t temperature = bme280_temperature;
+    uint32_t pressure = bme280_pressure;
+    uint32_t humidity = bme280_rh;
+
+    int32_t values[3] = {temperature, pressure, humidity};
+    aggregate_add(&bme280_aggregate, values);
+
+    if (!aggregate_raw_sample(&bme280_aggregate))
+        return;
+
+    log_delta_set(&bme280_delta, values, NULL, 0);
+}
+
+static i2c_sensor_t bme280_sensor = {
+    .init = bme280_init,
+    .start = bme280_start,
+    .poll = bme280_poll,
+    .log = bme280_log,
+    .period = &param_bme280_period,
+};
 
 void init_bme280()
 {
-    xTaskCreate(&bme280_read_task, "BME280 reader", 288, NULL, 11, NULL);
+    add_i2c_sensor(&bme280_sensor);
 }
@@ -38,6 +38,9 @@
 #include "buffer.h"
 #include "i2c.h"
 #include "leds.h"
+#include "config.h"
+#include "aggregate.h"
+#include "delta.h"
 
 
 
@@ -65,76 +68,79 @@ bool bmp180_temp_press(uint32_t *counter, float *temp, float *press)
     return true;
 }
 
-static void bmp180_read_task(void *pvParameters)
-{
-    /* Delta encoding state. */
-    uint32_t last_segment = 0;
-    uint32_t last_bmp180_temp = 0;
-    uint32_t last_bmp180_pressure = 0;
+static aggregate_channel_t bmp180_aggregate_channels[2];
+static aggregate_t bmp180_aggregate;
 
-    xSemaphoreTake(i2c_sem, portMAX_DELAY);
-    bmp180_constants_t constants;
+static delta_channel_t bmp180_delta_channels[2];
+static delta_set_t bmp180_delta;
+
+static bmp180_constants_t bmp180_constants;
+
+static bool bmp180_init(void)
+{
     bool available = bmp180_is_available(&bmp180_dev) &&
-        bmp180_fillInternalConstants(&bmp180_dev, &constants);
-    xSemaphoreGive(i2c_sem);
+        bmp180_fillInternalConstants(&bmp180_dev, &bmp180_constants);
 
     if (!available)
-        vTaskDelete(NULL);
-
-    for (;;) {
-        vTaskDelay(10000 / portTICK_PERIOD_MS);
-
-        xSemaphoreTake(i2c_sem, portMAX_DELAY);
-
-        int32_t temperature;
-        uint32_t pressure;
-        if (!bmp180_measure(&bmp180_dev, &constants, &temperature, &pressure, 3)) {
-            xSemaphoreGive(i2c_sem);
-            blink_red();
-            continue;
-        }
-            
-        bmp180_available = true;
-        bmp180_counter = RTC.COUNTER;
-        bmp180_temperature = temperature;
-        bmp180_pressure = pressure;
-
-        xSemaphoreGive(i2c_sem);
-
-        while (1) {
-            uint8_t outbuf[12];
-            /* Delta encoding */
-            int32_t temp_delta = (int32_t)temperature - (int32_t)last_bmp180_temp;
-            uint32_t len = emit_leb128_signed(outbuf, 0, temp_delta);
-            int32_t pressure_delta = (int32_t)pressure - (int32_t)last_bmp180_pressure;
-            len = emit_leb128_signed(outbuf, len, pressure_delta);
-            int32_t code = DBUF_EVENT_BMP180_TEMP_PRESSURE;
-            uint32_t new_segment = dbuf_append(last_segment, code, outbuf, len, 1);
-            if (new_segment == last_segment) {
-                /*
-                 * Commit the values logged. Note this is the only task
-                 * accessing this state so these updates are synchronized with
-                 * the last event of this class append.
-                 */
-                last_bmp180_temp = temperature;
-                last_bmp180_pressure = pressure;
-                break;
-            }
-
-            /* Moved on to a new buffer. Reset the delta encoding state and
-             * retry. */
-            last_segment = new_segment;
-            last_bmp180_temp = 0;
-            last_bmp180_pressure = 0;
-        };
-
-        blink_green();
-    }
+        return false;
+
+    init_aggregate(&bmp180_aggregate, DBUF_EVENT_BMP180_TEMP_PRESSURE, 2,
+                   bmp180_aggregate_channels);
+    init_delta_set(&bmp180_delta, DBUF_EVENT_BMP180_TEMP_PRESSURE, 2,
+                   bmp180_delta_channels);
+    return true;
 }
 
-
+static int32_t bmp180_start(void)
+{
+    return 0;
+}
+
+static int32_t bmp180_poll(void)
+{
+    int32_t temperature;
+    uint32_t pressure;
+    uint8_t oversampling = param_bmp180_oversampling;
+    if (oversampling > 3)
+        oversampling = 3;
+    if (!bmp180_measure(&bmp180_dev, &bmp180_constants, &temperature, &pressure, oversampling))
+        return -1;
+
+    bmp180_available = true;
+    bmp180_counter = RTC.COUNTER;
+    bmp180_temperature = temperature;
+    bmp180_pressure = pressure;
+
+    return 0;
+}
+
+/*
+ * Log the measurement. Note this task is the only writer of the measurement
+ * so it can be read without holding the i2c_sem.
+ */
+static void bmp180_log(void)
+{
+    int32_t temperature = bmp180_temperature;
+    uint32_t pressure = bmp180_pressure;
+
+    int32_t values[2] = {temperature, pressure};
+    aggregate_add(&bmp180_aggregate, values);
+
+    if (!aggregate_raw_sample(&bmp180_aggregate))
+        return;
+
+    log_delta_set(&bmp180_delta, values, NULL, 0);
+}
+
+static i2c_sensor_t bmp180_sensor = {
+    .init = bmp180_init,
+    .start = bmp180_start,
+    .poll = bmp180_poll,
+    .log = bmp180_log,
+    .period = &param_bmp180_period,
+};
 
 void init_bmp180()
 {
-    xTaskCreate(&bmp180_read_task, "bmp180_read_task", 240, NULL, 11, NULL);
+    add_i2c_sensor(&bmp180_sensor);
 }
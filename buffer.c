@@ -69,6 +69,10 @@
 
 
 #define DBUF_DATA_SIZE 4096
+/* The last word of each flash sector holds a footer written when sealed, see
+ * flash.c, so the events do not use it, nor the byte before it which is left
+ * as ones to terminate the events before the footer. */
+#define DBUF_FOOTER_SIZE 5
 
 typedef struct {
     /* The size of the filled data bytes. */
@@ -78,6 +82,9 @@ typedef struct {
     /* Time-stamp of the first event written to the buffer after the last save,
      * or the time of the oldest event not saved. */
     uint32_t write_time;
+    /* Non-zero while the flash writer is reading the buffer, and it must not
+     * then be re-initialized. Events may still be appended past the size. */
+    uint32_t pinned;
     /* The data. Initialized to all ones bits (0xff). The first two 32 bit words
      * are an unique index that is monotonically increasing. The second copy is
      * for redundancy and is inverted to help catch errors when saved to
@@ -103,12 +110,22 @@ static uint32_t dbufs_tail;
 /* To synchronize access to the data buffers. */
 static SemaphoreHandle_t dbufs_sem;
 
+/* To serialize the producers, held from a reservation to its commit while the
+ * event is encoded, and taken before the dbufs_sem. */
+static SemaphoreHandle_t dbuf_reserve_sem;
+
 /*
  * Logging to the data buffers can be disabled by clearing this variable, and
  * this is the start of the data flow so it stops more data entering.
  */
 static bool dbuf_logging_enabled = false;
 
+/*
+ * When the flash writer recompresses the buffers it only accepts full buffers,
+ * so the head buffer is not saved, see flash.c.
+ */
+static bool dbuf_full_only = false;
+
 /* Return the index for the buffer number. */
 static uint32_t dbuf_index(uint32_t num)
 {
@@ -141,6 +158,10 @@ static void initialize_dbuf(uint32_t num)
     memset(dbuf->data, 0xff, DBUF_DATA_SIZE);
 }
 
+void set_buffer_rc(bool enable) {
+    dbuf_full_only = enable;
+}
+
 bool get_buffer_logging() {
     return dbuf_logging_enabled;
 }
@@ -246,6 +267,19 @@ uint32_t emit_leb128_signed(uint8_t *buf, uint32_t start, int64_t v)
  * data. The caller needs to know when the buffer has changed to reset the state
  * and to do this the segment index is passed in an if not the current segment
  * index then the append aborts and the current segment index is returned.
+ *
+ * Producers may also reserve room for an event with dbuf_reserve(), encode the
+ * event directly into the head buffer, and then call dbuf_commit(). The
+ * segment is checked before the caller encodes the event so the caller learns
+ * of a segment change before encoding, avoiding encoding the event twice and
+ * copying it. The dbuf_reserve_sem is held from the reservation to the commit,
+ * so the caller must not block between these, but the dbufs_sem is only held
+ * within these calls so the flash writer is not held up by the encoding.
+ *
+ * Room is reserved for the largest event header and data, so a reservation
+ * might not fit when the event would have, and then the buffer is rolled over
+ * with up to the difference unused, a little more than the max_size less the
+ * final size. The dbuf_append() knows the final size, so it reserves exactly.
  */
 static uint32_t current_segment;
 static bool dbuf_stream_restart_required;
@@ -253,90 +287,71 @@ static int32_t last_code;
 static int32_t last_size;
 static uint32_t last_time;
 
-uint32_t dbuf_append(uint32_t segment, uint16_t code, uint8_t *data, uint32_t size,
-                     int low_res_time)
-{
-    xSemaphoreTake(dbufs_sem, portMAX_DELAY);
+/*
+ * Optional timestamp prediction. When 'time_predict' is set each buffer starts
+ * with a DBUF_EVENT_TIME_PREDICT event, coded in the usual format, and the
+ * following event headers code the time as the error from a prediction rather
+ * than as a delta from the last event. The time of an event is predicted from
+ * the time of the last event with the same code plus the interval between the
+ * last two such events. Codes without a prior event in the buffer, or above the
+ * table size, are predicted to be at the time of the last event, so the error
+ * is then just the usual delta. The prediction state is reset at the start of
+ * each buffer and at a DBUF_EVENT_SEGMENT_START event, along with the last
+ * event state.
+ */
+#define DBUF_PREDICT_CODES 64
+static uint64_t predict_valid;
+static uint32_t predict_time[DBUF_PREDICT_CODES];
+static uint32_t predict_period[DBUF_PREDICT_CODES];
 
-    if (!dbuf_logging_enabled) {
-        /* An entry is being dropped, and might have been delta encoded, so note
-         * that a segment restart is needed. The segment index will be advanced
-         * but there is no need to advance it here now, and the callers can keep
-         * using the current segment index - the output is just being
-         * discarded. When the stream restarts the segment index will change and
-         * callers will then need to reset their delta encoding state. */
-        dbuf_stream_restart_required = true;
+/* The size of a buffer holding no events, past the index and any flag. */
+static uint32_t dbuf_empty_size = 8;
 
-        xSemaphoreGive(dbufs_sem);
+/* The pending reservation. */
+static uint16_t reserve_code;
+static uint32_t reserve_time;
+static uint32_t reserve_max_size;
+static uint32_t reserve_header_size;
 
-        /*
-         * Continue to wakeup the flash_data task, even if new data is not
-         * being accepted into the data buffers.
-         */
-        if (flash_data_task)
-            xTaskNotify(flash_data_task, 0, eNoAction);
+static void reset_event_state(void)
+{
+    last_code = 0;
+    last_size = 0;
+    last_time = 0;
+    predict_valid = 0;
+}
 
-        /* Consume it to allow the caller to proceed. */
-        return segment;
-    }
+static uint32_t predict_event_time(uint16_t code)
+{
+    if (code < DBUF_PREDICT_CODES && (predict_valid & (1ULL << code)))
+        return predict_time[code] + predict_period[code];
+    return last_time;
+}
 
-    /* A stream restart is required. */
-    if (dbuf_stream_restart_required) {
-        /* Reset the prior-event state. */
-        last_code = 0;
-        last_size = 0;
-        last_time = 0;
-        /* Advance the segment index. */
-        current_segment++;
-        /* An entry needs to be added to the stream log now, so hijack this call
-         * and the caller will retry as the segment index has advanced. If there
-         * is no room for this entry then it will advance to the next buffer
-         * which resets the state anyway. The segment restart flag can be
-         * cleared now as all exits either log a restart event or roll over to a
-         * new buffer. */
-        dbuf_stream_restart_required = false;
-        if (segment == current_segment) {
-            printf("Error: unexpected segment index\n");
-        }
-        segment = current_segment;
-        code = DBUF_EVENT_SEGMENT_START;
-        data = NULL;
-        size = 0;
-        low_res_time = 1;
-    }
+static void note_event(uint16_t code, uint32_t size, uint32_t time)
+{
+    last_code = code;
+    last_size = size;
+    last_time = time;
 
-    if (segment != current_segment) {
-        /* The stream has been interrupted, so the caller must reset any delta
-         * encoding state and retry. */
-        segment = current_segment;
-        xSemaphoreGive(dbufs_sem);
-        return segment;
+    if (code < DBUF_PREDICT_CODES) {
+        uint64_t bit = 1ULL << code;
+        predict_period[code] = (predict_valid & bit) ? time - predict_time[code] : 0;
+        predict_time[code] = time;
+        predict_valid |= bit;
     }
+}
 
-    uint32_t time = RTC.COUNTER;
-    /* Space to emit the code, size, and time. */
-    uint8_t header[15];
+/*
+ * Emit the event header. The compact header is used when the code and size are
+ * the same as the last event, unless compact is false which supports finding
+ * the largest header size for an event.
+ */
+static uint32_t emit_event_header(uint8_t *header, uint16_t code, uint32_t size,
+                                  uint32_t time, bool compact)
+{
     uint32_t header_size = 0;
 
-    if (low_res_time) {
-        /* Protect against stepping backwards in time, which would look like
-         * wrapping which would be a big step forward in time. If the low bits
-         * of the last_time are zero then truncating the current time low bits
-         * can not step backwards. If the significant bits of the last_time and
-         * current time are not equal then it is also safe. */
-        if ((last_time & 0x00001fff) == 0 ||
-            (last_time & 0xffffe000) != (time & 0xffffe000)) {
-            /* Truncate the time, don't need all the precision. Note that the
-             * time delta low bits will not necessarily be zero for this event,
-             * but if the following event also uses a low_res_time then the time
-             * delta low bits will be zero then. */
-            time = time & 0xffffe000;
-        }
-    }
-
-    /* The time is always at least delta encoded, mod32. */
-    uint32_t time_delta = time - last_time;
-
     /* The first two bits, the two lsb, encode the header format.
      *
      * Bit 0:
@@ -346,59 +361,152 @@ uint32_t dbuf_append(uint32_t segment, uint16_t code, uint8_t *data, uint32_t si
      * Bit 1:
      *   0 = leb128 time delta.
      *   1 = leb128 truncated time delta.
-     *       
+     *
+     * When predicting the time, bit 1 instead has:
+     *   0 = leb128 time error.
+     *   1 = the predicted time, there is no time value.
+     *
+     * The time error is zig-zag coded, and its lsb flags the error being
+     * truncated, as for the delta.
+     *
      * The event code must have one zero bit in the first 5 bits to ensure that
      * the first byte always has one zero bit if there is an event, and that
      * 0xff terminates the event log.
      */
-
-    if (code == last_code && size == last_size) {
-        if ((time_delta & 0x00001fff) == 0) {
-            uint64_t v = time_delta >> (13 - 2) | 2 | 0;
-            header_size = emit_leb128(header, header_size, v);
+    uint32_t format;
+    uint64_t v;
+
+    if (param_time_predict) {
+        uint32_t error = time - predict_event_time(code);
+        if (error == 0) {
+            format = 2;
+            v = 0;
         } else {
-            uint64_t v = (uint64_t)time_delta << 2UL | 0 | 0;
-            header_size = emit_leb128(header, header_size, v);
+            int64_t e = (int32_t)error;
+            if ((error & 0x00001fff) == 0) {
+                e = (e >> 13) * 2 + 1;
+            } else {
+                e = e * 2;
+            }
+            v = e < 0 ? ((uint64_t)-e << 1) - 1 : (uint64_t)e << 1;
+            format = 0;
         }
     } else {
+        uint32_t time_delta = time - last_time;
         if ((time_delta & 0x00001fff) == 0) {
-            header_size = emit_leb128(header, header_size, (code << 2) | 2 | 1);
-            header_size = emit_leb128(header, header_size, size);
-            uint64_t v = time_delta >> 13;
-            header_size = emit_leb128(header, header_size, v);
+            format = 2;
+            v = time_delta >> 13;
         } else {
-            header_size = emit_leb128(header, header_size, (code << 2) | 0 | 1);
-            header_size = emit_leb128(header, header_size, size);
-            uint64_t v = (uint64_t)time_delta;
+            format = 0;
+            v = time_delta;
+        }
+    }
+
+    if (compact && code == last_code && size == last_size) {
+        header_size = emit_leb128(header, header_size, v << 2 | format | 0);
+    } else {
+        header_size = emit_leb128(header, header_size, (code << 2) | format | 1);
+        header_size = emit_leb128(header, header_size, size);
+        if (!param_time_predict || format == 0)
             header_size = emit_leb128(header, header_size, v);
+    }
+
+    return header_size;
+}
+
+/*
+ * Start the events in a buffer. When predicting the time, the first event
+ * flags this and it is coded in the usual format, at time zero.
+ */
+static void start_dbuf_events(uint32_t num)
+{
+    dbuf_t *dbuf = &dbufs[num];
+    dbuf->size = 8;
+    reset_event_state();
+
+    if (param_time_predict) {
+        uint32_t size = emit_leb128(dbuf->data, dbuf->size, DBUF_EVENT_TIME_PREDICT << 2 | 1);
+        size = emit_leb128(dbuf->data, size, 0);
+        dbuf->size = emit_leb128(dbuf->data, size, 0);
+        note_event(DBUF_EVENT_TIME_PREDICT, 0, 0);
+    }
+
+    dbuf_empty_size = dbuf->size;
+}
+
+/*
+ * Reserve room in the head buffer for an event with up to max_size bytes of
+ * data, or exactly max_size bytes if exact, returning a pointer to the data
+ * area. The dbufs_sem and the dbuf_reserve_sem are held on entry. Otherwise
+ * NULL is returned and the segment is updated if it has changed.
+ */
+static uint8_t *dbuf_reserve_locked(uint32_t *segment, uint16_t code,
+                                    uint32_t max_size, bool exact,
+                                    int low_res_time)
+{
+    if (*segment != current_segment) {
+        /* The stream has been interrupted, so the caller must reset any delta
+         * encoding state and retry. */
+        *segment = current_segment;
+        return NULL;
+    }
+
+    uint32_t time = RTC.COUNTER;
+
+    if (low_res_time) {
+        /* Protect against stepping backwards in time, which would look like
+         * wrapping which would be a big step forward in time. If the low bits
+         * of the last_time are zero then truncating the current time low bits
+         * can not step backwards. If the significant bits of the last_time and
+         * current time are not equal then it is also safe. */
+        if ((last_time & 0x00001fff) == 0 ||
+            (last_time & 0xffffe000) != (time & 0xffffe000)) {
+            /* Truncate the time, don't need all the precision. Note that the
+             * time delta low bits will not necessarily be zero for this event,
+             * but if the following event also uses a low_res_time then the time
+             * delta low bits will be zero then. */
+            time = time & 0xffffe000;
         }
     }
 
-    uint32_t total_size = header_size + size;
+    /* The time is always at least delta encoded, or predicted, mod32. Room is
+     * reserved for the largest header, unless the data size is known. */
+    uint8_t header[15];
+    uint32_t header_size = emit_event_header(header, code, max_size, time, exact);
+    uint32_t total_size = header_size + max_size;
 
     /* Guard against logging data too big to fit in any buffer. */
-    if (total_size > DBUF_DATA_SIZE - 8) {
-        xSemaphoreGive(dbufs_sem);
+    if (total_size > DBUF_DATA_SIZE - DBUF_FOOTER_SIZE - dbuf_empty_size) {
         /* Consume it to clear the error. This will break delta encoding for the
          * caller, but this is an exceptional path that should not occur in
          * normal operation. */
         printf("Error: data too large to buffer?\n");
-        return segment;
+        return NULL;
     }
 
     /* Check if there is room in the current buffer. */
     dbuf_t *head = &dbufs[dbufs_head];
-    if (head->size + total_size > DBUF_DATA_SIZE) {
+    if (head->size + total_size > DBUF_DATA_SIZE - DBUF_FOOTER_SIZE) {
         /* Full, move to the next buffer. */
         uint32_t index = dbuf_index(dbufs_head) + 1;
         /* Reuse the head buffer if it is the only active buffer and its data
          * has been saved. This check prevents a saved buffer being retained
          * which would break an assumed invariant. */
-        if (dbufs_head != dbufs_tail || head->size != head->save_size) {
+        if (dbufs_head != dbufs_tail || head->size != head->save_size ||
+            head->pinned) {
             /* Can not reuse the head buffer. */
-            dbufs_head++;
-            if (dbufs_head >= NUM_DBUFS)
-                dbufs_head = 0;
+            uint32_t next = dbufs_head + 1;
+            if (next >= NUM_DBUFS)
+                next = 0;
+            if (dbufs[next].pinned) {
+                /* The flash writer is still reading the oldest buffer so it
+                 * can not be discarded yet. Drop this event, consuming it, and
+                 * flag a segment restart as the callers delta encoding is now
+                 * broken. */
+                dbuf_stream_restart_required = true;
+                return NULL;
+            }
+            dbufs_head = next;
             if (dbufs_head == dbufs_tail) {
                 /* Wrapped, discard the tail buffer. */
                 dbufs_tail++;
@@ -409,111 +517,221 @@ uint32_t dbuf_append(uint32_t segment, uint16_t code, uint8_t *data, uint32_t si
         }
         initialize_dbuf(dbufs_head);
         set_dbuf_index(dbufs_head, index);
-        head->size = 8;
         /* Reset the prior-event state. */
-        last_code = 0;
-        last_size = 0;
-        last_time = 0;
+        start_dbuf_events(dbufs_head);
         /* Advance the segment index. The caller, and other callers using the
          * old segment, must reset any delta encoding state and retry. */
-        segment = current_segment + 1;
-        current_segment = segment;
+        current_segment++;
+        *segment = current_segment;
         /* Clear the segment restart flag, as it is no longer necessary. */
         dbuf_stream_restart_required = false;
-        xSemaphoreGive(dbufs_sem);
-        return segment;
+        return NULL;
     }
 
+    reserve_code = code;
+    reserve_time = time;
+    reserve_max_size = max_size;
+    reserve_header_size = header_size;
+
+    return &head->data[head->size + header_size];
+}
+
+/*
+ * Commit the reserved event with the final data size. The header is emitted
+ * and the data moved down to meet it if the header is smaller than reserved.
+ */
+static void dbuf_commit_locked(uint32_t size)
+{
+    dbuf_t *head = &dbufs[dbufs_head];
+    uint8_t *data = &head->data[head->size + reserve_header_size];
+
+    if (size > reserve_max_size)
+        size = reserve_max_size;
+
+    uint8_t header[15];
+    uint32_t header_size = emit_event_header(header, reserve_code, size,
+                                             reserve_time, true);
+
     /* Reset the write time if this is the first real write to the buffer, or
      * the first write since the last save. This prevents an immediate or early
      * save of new content added. */
-    if (head->size <= 8 || head->size == head->save_size)
-        head->write_time = time;
-
-    /* Emit the event header. */
-    uint32_t i;
-    for (i = 0; i < header_size; i++)
-        head->data[head->size + i] = header[i];
-    /* Emit the event data. */
-    for (i = 0; i < size; i++)
-        head->data[head->size + header_size + i] = data[i];
+    if (head->size <= dbuf_empty_size || head->size == head->save_size)
+        head->write_time = reserve_time;
+
+    /* Emit the event header, moving the event data down to meet it. */
+    uint8_t *dest = &head->data[head->size];
+    memcpy(dest, header, header_size);
+    if (header_size < reserve_header_size) {
+        memmove(dest + header_size, data, size);
+    }
+    /* Restore the ones fill after the event, clearing any data moved down and
+     * any data emitted past the final size. */
+    uint32_t total_size = header_size + size;
+    memset(dest + total_size, 0xff, reserve_header_size + reserve_max_size - total_size);
 
     head->size += total_size;
 
-    last_code = code;
-    last_size = size;
-    last_time = time;
+    note_event(reserve_code, size, reserve_time);
+}
+
+static uint8_t *reserve_event(uint32_t *segment, uint16_t code, uint32_t max_size,
+                              bool exact, int low_res_time)
+{
+    xSemaphoreTake(dbuf_reserve_sem, portMAX_DELAY);
+    xSemaphoreTake(dbufs_sem, portMAX_DELAY);
+
+    if (!dbuf_logging_enabled) {
+        /* An entry is being dropped, and might have been delta encoded, so note
+         * that a segment restart is needed. The segment index will be advanced
+         * but there is no need to advance it here now, and the callers can keep
+         * using the current segment index - the output is just being
+         * discarded. When the stream restarts the segment index will change and
+         * callers will then need to reset their delta encoding state. */
+        dbuf_stream_restart_required = true;
+
+        xSemaphoreGive(dbufs_sem);
+        xSemaphoreGive(dbuf_reserve_sem);
+
+        /*
+         * Continue to wakeup the flash_data task, even if new data is not
+         * being accepted into the data buffers.
+         */
+        if (flash_data_task)
+            xTaskNotify(flash_data_task, 0, eNoAction);
 
+        /* Consume it to allow the caller to proceed. */
+        return NULL;
+    }
+
+    /* A stream restart is required. */
+    if (dbuf_stream_restart_required) {
+        /* Reset the prior-event state. */
+        reset_event_state();
+        /* Advance the segment index. */
+        current_segment++;
+        /* An entry needs to be added to the stream log now, so hijack this call
+         * and the caller will retry as the segment index has advanced. If there
+         * is no room for this entry then it will advance to the next buffer
+         * which resets the state anyway. The segment restart flag can be
+         * cleared now as all exits either log a restart event or roll over to a
+         * new buffer. */
+        dbuf_stream_restart_required = false;
+        if (*segment == current_segment) {
+            printf("Error: unexpected segment index\n");
+        }
+        *segment = current_segment;
+        if (dbuf_reserve_locked(segment, DBUF_EVENT_SEGMENT_START, 0, true, 1))
+            dbuf_commit_locked(0);
+        xSemaphoreGive(dbufs_sem);
+        xSemaphoreGive(dbuf_reserve_sem);
+        if (flash_data_task)
+            xTaskNotify(flash_data_task, 0, eNoAction);
+        return NULL;
+    }
+
+    uint8_t *data = dbuf_reserve_locked(segment, code, max_size, exact, low_res_time);
     xSemaphoreGive(dbufs_sem);
+    if (!data)
+        xSemaphoreGive(dbuf_reserve_sem);
+
+    return data;
+}
+
+uint8_t *dbuf_reserve(uint32_t *segment, uint16_t code, uint32_t max_size,
+                      int low_res_time)
+{
+    return reserve_event(segment, code, max_size, false, low_res_time);
+}
+
+void dbuf_commit(uint32_t size)
+{
+    xSemaphoreTake(dbufs_sem, portMAX_DELAY);
+    dbuf_commit_locked(size);
+    xSemaphoreGive(dbufs_sem);
+    xSemaphoreGive(dbuf_reserve_sem);
 
     /* Wakeup the flash_data task. */
     if (flash_data_task)
         xTaskNotify(flash_data_task, 0, eNoAction);
+}
+
+uint32_t dbuf_append(uint32_t segment, uint16_t code, uint8_t *data, uint32_t size,
+                     int low_res_time)
+{
+    uint8_t *buf = reserve_event(&segment, code, size, true, low_res_time);
+
+    if (buf) {
+        if (size)
+            memcpy(buf, data, size);
+        dbuf_commit(size);
+    }
 
     return segment;
 }
     
 /*
- * Search for a buffer to write to flash. Fill the target buffer and return the
- * size currently used if there is something to send, otherwise return zero. If
- * some of the buffer has been successfully posted then the start of the
- * non-written elements is set. The full buffer is always copied, to get the
- * trailing ones, and because the flash write might fail and the entire buffer
- * might need to be re-written to the next flash sector.
+ * Search for a buffer to write to flash. Return a pointer to the buffer data
+ * if there is something to save, otherwise return NULL. The size currently used
+ * is set, and if some of the buffer has already been saved then the start of
+ * the non-written elements is set.
  *
  * The buffers are always returned in the order of their index, so this starts
  * searching at the tail of the buffer FIFO, and if nothing else then see if the
  * current buffer could be usefully saved.
  *
- * A copy of the buffer is made to allow the dbufs_sem to be released quickly.
+ * The buffer is not copied, rather it is pinned which prevents it being
+ * re-initialized until note_buffer_written() is called. Events may still be
+ * appended to a pinned buffer, but only past the returned size, so the data
+ * before the size is stable and may be read without holding the dbufs_sem. The
+ * bytes past the size may be changing, and the caller must use ones for these.
  *
- * On success note_buffer_written() should be called to allow the buffer to be
- * freed and reused, and the index is at the head of the buffer.
+ * The note_buffer_written() function must be called to unpin the buffer, even
+ * if the write failed, and on success this allows the buffer to be freed and
+ * reused. The index is at the head of the buffer.
  *
  * It is assumed that the memory resident buffers are saved well before the RTC
  * time used here can wrap.
  */
 
-uint32_t get_buffer_to_write(uint8_t *buf, uint32_t *start)
+uint8_t *get_buffer_to_write(uint32_t *size, uint32_t *start)
 {
-    uint32_t size = 0;
-
     xSemaphoreTake(dbufs_sem, portMAX_DELAY);
 
     if (dbufs_tail != dbufs_head) {
         dbuf_t *dbuf = &dbufs[dbufs_tail];
         if (dbuf->size > dbuf->save_size) {
-            uint32_t j;
-            size = dbuf->size;
-            for (j = 0; j < DBUF_DATA_SIZE; j++)
-                buf[j] = dbuf->data[j];
+            dbuf->pinned = 1;
+            *size = dbuf->size;
             *start = dbuf->save_size;
             xSemaphoreGive(dbufs_sem);
-            return size;
+            return dbuf->data;
         }
         xSemaphoreGive(dbufs_sem);
-        return 0;
+        return NULL;
+    }
+
+    if (dbuf_full_only) {
+        xSemaphoreGive(dbufs_sem);
+        return NULL;
     }
 
     /* Otherwise check if the head buffer needs to be saved.  Don't bother
-     * saving a sector with only an index. */
+     * saving a sector with only an index and no events. */
     dbuf_t *head = &dbufs[dbufs_head];
-    if (head->size > 8 && head->size > head->save_size) {
+    if (head->size > dbuf_empty_size && head->size > head->save_size) {
         uint32_t delta = RTC.COUNTER - head->write_time;
         // Currently about 120 seconds.
         if (delta > 20000000) {
-            uint32_t j;
-            size = head->size;
-            for (j = 0; j < DBUF_DATA_SIZE; j++)
-                buf[j] = head->data[j];
+            head->pinned = 1;
+            *size = head->size;
             *start = head->save_size;
             xSemaphoreGive(dbufs_sem);
-            return size;
+            return head->data;
         }
     }
 
     xSemaphoreGive(dbufs_sem);
-    return 0;
+    return NULL;
 }
 
 /*
@@ -527,14 +745,19 @@ uint32_t get_buffer_to_write(uint8_t *buf, uint32_t *start)
  * saved and only then can it be freed. The head buffer is never freed as it
  * likely has room for more events.
  *
- * The buffer might have wrapped and been re-used, in which case it has already
- * been freed.
+ * The buffer can not wrap and be re-used while pinned, but it might have been
+ * discarded by a reset in which case the index is not found.
  */
 void note_buffer_written(uint32_t index, uint32_t size)
 {
     xSemaphoreTake(dbufs_sem, portMAX_DELAY);
 
-    uint32_t i = dbufs_tail;
+    /* Unpin the buffer. It might not be live if the buffers were reset. */
+    uint32_t i;
+    for (i = 0; i < NUM_DBUFS; i++)
+        dbufs[i].pinned = 0;
+
+    i = dbufs_tail;
     while (1) {
         if (dbuf_index(i) == index)
             break;
@@ -574,24 +797,23 @@ void note_buffer_written(uint32_t index, uint32_t size)
 
 /*
  * Reset the buffers, discarding any data in them. The current segment index is
- * is not reset here but dbuf_stream_restart_required is set.
+ * is not reset here but dbuf_stream_restart_required is set. A buffer pinned by
+ * the flash writer is left untouched, and is not live after the reset.
  */
 void reset_dbuf()
 {
+    xSemaphoreTake(dbuf_reserve_sem, portMAX_DELAY);
     xSemaphoreTake(dbufs_sem, portMAX_DELAY);
 
-    dbufs_head = 0;
-    dbufs_tail = 0;
+    dbufs_head = dbufs[0].pinned ? 1 : 0;
+    dbufs_tail = dbufs_head;
     initialize_dbuf(dbufs_head);
     set_dbuf_index(dbufs_head, 0);
-    dbufs[dbufs_head].size = 8;
-
-    last_code = 0;
-    last_size = 0;
-    last_time = 0;
+    start_dbuf_events(dbufs_head);
     dbuf_stream_restart_required = true;
 
     xSemaphoreGive(dbufs_sem);
+    xSemaphoreGive(dbuf_reserve_sem);
 }
 
 
@@ -607,14 +829,12 @@ void user_init(void)
     initialize_dbuf(dbufs_head);
     uint32_t last_index = init_flash();
     set_dbuf_index(dbufs_head, last_index);
-    dbufs[dbufs_head].size = 8;
+    start_dbuf_events(dbufs_head);
 
     current_segment = 0;
-    last_code = 0;
-    last_size = 0;
-    last_time = 0;
 
     dbufs_sem = xSemaphoreCreateMutex();
+    dbuf_reserve_sem = xSemaphoreCreateMutex();
 
     /* Set the flag directly to avoid logging an event. */
     dbuf_logging_enabled = param_logging;
@@ -651,6 +871,7 @@ void user_init(void)
     init_bmp180();
     init_bme280();
     init_ds3231();
+    init_i2c_sensors();
 
     init_web();
     init_post();
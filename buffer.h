@@ -21,11 +21,15 @@
 
 bool get_buffer_logging(void);
 bool set_buffer_logging(bool enable);
-uint32_t get_buffer_to_write(uint8_t *buf, uint32_t *start);
+void set_buffer_rc(bool enable);
+uint8_t *get_buffer_to_write(uint32_t *size, uint32_t *start);
 void note_buffer_written(uint32_t index, uint32_t size);
 uint32_t dbuf_head_index();
 uint32_t dbuf_append(uint32_t index, uint16_t code, uint8_t *data, uint32_t size,
                      int low_res_time);
+uint8_t *dbuf_reserve(uint32_t *segment, uint16_t code, uint32_t max_size,
+                      int low_res_time);
+void dbuf_commit(uint32_t size);
 void reset_dbuf(void);
 
 uint32_t emit_leb128(uint8_t *buf, uint32_t start, uint64_t v);
@@ -61,3 +65,42 @@ uint32_t emit_leb128_signed(uint8_t *buf, uint32_t start, int64_t v);
 #define DBUF_EVENT_PAUSE_LOGGING 14
 
 #define DBUF_EVENT_TEXT_MESSAGE 15
+
+/* The PMS events with the values coded using an adaptive Rice code, see
+ * pms.c. */
+#define DBUF_EVENT_PMS3003_RICE 16
+#define DBUF_EVENT_PMS5003_RICE 17
+
+/* A count of repeats of the last PMS event in the buffer, with identical
+ * values and checksum, logged when the run ends. */
+#define DBUF_EVENT_PMS_REPEAT 18
+
+/* A summary of the samples of another event over a period, see aggregate.c. */
+#define DBUF_EVENT_AGGREGATE 19
+
+/* A PMS duty cycle state transition, see pms.c. */
+#define DBUF_EVENT_PMS_STATE 20
+
+/* The PMS events with the values predicted from the prior channel, and the
+ * predictor weights, see pms.c. */
+#define DBUF_EVENT_PMS3003_PREDICT 21
+#define DBUF_EVENT_PMS5003_PREDICT 22
+#define DBUF_EVENT_PMS_WEIGHTS 23
+
+/* Flags a flash sector holding range coded buffers, see flash.c. */
+#define DBUF_EVENT_RC_SECTOR 24
+
+/* The first event of a buffer with the event times predicted, see buffer.c. */
+#define DBUF_EVENT_TIME_PREDICT 25
+
+/* A sensor event with the channels delta, or delta-of-delta, encoded and zero
+ * residuals elided, see delta.c. */
+#define DBUF_EVENT_DELTA_SET 26
+
+/* The range coding of the flash sectors was enabled but there was not the
+ * memory for it, so the sectors are written in the usual format, see flash.c. */
+#define DBUF_EVENT_RC_FALLBACK 27
+
+/* Added to the PMS event codes for the events of a second PMS sensor, and to
+ * the source code of its summary events. The PMS_STATE event is common. */
+#define DBUF_EVENT_PMS_SENSOR2 32
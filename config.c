@@ -33,9 +33,27 @@
  */
 uint8_t param_leds;
 uint8_t param_pms_uart;
+uint8_t param_pms2_gpio;
+uint32_t param_pms_period;
+uint8_t param_pms_warmup;
+uint8_t param_pms_samples;
+uint8_t param_pms_predict;
 uint8_t param_i2c_scl;
 uint8_t param_i2c_sda;
 uint8_t param_logging;
+uint32_t param_aggregate_period;
+uint8_t param_aggregate_raw;
+uint8_t param_delta_mode;
+uint8_t param_sht2x_resolution;
+uint32_t param_sht2x_period;
+uint8_t param_bmp180_oversampling;
+uint32_t param_bmp180_period;
+uint8_t param_bme280_forced;
+uint8_t param_bme280_oversampling;
+uint32_t param_bme280_period;
+uint32_t param_ds3231_period;
+uint8_t param_flash_rc;
+uint8_t param_time_predict;
 char *param_web_server;
 char param_web_port[7];
 char *param_web_path;
@@ -49,9 +67,27 @@ void init_params()
 
     param_leds = 1;
     param_pms_uart = 2;
+    param_pms2_gpio = 255;
+    param_pms_period = 0;
+    param_pms_warmup = 30;
+    param_pms_samples = 10;
+    param_pms_predict = 0;
     param_i2c_scl = 5;
     param_i2c_sda = 4;
     param_logging = 1;
+    param_aggregate_period = 0;
+    param_aggregate_raw = 0;
+    param_delta_mode = 0;
+    param_sht2x_resolution = 0;
+    param_sht2x_period = 10;
+    param_bmp180_oversampling = 3;
+    param_bmp180_period = 10;
+    param_bme280_forced = 0;
+    param_bme280_oversampling = 5;
+    param_bme280_period = 10;
+    param_ds3231_period = 180;
+    param_flash_rc = 0;
+    param_time_predict = 0;
     param_web_server = NULL;
     bzero(param_web_port, sizeof(param_web_port));
     param_web_path = NULL;
@@ -61,11 +97,32 @@ void init_params()
 
     sysparam_get_int8("oaq_leds", (int8_t *)&param_leds);
     sysparam_get_int8("oaq_pms_uart", (int8_t *)&param_pms_uart);
+    sysparam_get_int8("oaq_pms2_gpio", (int8_t *)&param_pms2_gpio);
+    sysparam_get_int32("oaq_pms_period", (int32_t *)&param_pms_period);
+    sysparam_get_int8("oaq_pms_warmup", (int8_t *)&param_pms_warmup);
+    sysparam_get_int8("oaq_pms_samples", (int8_t *)&param_pms_samples);
+    sysparam_get_int8("oaq_pms_predict", (int8_t *)&param_pms_predict);
     sysparam_get_int8("oaq_i2c_scl", (int8_t *)&param_i2c_scl);
     sysparam_get_int8("oaq_i2c_sda", (int8_t *)&param_i2c_sda);
 
     sysparam_get_int8("oaq_logging", (int8_t *)&param_logging);
 
+    sysparam_get_int32("oaq_agg_period", (int32_t *)&param_aggregate_period);
+    sysparam_get_int8("oaq_agg_raw", (int8_t *)&param_aggregate_raw);
+    sysparam_get_int8("oaq_delta_mode", (int8_t *)&param_delta_mode);
+
+    sysparam_get_int8("oaq_sht_res", (int8_t *)&param_sht2x_resolution);
+    sysparam_get_int32("oaq_sht_period", (int32_t *)&param_sht2x_period);
+    sysparam_get_int8("oaq_bmp180_os", (int8_t *)&param_bmp180_oversampling);
+    sysparam_get_int32("oaq_bmp180_period", (int32_t *)&param_bmp180_period);
+    sysparam_get_int8("oaq_bme_forced", (int8_t *)&param_bme280_forced);
+    sysparam_get_int8("oaq_bme_os", (int8_t *)&param_bme280_oversampling);
+    sysparam_get_int32("oaq_bme_period", (int32_t *)&param_bme280_period);
+    sysparam_get_int32("oaq_ds3231_period", (int32_t *)&param_ds3231_period);
+
+    sysparam_get_int8("oaq_flash_rc", (int8_t *)&param_flash_rc);
+    sysparam_get_int8("oaq_time_predict", (int8_t *)&param_time_predict);
+
     sysparam_get_string("oaq_web_server", &param_web_server);
     int32_t port = 80;
     sysparam_get_int32("oaq_web_port", &port);
@@ -33,10 +33,31 @@ extern uint8_t param_leds;
  *  0 - None, disabled (default).
  *  1 - UART0 on GPIO3 aka RX (Nodemcu pin D9).
  *  2 - UART0 swapped pins mode, GPIO13 (Nodemcu pin D7).
- *  3 - TODO Flipping between the above for two sensors?
  */
 extern uint8_t param_pms_uart;
 
+/*
+ * The GPIO number of a software UART receiving from a second PMS*003, or 255
+ * (default) for none. GPIO16 can not be used.
+ */
+extern uint8_t param_pms2_gpio;
+
+/*
+ * PMS*003 duty cycling. When the period, in seconds, is non-zero the sensor is
+ * put to sleep between bursts of 'pms_samples' samples, each burst following a
+ * warm-up of 'pms_warmup' seconds. This needs the sensor RX line connected to
+ * the UART0 TX line. Zero (default) leaves the sensor streaming.
+ */
+extern uint32_t param_pms_period;
+extern uint8_t param_pms_warmup;
+extern uint8_t param_pms_samples;
+
+/*
+ * PMS*003 cross-channel prediction, enabled if non-zero. Zero (default) codes
+ * the channel deltas directly.
+ */
+extern uint8_t param_pms_predict;
+
 /*
  * I2C bus pin definitions, GPIO numbers.
  *
@@ -53,6 +74,70 @@ extern uint8_t param_i2c_sda;
  */
 extern bool param_logging;
 
+/*
+ * The aggregation mode. When the period, in seconds, is non-zero the sensor
+ * values are summarized over this period and a summary event logged. The raw
+ * samples are then logged only once every 'aggregate_raw' samples, or not at
+ * all if this is zero.
+ */
+extern uint32_t param_aggregate_period;
+extern uint8_t param_aggregate_raw;
+
+/*
+ * The I2C sensor event format. Zero (default) logs each sensor's own events
+ * with the channels delta encoded. One logs the channel deltas in a common
+ * event, eliding the zero deltas, and two logs the delta-of-delta there, see
+ * delta.c.
+ */
+extern uint8_t param_delta_mode;
+
+/*
+ * The I2C sensor sampling. The periods are in seconds. These are read for each
+ * sample, and the web config page changes them at run time.
+ *
+ * The SHT2x resolution is: 0 - RH 12 bit, T 14 bit (default); 1 - RH 8 bit,
+ * T 12 bit; 2 - RH 10 bit, T 13 bit; 3 - RH 11 bit, T 11 bit. Its period
+ * defaults to 10 seconds.
+ *
+ * The BMP180 oversampling is 0 for x1 up to 3 (default) for x8, and its period
+ * defaults to 10 seconds.
+ *
+ * The DS3231 period defaults to 180 seconds.
+ */
+extern uint8_t param_sht2x_resolution;
+extern uint32_t param_sht2x_period;
+extern uint8_t param_bmp180_oversampling;
+extern uint32_t param_bmp180_period;
+extern uint32_t param_ds3231_period;
+
+/*
+ * BME280 and BMP280 sampling. If 'bme280_forced' is non-zero the sensor is
+ * sampled in the forced mode, converting only when sampled and without
+ * filtering, and when the PMS*003 is enabled the samples are started at a PMS
+ * frame so they share a time. Zero (default) leaves it converting continuously
+ * in the normal mode. The oversampling is 1 for x1 up to 5 (default) for x16,
+ * and the period is in seconds, defaulting to 10 seconds. The oversampling and
+ * period can be changed at run time, but not the mode.
+ */
+extern uint8_t param_bme280_forced;
+extern uint8_t param_bme280_oversampling;
+extern uint32_t param_bme280_period;
+
+/*
+ * Flash recompression, enabled if non-zero. The full buffers are range coded
+ * and packed into the flash sectors, see flash.c. The head buffer is then not
+ * flushed to flash so up to a buffer of data is lost on a restart. Zero
+ * (default) writes the buffers as is.
+ */
+extern uint8_t param_flash_rc;
+
+/*
+ * Event time prediction, enabled if non-zero. The time of each event is
+ * predicted from the recent period of its event code and only the error is
+ * coded, see buffer.c. Zero (default) codes the time delta from the last event.
+ */
+extern uint8_t param_time_predict;
+
 /*
  * Network parameters. If not sufficiently initialized to communicate with a
  * server then wifi is disabled and the post-data task is not created.
@@ -0,0 +1,160 @@
+/*
+ * Delta encoded sensor events.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The slow sensors log a set of channels, each delta encoded against the last
+ * value logged in the same segment, and the delta state is reset when the
+ * segment changes. Some opaque extra bytes, such as a checksum, may follow the
+ * channels.
+ *
+ * By default the event has the sensor's own code and the plain format: the
+ * leb128 delta of each channel, signed unless flagged unsigned.
+ *
+ * If 'delta_mode' is set then a DBUF_EVENT_DELTA_SET event is logged instead.
+ * This starts with a leb128 of the sensor's event code shifted left by one,
+ * with the lsb set for the delta-of-delta. Then a leb128 mask of the channels
+ * with a non-zero residual, and the signed leb128 residual of each of these
+ * channels. The residual is the delta, or with the lsb set the difference from
+ * the last delta. The deltas of the first value in a segment are from zero,
+ * and with the delta-of-delta the second value is coded as just its delta. So
+ * unchanging, or steadily changing, channels code to nothing.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "config.h"
+#include "delta.h"
+
+/* The largest event, with the leb128 code, the mask, and five bytes per
+ * channel. */
+#define DELTA_EVENT_MAX_SIZE(n) (8 + (n) * 5)
+
+static void reset_delta_set(delta_set_t *set)
+{
+    uint32_t i;
+    for (i = 0; i < set->num_channels; i++) {
+        set->channels[i].last = 0;
+        set->channels[i].last_delta = 0;
+    }
+    set->count = 0;
+}
+
+void init_delta_set(delta_set_t *set, uint16_t code, uint32_t num_channels,
+                    delta_channel_t *channels)
+{
+    set->code = code;
+    set->num_channels = num_channels;
+    set->channels = channels;
+    set->segment = 0;
+    reset_delta_set(set);
+}
+
+static uint32_t emit_delta_set(delta_set_t *set, int32_t *values, uint8_t *buf,
+                               uint8_t mode)
+{
+    uint32_t len = 0;
+    uint32_t i;
+
+    if (!mode) {
+        for (i = 0; i < set->num_channels; i++) {
+            delta_channel_t *channel = &set->channels[i];
+            int32_t delta = (uint32_t)values[i] - (uint32_t)channel->last;
+            if (channel->flags & DELTA_UNSIGNED)
+                len = emit_leb128(buf, len, (uint32_t)delta);
+            else
+                len = emit_leb128_signed(buf, len, delta);
+        }
+        return len;
+    }
+
+    bool delta2 = mode > 1;
+    int32_t residuals[32];
+    uint32_t mask = 0;
+
+    for (i = 0; i < set->num_channels; i++) {
+        delta_channel_t *channel = &set->channels[i];
+        int32_t delta = (uint32_t)values[i] - (uint32_t)channel->last;
+        int32_t residual = delta;
+        if (delta2 && set->count > 1)
+            residual = (uint32_t)delta - (uint32_t)channel->last_delta;
+        residuals[i] = residual;
+        if (residual)
+            mask |= 1u << i;
+    }
+
+    len = emit_leb128(buf, len, set->code << 1 | delta2);
+    len = emit_leb128(buf, len, mask);
+    for (i = 0; i < set->num_channels; i++) {
+        if (residuals[i])
+            len = emit_leb128_signed(buf, len, residuals[i]);
+    }
+
+    return len;
+}
+
+/*
+ * Log the values, followed by the extra bytes. At most 32 channels are
+ * supported.
+ */
+void log_delta_set(delta_set_t *set, int32_t *values, uint8_t *extra,
+                   uint32_t extra_size)
+{
+    uint8_t mode = param_delta_mode;
+    uint16_t code = mode ? DBUF_EVENT_DELTA_SET : set->code;
+    uint32_t max_size = DELTA_EVENT_MAX_SIZE(set->num_channels) + extra_size;
+
+    while (1) {
+        uint32_t new_segment = set->segment;
+        uint8_t *buf = dbuf_reserve(&new_segment, code, max_size, 1);
+        if (new_segment != set->segment) {
+            /* Moved on to a new buffer. Reset the delta encoding state and
+             * retry. */
+            set->segment = new_segment;
+            reset_delta_set(set);
+            continue;
+        }
+
+        if (buf) {
+            uint32_t len = emit_delta_set(set, values, buf, mode);
+            if (extra_size) {
+                memcpy(buf + len, extra, extra_size);
+                len += extra_size;
+            }
+            dbuf_commit(len);
+        }
+
+        break;
+    }
+
+    /*
+     * Commit the values logged. Note the caller is the only task accessing
+     * this state so these updates are synchronized with the last event of
+     * this set.
+     */
+    uint32_t i;
+    for (i = 0; i < set->num_channels; i++) {
+        delta_channel_t *channel = &set->channels[i];
+        channel->last_delta = (uint32_t)values[i] - (uint32_t)channel->last;
+        channel->last = values[i];
+    }
+    if (set->count < 2)
+        set->count++;
+}
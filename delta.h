@@ -0,0 +1,49 @@
+/*
+ * Delta encoded sensor events.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ */
+
+/* The channel delta is coded unsigned in the plain format, for a channel that
+ * does not decrease such as a time. */
+#define DELTA_UNSIGNED 1
+
+/*
+ * The delta encoding state for one channel, the last value logged and its
+ * delta. The flags are set by the caller.
+ */
+typedef struct {
+    uint8_t flags;
+    int32_t last;
+    int32_t last_delta;
+} delta_channel_t;
+
+typedef struct {
+    /* The event code of the plain format. */
+    uint16_t code;
+    uint32_t num_channels;
+    delta_channel_t *channels;
+    uint32_t segment;
+    /* The number of values logged in this segment, up to two. */
+    uint32_t count;
+} delta_set_t;
+
+void init_delta_set(delta_set_t *set, uint16_t code, uint32_t num_channels,
+                    delta_channel_t *channels);
+void log_delta_set(delta_set_t *set, int32_t *values, uint8_t *extra,
+                   uint32_t extra_size);
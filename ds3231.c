@@ -40,6 +40,8 @@
 #include "buffer.h"
 #include "i2c.h"
 #include "leds.h"
+#include "config.h"
+#include "delta.h"
 
 
 
@@ -124,86 +126,70 @@ bool ds3231_time_temp(uint32_t *counter, struct tm *time, float *temp)
     return true;
 }
 
-static void ds3231_read_task(void *pvParameters)
-{
-    /* Delta encoding state. */
-    uint32_t last_segment = 0;
-    time_t last_clock_time = 0;
-    int16_t last_temperature = 0;
-
-    xSemaphoreTake(i2c_sem, portMAX_DELAY);
+static delta_channel_t ds3231_delta_channels[2];
+static delta_set_t ds3231_delta;
 
+static bool ds3231_init(void)
+{
     bzero(&ds3231_time, sizeof(ds3231_time));
 
     struct tm time;
-    bool available = ds3231_getTime(&ds3231_dev, &time);
-
-    xSemaphoreGive(i2c_sem);
-    
-    if (!available)
-        vTaskDelete(NULL);
+    if (!ds3231_getTime(&ds3231_dev, &time))
+        return false;
 
-    for (;;) {
-        vTaskDelay(180000 / portTICK_PERIOD_MS);
+    /* The time is coded unsigned as it does not decrease. */
+    ds3231_delta_channels[0].flags = DELTA_UNSIGNED;
+    init_delta_set(&ds3231_delta, DBUF_EVENT_DS3231_TIME_TEMP, 2,
+                   ds3231_delta_channels);
+    return true;
+}
 
-        xSemaphoreTake(i2c_sem, portMAX_DELAY);
+static int32_t ds3231_start(void)
+{
+    return 0;
+}
 
-        if (!ds3231_getTime(&ds3231_dev, &time)) {
-            xSemaphoreGive(i2c_sem);
-            blink_red();
-            continue;
-        }
+static int32_t ds3231_poll(void)
+{
+    struct tm time;
+    if (!ds3231_getTime(&ds3231_dev, &time))
+        return -1;
 
-        time_t clock_time = mktime(&time);
-        int16_t temperature;
-        if (!ds3231_getRawTemp(&ds3231_dev, &temperature)) {
-            xSemaphoreGive(i2c_sem);
-            blink_red();
-            continue;
-        }
+    int16_t temperature;
+    if (!ds3231_getRawTemp(&ds3231_dev, &temperature))
+        return -1;
 
-        ds3231_available = true;
-        ds3231_counter = RTC.COUNTER;
-        ds3231_time = time;
-        ds3231_temperature = temperature;
-
-        xSemaphoreGive(i2c_sem);
-
-        while (1) {
-            uint8_t outbuf[12];
-            /* Delta encoding */
-            uint32_t time_delta = clock_time - last_clock_time;
-            uint32_t len = emit_leb128(outbuf, 0, time_delta);
-            int32_t temp_delta = (int32_t)temperature - (int32_t)last_temperature;
-            len = emit_leb128_signed(outbuf, len, temp_delta);
-            int32_t code = DBUF_EVENT_DS3231_TIME_TEMP;
-            uint32_t new_segment = dbuf_append(last_segment, code, outbuf, len, 1);
-            if (new_segment == last_segment)
-                break;
-
-            /* Moved on to a new buffer. Reset the delta encoding
-             * state and retry. */
-            last_segment = new_segment;
-            last_clock_time = 0;
-            last_temperature = 0;
-        };
-
-        blink_green();
+    ds3231_available = true;
+    ds3231_counter = RTC.COUNTER;
+    ds3231_time = time;
+    ds3231_temperature = temperature;
 
-        /*
-         * Commit the values logged. Note this is the only task
-         * accessing this state so these updates are synchronized
-         * with the last event of this class append.
-         */
-        last_clock_time = clock_time;
-        last_temperature = temperature;
-    }
+    return 0;
 }
 
+/*
+ * Log the measurement. Note this task is the only writer of the measurement
+ * so it can be read without holding the i2c_sem.
+ */
+static void ds3231_log(void)
+{
+    struct tm time = ds3231_time;
+    time_t clock_time = mktime(&time);
+    int16_t temperature = ds3231_temperature;
+
+    int32_t values[2] = {clock_time, temperature};
+    log_delta_set(&ds3231_delta, values, NULL, 0);
+}
 
-
+static i2c_sensor_t ds3231_sensor = {
+    .init = ds3231_init,
+    .start = ds3231_start,
+    .poll = ds3231_poll,
+    .log = ds3231_log,
+    .period = &param_ds3231_period,
+};
 
 void init_ds3231()
 {
-    xTaskCreate(&ds3231_read_task, "DS3231 reader", 224, NULL, 11, NULL);
+    add_i2c_sensor(&ds3231_sensor);
 }
@@ -36,13 +36,21 @@
  * number wrapping, but the node attempts to invalidate a bad sector written so
  * it might never be sent to the server.
  *
- * The sectors do not have a length encoding, rather the entire sector is always
- * posted to the server. Unused bytes are filled with ones, so the node might
- * omit trailing ones when sending a sector.
+ * The sectors do not have a length encoding within the data, rather unused
+ * bytes are filled with ones and the node omits trailing ones when sending a
+ * sector. The events never use the last word of a sector, nor the byte before
+ * it, and when a sector is sealed its fill length is recorded in the last word
+ * as a footer, so that the length can be found without reading the entire
+ * sector. At least one byte of ones always separates the event data from the
+ * footer, so decoders reading the raw sectors stop before it. The head sector
+ * found at start-up is sealed by the flash task, as a new sector is started.
  *
  * A new sector is started each time the node restarts, but to minimize
  * unnecessary writes of unused sectors a sector is not initialized until used.
  *
+ * Optionally the buffers are recompressed, packing a number of buffers into
+ * each sector, see below.
+ *
  */
 
 #include "espressif/esp_common.h"
@@ -59,8 +67,11 @@
 #include "sysparam.h"
 
 #include "buffer.h"
+#include "config.h"
+#include "flash.h"
 #include "leds.h"
 #include "push.h"
+#include "rc.h"
 
 /*
  * For a 32Mbit flash, or 4MB, there are 1024 flash sectors. The first 256 are
@@ -77,16 +88,57 @@
 #define BUFFER_FLASH_FIRST_SECTOR 256
 #define BUFFER_FLASH_NUM_SECTORS (1024 - BUFFER_FLASH_FIRST_SECTOR - 5 - DEFAULT_SYSPARAM_SECTORS)
 
+/* The offset of the footer word, holding the 16 bit fill length and its
+ * inverse, and the end of the data, which leaves a byte of ones before it. */
+#define FLASH_FOOTER_OFFSET (4096 - 4)
+#define FLASH_DATA_END (FLASH_FOOTER_OFFSET - 1)
+
+/*
+ * All the flash operations go through these wrappers, which count the
+ * operations to help measure the flash wear and bus time of the buffer
+ * management.
+ */
+static uint32_t flash_reads = 0;
+static uint32_t flash_read_bytes = 0;
+static uint32_t flash_writes = 0;
+static uint32_t flash_write_bytes = 0;
+static uint32_t flash_erases = 0;
+
+static sdk_SpiFlashOpResult flash_read(uint32_t addr, uint32_t *buf, uint32_t size)
+{
+    flash_reads++;
+    flash_read_bytes += size;
+    return sdk_spi_flash_read(addr, buf, size);
+}
+
+static sdk_SpiFlashOpResult flash_write(uint32_t addr, uint32_t *buf, uint32_t size)
+{
+    flash_writes++;
+    flash_write_bytes += size;
+    return sdk_spi_flash_write(addr, buf, size);
+}
+
+static sdk_SpiFlashOpResult flash_erase_sector(uint16_t sector)
+{
+    flash_erases++;
+    return sdk_spi_flash_erase_sector(sector);
+}
+
 /*
  * Read and decode a sector index, filling the index on success and returning 1,
- * otherwise returning 0.
+ * otherwise returning 0. If erased is not NULL it is set if the index words
+ * are all ones, as for an erased sector.
  */
-static uint32_t decode_flash_sector_index(uint16_t sector, uint32_t *index)
+static uint32_t decode_flash_sector_index(uint16_t sector, uint32_t *index,
+                                          bool *erased)
 {
     uint32_t addr = sector * 4096;
     uint32_t data[2];
     sdk_SpiFlashOpResult res;
-    res = sdk_spi_flash_read(addr, data, 8);
+    res = flash_read(addr, data, 8);
+    if (erased)
+        *erased = res == SPI_FLASH_RESULT_OK && data[0] == 0xffffffff &&
+            data[1] == 0xffffffff;
     if (res != SPI_FLASH_RESULT_OK) {
         return 0;
     }
@@ -98,11 +150,152 @@ static uint32_t decode_flash_sector_index(uint16_t sector, uint32_t *index)
     return 1;
 }
 
+static uint8_t flash_buf[4096];
+
+/*
+ * A RAM index of the flash sectors, so that searching for a buffer index does
+ * not need to read each sector index from flash. This is built at start-up and
+ * updated on each write, erase, and failure.
+ *
+ * Each entry is a 32 bit word: bit 31 is set if the sector holds a valid index;
+ * bits 30 to 18 hold the fill length, being the size without the trailing ones,
+ * or SECTOR_INDEX_FILL_UNKNOWN if not yet known; and bits 17 to 0 hold the low
+ * bits of the index. The full index is recovered relative to the largest index
+ * noted, which works as the live indexes span far less than 2^18.
+ *
+ * The fill length of a sealed sector does not change, so it is computed once
+ * when first needed and then cached.
+ */
+#define SECTOR_INDEX_VALID 0x80000000
+#define SECTOR_INDEX_FILL_SHIFT 18
+#define SECTOR_INDEX_FILL_UNKNOWN 0x1fff
+#define SECTOR_INDEX_MASK 0x0003ffff
+/* Not yet read from flash, which is done on the first lookup. */
+#define SECTOR_INDEX_UNKNOWN (SECTOR_INDEX_FILL_UNKNOWN << SECTOR_INDEX_FILL_SHIFT)
+/* Not valid, with the index words all ones, as erased. */
+#define SECTOR_INDEX_ERASED 1
+static uint32_t sector_index[BUFFER_FLASH_NUM_SECTORS];
+/* The largest index noted, and the reference for decoding the index bits. */
+static uint32_t sector_index_largest;
+
+static void set_sector_index(uint16_t sector, uint32_t index, uint32_t fill)
+{
+    if (index > sector_index_largest)
+        sector_index_largest = index;
+    sector_index[sector - BUFFER_FLASH_FIRST_SECTOR] = SECTOR_INDEX_VALID |
+        fill << SECTOR_INDEX_FILL_SHIFT | (index & SECTOR_INDEX_MASK);
+}
+
+static void invalidate_sector_index(uint16_t sector)
+{
+    sector_index[sector - BUFFER_FLASH_FIRST_SECTOR] = 0;
+}
+
+/* Re-read a sector index from flash, such as after a failure. */
+static void refresh_sector_index(uint16_t sector)
+{
+    uint32_t index;
+    bool erased;
+    if (decode_flash_sector_index(sector, &index, &erased)) {
+        set_sector_index(sector, index, SECTOR_INDEX_FILL_UNKNOWN);
+    } else {
+        sector_index[sector - BUFFER_FLASH_FIRST_SECTOR] = erased ? SECTOR_INDEX_ERASED : 0;
+    }
+}
+
+/* Lookup a sector index, filling the index and returning 1 if valid, otherwise
+ * returning 0. */
+static uint32_t get_sector_index(uint16_t sector, uint32_t *index)
+{
+    uint32_t entry = sector_index[sector - BUFFER_FLASH_FIRST_SECTOR];
+    if (entry == SECTOR_INDEX_UNKNOWN) {
+        refresh_sector_index(sector);
+        entry = sector_index[sector - BUFFER_FLASH_FIRST_SECTOR];
+    }
+    if (!(entry & SECTOR_INDEX_VALID))
+        return 0;
+
+    uint32_t delta = ((sector_index_largest & SECTOR_INDEX_MASK) - entry) & SECTOR_INDEX_MASK;
+    *index = sector_index_largest - delta;
+    return 1;
+}
+
+/*
+ * Read the footer of a sealed sector, filling the fill length and returning 1
+ * if valid, otherwise 0. A sector that was not sealed, such as one written
+ * before the footer was used, might hold event data in the last word that
+ * happens to decode as a footer, so the claimed fill is also checked against
+ * the data: the last byte of the data is not a one, and the bytes following it
+ * up to the next word and in the word after are ones.
+ */
+static uint32_t read_sector_footer(uint16_t sector, uint32_t *fill)
+{
+    uint32_t addr = sector * 4096;
+    uint32_t footer;
+    sdk_SpiFlashOpResult res;
+    res = flash_read(addr + FLASH_FOOTER_OFFSET, &footer, 4);
+    uint32_t size = footer & 0xffff;
+    if (res != SPI_FLASH_RESULT_OK || (footer >> 16) != (size ^ 0xffff) ||
+        size == 0 || size > FLASH_DATA_END) {
+        return 0;
+    }
+
+    uint32_t start = (size - 1) & 0xfffffffc;
+    uint32_t end = start + 8;
+    if (end > FLASH_FOOTER_OFFSET)
+        end = FLASH_FOOTER_OFFSET;
+    uint32_t data[2];
+    res = flash_read(addr + start, data, end - start);
+    if (res != SPI_FLASH_RESULT_OK)
+        return 0;
+    uint8_t *bytes = (uint8_t *)data;
+    if (bytes[size - 1 - start] == 0xff)
+        return 0;
+    uint32_t i;
+    for (i = size - start; i < end - start; i++) {
+        if (bytes[i] != 0xff)
+            return 0;
+    }
+
+    *fill = size;
+    return 1;
+}
+
+/* Lookup the fill length of a sector with a valid index, reading the sector
+ * from flash if not yet known. Returns 1 on success, otherwise 0. */
+static uint32_t get_sector_fill(uint16_t sector, uint32_t *fill)
+{
+    uint32_t entry = sector_index[sector - BUFFER_FLASH_FIRST_SECTOR];
+    uint32_t size = (entry >> SECTOR_INDEX_FILL_SHIFT) & SECTOR_INDEX_FILL_UNKNOWN;
+
+    if (size == SECTOR_INDEX_FILL_UNKNOWN) {
+        /* Firstly try the footer of a sealed sector. */
+        if (!read_sector_footer(sector, &size)) {
+            /* Not sealed, so scan for the trailing ones. */
+            sdk_SpiFlashOpResult res;
+            res = flash_read(sector * 4096, (uint32_t *)flash_buf, 4096);
+            if (res != SPI_FLASH_RESULT_OK)
+                return 0;
+            for (size = 4096; size > 0; size--) {
+                if (flash_buf[size - 1] != 0xff)
+                    break;
+            }
+        }
+        entry &= ~(SECTOR_INDEX_FILL_UNKNOWN << SECTOR_INDEX_FILL_SHIFT);
+        sector_index[sector - BUFFER_FLASH_FIRST_SECTOR] = entry | size << SECTOR_INDEX_FILL_SHIFT;
+    }
+
+    *fill = size;
+    return 1;
+}
+
 /*
  * Find the sector with the largest valid index, returning 1 on success or 0 on
- * failure, and filling the sector and index on success.
+ * failure, and filling the sector and index on success. This reads the index
+ * of every sector not already in the RAM sector index so it is slow, but it is
+ * robust to inconsistent data.
  */
-static int find_most_recent_sector(uint16_t *most_recent_sector,
+static int scan_most_recent_sector(uint16_t *most_recent_sector,
                                    uint32_t *largest_index)
 {
     uint16_t sector;
@@ -115,8 +308,9 @@ static int find_most_recent_sector(uint16_t *most_recent_sector,
          sector < BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS;
          sector++) {
         uint32_t index;
-        if (decode_flash_sector_index(sector, &index) &&
-            index >= *largest_index) {
+        if (!get_sector_index(sector, &index))
+            continue;
+        if (index >= *largest_index) {
             *most_recent_sector = sector;
             *largest_index = index;
         }
@@ -135,7 +329,7 @@ static int find_most_recent_sector(uint16_t *most_recent_sector,
         if (sector >= BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS)
             sector = BUFFER_FLASH_FIRST_SECTOR;
         uint32_t index;
-        if (decode_flash_sector_index(sector, &index) &&
+        if (get_sector_index(sector, &index) &&
             index == *largest_index) {
             *most_recent_sector = sector;
         }
@@ -144,6 +338,124 @@ static int find_most_recent_sector(uint16_t *most_recent_sector,
     return 1;
 }
 
+/*
+ * The sectors are written in order around the ring with non-decreasing
+ * indexes, so the ring is a rotated sorted sequence and the head can be found
+ * with a binary search. Some sectors might be bad, so each probe scans forward
+ * a few sectors for a valid index. The sectors past the head of a ring not yet
+ * filled are erased, so a probe finding only erased sectors is taken to be
+ * past the head. A failed write also leaves an erased sector, but the writes
+ * are retried on only a few sectors, so the head found is confirmed by
+ * checking that it is followed by a smaller index, or by a run of
+ * FLASH_ERASED_SECTORS sectors without a valid index. A probe finding only
+ * corrupt indexes, or inconsistent data, falls back to the full scan.
+ */
+#define FLASH_PROBE_SECTORS 8
+#define FLASH_ERASED_SECTORS 32
+
+#define FLASH_PROBE_FOUND 0
+#define FLASH_PROBE_ERASED 1
+#define FLASH_PROBE_CORRUPT 2
+
+static uint32_t probe_sector_index(uint32_t pos, uint32_t *found_pos, uint32_t *index)
+{
+    uint32_t result = FLASH_PROBE_ERASED;
+    uint32_t i;
+    for (i = 0; i < FLASH_PROBE_SECTORS && pos < BUFFER_FLASH_NUM_SECTORS; i++, pos++) {
+        if (get_sector_index(BUFFER_FLASH_FIRST_SECTOR + pos, index)) {
+            *found_pos = pos;
+            return FLASH_PROBE_FOUND;
+        }
+        if (sector_index[pos] != SECTOR_INDEX_ERASED)
+            result = FLASH_PROBE_CORRUPT;
+    }
+    return result;
+}
+
+/*
+ * Find the sector with the largest valid index, as for scan_most_recent_sector()
+ * but using a binary search over the ring. Sectors after the head hold older
+ * indexes than the first sector, or are erased, so the head is the last sector
+ * with an index not less than the first sector. If the data is not consistent
+ * then this falls back to the full scan. The RAM sector index entries not read
+ * here are read on their first lookup.
+ */
+static int find_most_recent_sector(uint16_t *most_recent_sector,
+                                   uint32_t *largest_index)
+{
+    uint32_t i;
+
+    for (i = 0; i < BUFFER_FLASH_NUM_SECTORS; i++)
+        sector_index[i] = SECTOR_INDEX_UNKNOWN;
+    sector_index_largest = 0;
+
+    uint32_t first_index;
+    uint32_t lo;
+    uint32_t probe = probe_sector_index(0, &lo, &first_index);
+    if (probe == FLASH_PROBE_ERASED) {
+        /* Empty if there is no valid index in the first sectors, else failed
+         * writes at the start so check them all. */
+        for (i = FLASH_PROBE_SECTORS; i < FLASH_ERASED_SECTORS; i++) {
+            uint32_t index;
+            if (get_sector_index(BUFFER_FLASH_FIRST_SECTOR + i, &index))
+                return scan_most_recent_sector(most_recent_sector, largest_index);
+        }
+        return 0;
+    }
+    if (probe != FLASH_PROBE_FOUND)
+        return scan_most_recent_sector(most_recent_sector, largest_index);
+
+    /* The sector at lo has an index not less than the first index, and the
+     * sector at hi does not, or is erased, or is past the end. */
+    uint32_t lo_index = first_index;
+    uint32_t hi = BUFFER_FLASH_NUM_SECTORS;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        uint32_t pos, index;
+        probe = probe_sector_index(mid, &pos, &index);
+        if (probe == FLASH_PROBE_CORRUPT) {
+            /* Bad sectors, so check them all. */
+            return scan_most_recent_sector(most_recent_sector, largest_index);
+        }
+        if (probe == FLASH_PROBE_FOUND && index >= first_index) {
+            if (pos >= hi || index < lo_index) {
+                /* Not sorted. */
+                return scan_most_recent_sector(most_recent_sector, largest_index);
+            }
+            lo = pos;
+            lo_index = index;
+        } else {
+            hi = mid;
+        }
+    }
+
+    /* Check the sectors following the head for the successor, which should
+     * hold a smaller index, or be erased. A write failure might have left the
+     * same index in the following sectors, and the most recent of these is the
+     * head, and might have left erased sectors before a larger index. */
+    uint32_t pos = lo;
+    uint32_t run = 0;
+    for (i = 1; i < BUFFER_FLASH_NUM_SECTORS && run < FLASH_ERASED_SECTORS; i++, run++) {
+        if (++pos >= BUFFER_FLASH_NUM_SECTORS)
+            pos = 0;
+        uint32_t index;
+        if (get_sector_index(BUFFER_FLASH_FIRST_SECTOR + pos, &index)) {
+            if (index < lo_index)
+                break;
+            if (index > lo_index) {
+                /* Not sorted. */
+                return scan_most_recent_sector(most_recent_sector, largest_index);
+            }
+            lo = pos;
+            run = 0;
+        }
+    }
+
+    *most_recent_sector = BUFFER_FLASH_FIRST_SECTOR + lo;
+    *largest_index = lo_index;
+    return 1;
+}
+
 /* The head of the flash sector ring buffer. */
 static uint16_t flash_sector;
 /* Flag to support lazy initialization of the current sector. */
@@ -154,7 +466,6 @@ TaskHandle_t flash_data_task = NULL;
 
 /* For protecting access to the flash state. */
 SemaphoreHandle_t flash_state_sem = NULL;
-static uint8_t flash_buf[4096];
 
 
 /* Check if a flash sector is erased, returning 1 if erased and 0 if
@@ -167,7 +478,7 @@ static int flash_sector_erased(uint16_t sector)
     for (i = 0; i < 4096; i += 16) {
         uint32_t data[4];
         sdk_SpiFlashOpResult res;
-        res = sdk_spi_flash_read(addr + i, data, 16);
+        res = flash_read(addr + i, data, 16);
         if (res != SPI_FLASH_RESULT_OK) {
             return 0;
         }
@@ -180,29 +491,110 @@ static int flash_sector_erased(uint16_t sector)
     return 1;
 }
 
-/* Compare a flash sector to the contents of a buffer, returning 1 if
- * equal and 0 if not. */
-static int check_flash_sector(uint16_t sector, uint32_t *buf)
+/*
+ * Write the range [start, end) of a buffer to the same offset in a flash
+ * sector, returning 1 on success and 0 on failure. The start is rounded down to
+ * a word boundary and the buffer bytes before the start are assumed stable. The
+ * buffer may be appended to past the end while this is in progress, so the
+ * bytes past the end are not read, rather the last partial word is padded with
+ * ones which leaves those flash bytes erased.
+ */
+static int write_flash_range(uint16_t sector, uint8_t *buf, uint32_t start, uint32_t end)
 {
     uint32_t addr = sector * 4096;
-    int i;
+    uint32_t aligned_start = start & 0xfffffffc;
+    uint32_t aligned_end = end & 0xfffffffc;
+    sdk_SpiFlashOpResult res;
+
+    if (aligned_end > aligned_start) {
+        res = flash_write(addr + aligned_start, (uint32_t *)(buf + aligned_start),
+                          aligned_end - aligned_start);
+        if (res != SPI_FLASH_RESULT_OK)
+            return 0;
+    }
+
+    if (end & 3) {
+        uint32_t word = 0xffffffff;
+        memcpy(&word, buf + aligned_end, end & 3);
+        res = flash_write(addr + aligned_end, &word, 4);
+        if (res != SPI_FLASH_RESULT_OK)
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Compare the range [start, end) of a flash sector to the contents of a
+ * buffer, returning 1 if equal and 0 if not. The range is word aligned, and the
+ * bytes past the end are expected to be ones, as written above. */
+static int check_flash_range(uint16_t sector, uint8_t *buf, uint32_t start, uint32_t end)
+{
+    uint32_t addr = sector * 4096;
+    uint32_t i = start & 0xfffffffc;
 
-    for (i = 0; i < 4096; i += 16, buf += 4) {
+    while (i < end) {
         uint32_t data[4];
+        uint32_t size = (end - i + 3) & 0xfffffffc;
+        if (size > 16)
+            size = 16;
         sdk_SpiFlashOpResult res;
-        res = sdk_spi_flash_read(addr + i, data, 16);
+        res = flash_read(addr + i, data, size);
         if (res != SPI_FLASH_RESULT_OK) {
             return 0;
         }
-        if (data[0] != buf[0] || data[1] != buf[1] ||
-            data[2] != buf[2] || data[3] != buf[3]) {
-            return 0;
+        uint32_t j;
+        for (j = 0; j < size / 4; j++, i += 4) {
+            uint32_t word = 0xffffffff;
+            memcpy(&word, buf + i, end - i < 4 ? end - i : 4);
+            if (data[j] != word) {
+                return 0;
+            }
         }
     }
 
     return 1;
 }
 
+/*
+ * Read the range [start, end) of a flash sector. Only the words covering the
+ * range are read, directly into the buffer when the start and the buffer are
+ * word aligned, otherwise via the flash_buf.
+ */
+static sdk_SpiFlashOpResult read_flash_range(uint16_t sector, uint32_t start,
+                                             uint32_t end, uint8_t *buf)
+{
+    uint32_t addr = sector * 4096;
+    sdk_SpiFlashOpResult res;
+
+    if (end <= start)
+        return SPI_FLASH_RESULT_OK;
+
+    if ((start & 3) == 0 && ((uintptr_t)buf & 3) == 0) {
+        uint32_t size = (end - start) & 0xfffffffc;
+        if (size > 0) {
+            res = flash_read(addr + start, (uint32_t *)buf, size);
+            if (res != SPI_FLASH_RESULT_OK)
+                return res;
+        }
+        if (size < end - start) {
+            uint32_t word;
+            res = flash_read(addr + start + size, &word, 4);
+            if (res != SPI_FLASH_RESULT_OK)
+                return res;
+            memcpy(buf + size, &word, end - start - size);
+        }
+        return SPI_FLASH_RESULT_OK;
+    }
+
+    uint32_t aligned_start = start & 0xfffffffc;
+    uint32_t aligned_end = (end + 3) & 0xfffffffc;
+    res = flash_read(addr + aligned_start, (uint32_t *)(flash_buf + aligned_start),
+                     aligned_end - aligned_start);
+    if (res == SPI_FLASH_RESULT_OK)
+        memcpy(buf, flash_buf + start, end - start);
+    return res;
+}
+
 /* Log failures. Perhaps log an event for these. */
 static uint32_t flash_write_failures = 0;
 static uint32_t flash_index_invalidate_failures = 0;
@@ -213,27 +605,307 @@ static void handle_flash_write_failure()
     flash_write_failures++;
     /* If the index is invalid then just move on. */
     uint32_t flash_index;
-    if (decode_flash_sector_index(flash_sector, &flash_index)) {
+    if (decode_flash_sector_index(flash_sector, &flash_index, NULL)) {
         /* If the index decodes as valid then attempt to erase the sector to at
          * least invalidate the index. */
-        sdk_spi_flash_erase_sector(flash_sector);
+        flash_erase_sector(flash_sector);
         taskYIELD();
-        if (decode_flash_sector_index(flash_sector, &flash_index)) {
+        if (decode_flash_sector_index(flash_sector, &flash_index, NULL)) {
             /* Log the failure. */
             flash_index_invalidate_failures++;
         }
     }
+    refresh_sector_index(flash_sector);
     flash_sector++;
     if (flash_sector >= BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS)
         flash_sector = BUFFER_FLASH_FIRST_SECTOR;
     flash_sector_initialized = 0;
 }
 
+/*
+ * Record the fill length in the footer of a sector that will not be written
+ * again. If this fails then the fill length is found by scanning the sector.
+ * A sector written before the footer was used might have data up to the
+ * footer, and is not sealed.
+ */
+static void seal_flash_sector(uint16_t sector)
+{
+    uint32_t index, fill;
+    if (!get_sector_index(sector, &index) || !get_sector_fill(sector, &fill) ||
+        fill > FLASH_DATA_END)
+        return;
+    uint32_t footer = fill | (fill ^ 0xffff) << 16;
+    flash_write(sector * 4096 + FLASH_FOOTER_OFFSET, &footer, 4);
+}
+
 /* A flag to note if new data might be available to help avoid a full check each
  * time. Set when new data is written and cleared when no data to post is
  * found. */
 static volatile uint32_t maybe_flash_to_post = 1;
 
+/* The fill length of a buffer, being the size without the trailing ones. */
+static uint32_t buffer_fill(uint8_t *buf, uint32_t size)
+{
+    while (size > 0 && buf[size - 1] == 0xff)
+        size--;
+    return size;
+}
+
+/*
+ * Write a buffer to the uninitialized flash_sector, moving on to the next
+ * sector on failure.
+ */
+static void write_new_flash_sector(uint8_t *buf, uint32_t size, uint32_t index)
+{
+    /* Retry a limited number of times on write failures. */
+    int retries = 0;
+    while (1) {
+        /* Firstly check if it is erased. */
+        if (!flash_sector_erased(flash_sector)) {
+            /* Erase the flash_sector. */
+            sdk_SpiFlashOpResult res;
+            res = flash_erase_sector(flash_sector);
+            taskYIELD();
+            if (res != SPI_FLASH_RESULT_OK ||
+                !flash_sector_erased(flash_sector)) {
+                /* Just fall through and try the write, it might still
+                 * work. */
+            }
+        }
+        invalidate_sector_index(flash_sector);
+        /* Write the sector. The remainder of the sector is expected to
+         * be erased. */
+        int ok = write_flash_range(flash_sector, buf, 0, size);
+        taskYIELD();
+        if (!ok || !check_flash_range(flash_sector, buf, 0, size)) {
+            handle_flash_write_failure();
+            if (++retries > 8) {
+                /* Give up, consider it written. */
+                break;
+            }
+            continue;
+        }
+        /* Success. */
+        set_sector_index(flash_sector, index, buffer_fill(buf, size));
+        flash_sector_initialized = 1;
+        break;
+    }
+}
+
+/* Seal the current sector, and move on to the next. */
+static void next_flash_sector()
+{
+    seal_flash_sector(flash_sector);
+    taskYIELD();
+    flash_sector++;
+    if (flash_sector >= BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS)
+        flash_sector = BUFFER_FLASH_FIRST_SECTOR;
+    flash_sector_initialized = 0;
+}
+
+/*
+ * Optional recompression. When 'flash_rc' is set only the full buffers are
+ * written, not the head buffer, and each is compressed using the range coder
+ * and appended as a chunk to a packed sector, so that a sector holds more than
+ * one buffer. The head buffer is then only in memory until full, and lost on a
+ * restart.
+ *
+ * A packed sector starts with the index of its first buffer, as usual, and
+ * then a DBUF_EVENT_RC_SECTOR event with no data which flags the format. This
+ * is followed by the chunks, each with a four byte header holding the coded
+ * size and the buffer size as 16 bit little endian numbers, and then the coded
+ * data. The chunks hold consecutive buffers from the sector index, and each
+ * decodes to the buffer including its index. A buffer that does not compress
+ * to fit an empty packed sector is written in the usual format. The host
+ * tool test/rcunpack.c unpacks these sectors.
+ *
+ * To save memory the image of the current packed sector is not kept, rather
+ * each chunk is coded into the flash_buf at its offset, and after a write
+ * failure the prior chunks, which were verified when written, are read back
+ * from the failed sector so that all the chunks can be written to the next
+ * sector. Only the model is allocated, and only when enabled.
+ */
+static rc_model_t *rc_model = NULL;
+/* The fill of the current packed sector, or zero if none. */
+static uint32_t rc_fill = 0;
+static uint32_t rc_first_index;
+static uint32_t rc_last_index;
+
+/* Emit the packed sector header, returning its size, which is
+ * RC_SECTOR_HEADER_SIZE. */
+static uint32_t emit_rc_sector_header(uint8_t *buf, uint32_t index)
+{
+    buf[0] = index;
+    buf[1] = index >> 8;
+    buf[2] = index >> 16;
+    buf[3] = index >> 24;
+    buf[4] = ~index;
+    buf[5] = ~index >> 8;
+    buf[6] = ~index >> 16;
+    buf[7] = ~index >> 24;
+    uint32_t len = emit_leb128(buf, 8, DBUF_EVENT_RC_SECTOR << 2 | 1);
+    len = emit_leb128(buf, len, 0);
+    return emit_leb128(buf, len, 0);
+}
+
+/*
+ * Write a full buffer to a packed sector, returning false if it does not
+ * compress to fit an empty packed sector, or if the prior chunks could not be
+ * recovered after a write failure.
+ */
+static bool write_rc_buffer(uint8_t *buf, uint32_t size, uint32_t index)
+{
+    uint32_t offset = rc_fill;
+    uint32_t coded = 0;
+
+    /* Append to the current packed sector if it holds the prior buffer. The
+     * word holding the start of the chunk is written and checked in full, so
+     * its prior content is read first. */
+    if (offset && offset + RC_CHUNK_HEADER_SIZE < FLASH_DATA_END &&
+        flash_sector_initialized && index == rc_last_index + 1 &&
+        read_flash_range(flash_sector, offset & 0xfffffffc, offset,
+                         flash_buf + (offset & 0xfffffffc)) == SPI_FLASH_RESULT_OK) {
+        coded = rc_compress(rc_model, buf, size, flash_buf + offset + RC_CHUNK_HEADER_SIZE,
+                            FLASH_DATA_END - offset - RC_CHUNK_HEADER_SIZE);
+    }
+
+    bool new_sector = coded == 0;
+    if (new_sector) {
+        /* Seal the current sector first, as that might use the flash_buf. */
+        if (flash_sector_initialized)
+            next_flash_sector();
+        memset(flash_buf, 0xff, 4096);
+        offset = emit_rc_sector_header(flash_buf, index);
+        coded = rc_compress(rc_model, buf, size, flash_buf + offset + RC_CHUNK_HEADER_SIZE,
+                            FLASH_DATA_END - offset - RC_CHUNK_HEADER_SIZE);
+        if (!coded)
+            return false;
+        rc_first_index = index;
+    }
+
+    uint8_t *chunk = flash_buf + offset;
+    chunk[0] = coded;
+    chunk[1] = coded >> 8;
+    chunk[2] = size;
+    chunk[3] = size >> 8;
+    uint32_t end = offset + RC_CHUNK_HEADER_SIZE + coded;
+
+    if (!new_sector) {
+        int ok = write_flash_range(flash_sector, flash_buf, offset, end);
+        taskYIELD();
+        if (ok && check_flash_range(flash_sector, flash_buf, offset, end)) {
+            set_sector_index(flash_sector, rc_first_index, buffer_fill(flash_buf, end));
+        } else {
+            /* Read back the prior chunks, and write all the chunks to the
+             * next sector. If they can not be read then they are lost. */
+            sdk_SpiFlashOpResult res = read_flash_range(flash_sector, 0, offset, flash_buf);
+            handle_flash_write_failure();
+            if (res != SPI_FLASH_RESULT_OK)
+                return false;
+            new_sector = true;
+        }
+    }
+
+    if (new_sector)
+        write_new_flash_sector(flash_buf, end, rc_first_index);
+
+    rc_fill = end;
+    rc_last_index = index;
+    return true;
+}
+
+/*
+ * Write all the pending buffers to flash.
+ */
+static void write_buffers_to_flash(void)
+{
+    while (1) {
+        uint32_t start;
+        uint32_t size;
+        uint8_t *buf = get_buffer_to_write(&size, &start);
+
+        if (!buf)
+            break;
+
+        /* The buffer is pinned, not copied. Only the bytes before the size
+         * are read, so events can continue to be appended meanwhile. */
+        uint32_t index = buf[0] | buf[1] << 8 | buf[2] << 16 | buf[3] << 24 ;
+
+        xSemaphoreTake(flash_state_sem, portMAX_DELAY);
+
+        if (rc_model) {
+            if (write_rc_buffer(buf, size, index)) {
+                maybe_flash_to_post = 1;
+                xSemaphoreGive(flash_state_sem);
+                note_buffer_written(index, size);
+                if (post_data_task)
+                    xTaskNotify(post_data_task, 0, eNoAction);
+                continue;
+            }
+            /* Written in the usual format below, to a new sector. */
+            rc_fill = 0;
+            if (flash_sector_initialized)
+                next_flash_sector();
+        }
+
+        if (flash_sector_initialized) {
+            /* Rewrite to the current flash_sector? */
+            uint32_t flash_index;
+            if (get_sector_index(flash_sector, &flash_index) &&
+                flash_index == index) {
+                /* Rewrite to the current flash_sector. Only the range from
+                 * the start position is written and verified, the prior
+                 * content was verified when written. */
+                int ok = write_flash_range(flash_sector, buf, start, size);
+                taskYIELD();
+                if (ok && check_flash_range(flash_sector, buf, start, size)) {
+                    set_sector_index(flash_sector, index, buffer_fill(buf, size));
+                    maybe_flash_to_post = 1;
+                    xSemaphoreGive(flash_state_sem);
+                    note_buffer_written(index, size);
+                    continue;
+                }
+                
+                handle_flash_write_failure();
+            } else {
+                /* Either the flash index is bad or the index being written
+                 * is more recent, so move on to the next flash sector. The
+                 * current sector is complete so seal it. */
+                next_flash_sector();
+            }
+        }
+
+        /* At an uninitialized flash sector, with a full buffer to write. */
+        write_new_flash_sector(buf, size, index);
+        maybe_flash_to_post = 1;
+        xSemaphoreGive(flash_state_sem);
+        note_buffer_written(index, size);
+        /* Signal the HTTP-Post thread to re-check. */
+        if (post_data_task)
+            xTaskNotify(post_data_task, 0, eNoAction);
+    }
+}
+
+/*
+ * The head sector found at start-up, or zero if none. It is sealed by the
+ * flash task after the start-up delay, not at start-up, so the flash is not
+ * written while the power might be bouncing.
+ */
+static uint16_t flash_start_sector = 0;
+
+static void seal_start_sector(void)
+{
+    if (!flash_start_sector)
+        return;
+
+    xSemaphoreTake(flash_state_sem, portMAX_DELAY);
+    uint32_t fill;
+    if (!read_sector_footer(flash_start_sector, &fill))
+        seal_flash_sector(flash_start_sector);
+    flash_start_sector = 0;
+    xSemaphoreGive(flash_state_sem);
+}
+
 void flash_data(void *pvParameters)
 {
     /*
@@ -246,100 +918,31 @@ void flash_data(void *pvParameters)
      */
     vTaskDelay(180000 / portTICK_PERIOD_MS);
 
-    while (1) {
-        xTaskNotifyWait(0, 0, NULL, 120000 / portTICK_PERIOD_MS);
+    seal_start_sector();
 
-        /* Try to flush all the pending buffers before waiting again. */
-        while (1) {
-            uint32_t start;
-            uint32_t size = get_buffer_to_write(flash_buf, &start);
-
-            if (size == 0)
-                break;
-
-            uint32_t index = flash_buf[0] | flash_buf[1] << 8 | flash_buf[2] << 16 | flash_buf[3] << 24 ;
-
-            xSemaphoreTake(flash_state_sem, portMAX_DELAY);
-
-            if (flash_sector_initialized) {
-                /* Rewrite to the current flash_sector? */
-                uint32_t flash_index;
-                if (decode_flash_sector_index(flash_sector, &flash_index) &&
-                    flash_index == index) {
-                    /* Rewrite to the current flash_sector. Firstly try just
-                     * writing from the start position. */
-
-                    /* Round to a word aligned range. */
-                    uint32_t aligned_end = (size + 3) & 0xfffffffc;
-                    uint32_t aligned_start = start & 0xfffffffc;
-                    uint32_t aligned_size = aligned_end - aligned_start;
-
-                    sdk_SpiFlashOpResult res;
-                    uint32_t dest_addr = (uint32_t)flash_sector * 4096 + aligned_start;
-                    res = sdk_spi_flash_write(dest_addr, (uint32_t *)(flash_buf + aligned_start), aligned_size);
-                    taskYIELD();
-                    if (res == SPI_FLASH_RESULT_OK &&
-                        check_flash_sector(flash_sector, (uint32_t *)flash_buf)) {
-                        maybe_flash_to_post = 1;
-                        xSemaphoreGive(flash_state_sem);
-                        note_buffer_written(index, size);
-                        continue;
-                    }
-                    
-                    handle_flash_write_failure();
-                } else {
-                    /* Either the flash index is bad or the index being written
-                     * is more recent, so move on to the next flash sector. */
-                    flash_sector++;
-                    if (flash_sector >= BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS)
-                        flash_sector = BUFFER_FLASH_FIRST_SECTOR;
-                    flash_sector_initialized = 0;
-                }
-            }
-
-            /* At an uninitialized flash sector, with a full buffer to write. */
-
-            /* Retry a limited number of times on write failures. */
-            int retries = 0;
+    if (param_flash_rc) {
+        rc_model = malloc(sizeof(rc_model_t));
+        if (!rc_model) {
+            /* Log the fallback, so it is not silent in the data. */
+            printf("Error: no memory for the recompression\n");
+            static uint32_t last_segment = 0;
             while (1) {
-                /* Firstly check if it is erased. */
-                if (!flash_sector_erased(flash_sector)) {
-                    /* Erase the flash_sector. */
-                    sdk_SpiFlashOpResult res;
-                    res = sdk_spi_flash_erase_sector(flash_sector);
-                    taskYIELD();
-                    if (res != SPI_FLASH_RESULT_OK ||
-                        !flash_sector_erased(flash_sector)) {
-                        /* Just fall through and try the write, it might still
-                         * work. */
-                    }
-                }
-                /* Write the sector. */
-                sdk_SpiFlashOpResult res;
-                uint32_t dest_addr = (uint32_t)flash_sector * 4096;
-                res = sdk_spi_flash_write(dest_addr, (uint32_t *)flash_buf, size);
-                taskYIELD();
-                if (res != SPI_FLASH_RESULT_OK ||
-                    !check_flash_sector(flash_sector, (uint32_t *)flash_buf)) {
-                    handle_flash_write_failure();
-                    if (++retries > 8) {
-                        /* Give up, consider it written. */
-                        break;
-                    }
-                    continue;
-                }
-                /* Success. */
-                flash_sector_initialized = 1;
-                break;
+                uint32_t new_segment = dbuf_append(last_segment, DBUF_EVENT_RC_FALLBACK,
+                                                   NULL, 0, 1);
+                if (new_segment == last_segment)
+                    break;
+                last_segment = new_segment;
             }
-            maybe_flash_to_post = 1;
-            xSemaphoreGive(flash_state_sem);
-            note_buffer_written(index, size);
-            /* Signal the HTTP-Post thread to re-check. */
-            if (post_data_task)
-                xTaskNotify(post_data_task, 0, eNoAction);
         }
     }
+    set_buffer_rc(rc_model != NULL);
+
+    while (1) {
+        xTaskNotifyWait(0, 0, NULL, 120000 / portTICK_PERIOD_MS);
+
+        /* Try to flush all the pending buffers before waiting again. */
+        write_buffers_to_flash();
+    }
 }
 
 /*
@@ -365,6 +968,22 @@ void clear_maybe_buffer_to_post()
     return;
 }
 
+/*
+ * Return the flash operation counts since start-up, for monitoring the flash
+ * usage.
+ */
+void get_flash_stats(flash_stats_t *stats)
+{
+    xSemaphoreTake(flash_state_sem, portMAX_DELAY);
+    stats->reads = flash_reads;
+    stats->read_bytes = flash_read_bytes;
+    stats->writes = flash_writes;
+    stats->write_bytes = flash_write_bytes;
+    stats->erases = flash_erases;
+    stats->write_failures = flash_write_failures;
+    xSemaphoreGive(flash_state_sem);
+}
+
 
 /*
  * Request the current length of the buffer with the given index or the first
@@ -388,6 +1007,9 @@ void clear_maybe_buffer_to_post()
  * index sequence and otherwise it would take some more iteration to find the
  * next in the sequence. If there is no next_index then 0xffffffff is returned -
  * the search for the next index should start from there as there might be a gap.
+ *
+ * The search walks the RAM sector index, so the only flash read is to find the
+ * fill length of a sector when first needed.
  */
 uint32_t get_buffer_size(uint32_t requested_index, uint32_t *index, uint32_t *next_index, bool *sealed)
 {
@@ -401,18 +1023,12 @@ uint32_t get_buffer_size(uint32_t requested_index, uint32_t *index, uint32_t *ne
     *next_index = 0xffffffff;
 
     if (flash_sector_initialized) {
-        if (decode_flash_sector_index(flash_sector, index)) {
+        if (get_sector_index(flash_sector, index)) {
             last_sector = flash_sector;
             last_index = *index;
             if (*index <= requested_index) {
-                sdk_SpiFlashOpResult res;
-                res = sdk_spi_flash_read(flash_sector * 4096, (uint32_t *)flash_buf, 4096);
-                if (res == SPI_FLASH_RESULT_OK) {
-                    uint32_t size = 0;
-                    for (size = 4096; size > 0; size--) {
-                        if (flash_buf[size - 1] != 0xff)
-                            break;
-                    }
+                uint32_t size;
+                if (get_sector_fill(flash_sector, &size)) {
                     *sealed = false;
                     xSemaphoreGive(flash_state_sem);
                     return size;
@@ -429,21 +1045,14 @@ uint32_t get_buffer_size(uint32_t requested_index, uint32_t *index, uint32_t *ne
     }
 
     while (1) {
-        if (decode_flash_sector_index(sector, index) &&
+        if (get_sector_index(sector, index) &&
             /* Skip if the index increases (an error), or if this is not the
              * most recent write for this index which might occur if a flash
              * write failed and the sector was re-written. */
             *index < last_index) {
             if (*index <= requested_index) {
-                sdk_SpiFlashOpResult res;
-                memset(flash_buf, 0xa5, 4096);
-                res = sdk_spi_flash_read(sector * 4096, (uint32_t *)flash_buf, 4096);
-                if (res == SPI_FLASH_RESULT_OK) {
-                    uint32_t size;
-                    for (size = 4096; size > 0; size--) {
-                        if (flash_buf[size - 1] != 0xff)
-                            break;
-                    }
+                uint32_t size;
+                if (get_sector_fill(sector, &size)) {
                     *next_index = last_index;
                     *sealed = (sector != flash_sector);
                     xSemaphoreGive(flash_state_sem);
@@ -475,14 +1084,8 @@ uint32_t get_buffer_size(uint32_t requested_index, uint32_t *index, uint32_t *ne
 
     if (last_sector != 0) {
         /* Found something, so return it and it's size. */
-        sdk_SpiFlashOpResult res;
-        res = sdk_spi_flash_read(last_sector * 4096, (uint32_t *)flash_buf, 4096);
-        if (res == SPI_FLASH_RESULT_OK) {
-            uint32_t size = 0;
-            for (size = 4096; size > 0; size--) {
-                if (flash_buf[size - 1] != 0xff)
-                    break;
-            }
+        uint32_t size;
+        if (get_sector_fill(last_sector, &size)) {
             *index = last_index;
             *sealed = (last_sector != flash_sector);
             xSemaphoreGive(flash_state_sem);
@@ -519,23 +1122,18 @@ bool get_buffer_range(uint32_t index, uint32_t start, uint32_t end, uint8_t *buf
 
     if (last_get_buffer_range_sector && index == last_get_buffer_range_index) {
         sdk_SpiFlashOpResult res;
-        res = sdk_spi_flash_read(last_get_buffer_range_sector * 4096,
-                                 (uint32_t *)flash_buf, 4096);
+        res = read_flash_range(last_get_buffer_range_sector, start, end, buf);
         if (res == SPI_FLASH_RESULT_OK) {
-            for (i = 0; i < end - start; i++)
-                buf[i] = flash_buf[start + i];
             xSemaphoreGive(flash_state_sem);
             return true;
         }
     }
 
     if (flash_sector_initialized) {
-        if (decode_flash_sector_index(flash_sector, &i) && i == index) {
+        if (get_sector_index(flash_sector, &i) && i == index) {
             sdk_SpiFlashOpResult res;
-            res = sdk_spi_flash_read(flash_sector * 4096, (uint32_t *)flash_buf, 4096);
+            res = read_flash_range(flash_sector, start, end, buf);
             if (res == SPI_FLASH_RESULT_OK) {
-                for (i = 0; i < end - start; i++)
-                    buf[i] = flash_buf[start + i];
                 last_get_buffer_range_sector = flash_sector;
                 last_get_buffer_range_index = index;
                 xSemaphoreGive(flash_state_sem);
@@ -552,12 +1150,10 @@ bool get_buffer_range(uint32_t index, uint32_t start, uint32_t end, uint8_t *buf
     }
 
     while (1) {
-        if (decode_flash_sector_index(sector, &i) && i == index) {
+        if (get_sector_index(sector, &i) && i == index) {
             sdk_SpiFlashOpResult res;
-            res = sdk_spi_flash_read(sector * 4096, (uint32_t *)flash_buf, 4096);
+            res = read_flash_range(sector, start, end, buf);
             if (res == SPI_FLASH_RESULT_OK) {
-                for (i = 0; i < end - start; i++)
-                    buf[i] = flash_buf[start + i];
                 last_get_buffer_range_sector = sector;
                 last_get_buffer_range_index = index;
                 xSemaphoreGive(flash_state_sem);
@@ -601,17 +1197,21 @@ bool erase_flash_data() {
         if (!flash_sector_erased(flash_sector)) {
             /* Erase the flash_sector. */
             sdk_SpiFlashOpResult res;
-            res = sdk_spi_flash_erase_sector(flash_sector);
+            res = flash_erase_sector(flash_sector);
             taskYIELD();
             if (res != SPI_FLASH_RESULT_OK ||
                 !flash_sector_erased(flash_sector)) {
                 success = false;
             }
         }
+        invalidate_sector_index(flash_sector);
     }
+    sector_index_largest = 0;
     /* No valid sectors, start at the first sector. */
     flash_sector = BUFFER_FLASH_FIRST_SECTOR;
     flash_sector_initialized = 0;
+    flash_start_sector = 0;
+    rc_fill = 0;
     maybe_flash_to_post = 0;
     last_get_buffer_range_sector = 0;
     last_get_buffer_range_index = 0xffffffff;
@@ -624,13 +1224,48 @@ bool erase_flash_data() {
 }
 
 
+/*
+ * Return the index of the last buffer in a sector, which for a packed sector
+ * is the index of the first buffer plus the number of chunks less one.
+ */
+static uint32_t sector_last_index(uint16_t sector, uint32_t index)
+{
+    uint8_t header[16];
+    uint32_t size = emit_rc_sector_header(header, index);
+    uint8_t data[16];
+
+    if (read_flash_range(sector, 0, size, data) != SPI_FLASH_RESULT_OK ||
+        memcmp(header, data, size) != 0) {
+        return index;
+    }
+
+    uint32_t offset = size;
+    uint32_t chunks = 0;
+    while (offset + RC_CHUNK_HEADER_SIZE <= FLASH_FOOTER_OFFSET) {
+        uint8_t chunk[RC_CHUNK_HEADER_SIZE];
+        if (read_flash_range(sector, offset, offset + RC_CHUNK_HEADER_SIZE, chunk) != SPI_FLASH_RESULT_OK)
+            break;
+        uint32_t coded = chunk[0] | chunk[1] << 8;
+        if (coded == 0xffff)
+            break;
+        chunks++;
+        offset += RC_CHUNK_HEADER_SIZE + coded;
+    }
+
+    return chunks ? index + chunks - 1 : index;
+}
+
 uint32_t init_flash()
 {
     uint32_t flash_index;
 
     /* Recover the head sector and index. */
     if (find_most_recent_sector(&flash_sector, &flash_index)) {
+        /* The head sector will not be written again as a new sector is
+         * started, so it is sealed by the flash task. */
+        flash_start_sector = flash_sector;
         /* Start the head at the next sector. */
+        flash_index = sector_last_index(flash_sector, flash_index);
         flash_sector++;
         if (flash_sector >= BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS)
             flash_sector = BUFFER_FLASH_FIRST_SECTOR;
@@ -639,6 +1274,7 @@ uint32_t init_flash()
         /* No valid sectors, start at the first sector. */
         flash_sector = BUFFER_FLASH_FIRST_SECTOR;
         flash_index = 0;
+        flash_start_sector = 0;
     }
     flash_sector_initialized = 0;
 
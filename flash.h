@@ -32,3 +32,14 @@ extern TaskHandle_t flash_data_task;
 uint32_t get_buffer_size(uint32_t requested_index, uint32_t *index, uint32_t *next_index, bool *sealed);
 bool get_buffer_range(uint32_t index, uint32_t start, uint32_t end, uint8_t *buf);
 bool erase_flash_data(void);
+
+typedef struct {
+    uint32_t reads;
+    uint32_t read_bytes;
+    uint32_t writes;
+    uint32_t write_bytes;
+    uint32_t erases;
+    uint32_t write_failures;
+} flash_stats_t;
+
+void get_flash_stats(flash_stats_t *stats);
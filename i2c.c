@@ -31,6 +31,7 @@
 #include "i2c/i2c.h"
 #include "i2c.h"
 #include "config.h"
+#include "leds.h"
 
 /* To synchronize access to the I2C interface. */
 SemaphoreHandle_t i2c_sem;
@@ -40,3 +41,147 @@ void init_i2c()
     i2c_init(I2C_BUS, param_i2c_scl, param_i2c_sda, I2C_FREQ_100K);
     i2c_sem = xSemaphoreCreateMutex();
 }
+
+/*
+ * The I2C sensors are run by a single task, rather than a task per sensor,
+ * saving the task stacks. Each sensor driver has callbacks to start a
+ * measurement and to poll it, and these return the ticks to wait before the
+ * next poll so that while one sensor is converting the task can move on to
+ * another. The i2c_sem is held only for each callback, not over the wait.
+ *
+ * A sensor can be synchronized to the PMS frames, so that its samples share a
+ * time with a particle sample. Its sample is then started at the first PMS
+ * frame after it is due, or when I2C_SYNC_TICKS has passed without a frame,
+ * for example when the PMS sensor is asleep.
+ */
+#define I2C_SYNC_TICKS (2000 / portTICK_PERIOD_MS)
+
+static i2c_sensor_t *i2c_sensors = NULL;
+static TaskHandle_t i2c_sensors_task_handle = NULL;
+static bool i2c_sync = false;
+
+/* Called by the PMS reader on each frame. */
+void i2c_note_pms_frame()
+{
+    if (i2c_sync)
+        xTaskNotifyGive(i2c_sensors_task_handle);
+}
+
+/* Add a sensor driver, to be detected when the task starts. */
+void add_i2c_sensor(i2c_sensor_t *sensor)
+{
+    i2c_sensor_t **link = &i2c_sensors;
+    while (*link)
+        link = &(*link)->next;
+    sensor->next = NULL;
+    *link = sensor;
+}
+
+/* Schedule the next sample, skipping any samples missed. */
+static void next_i2c_sample(i2c_sensor_t *sensor, TickType_t now)
+{
+    uint32_t seconds = *sensor->period;
+    if (seconds < 1)
+        seconds = 1;
+    else if (seconds > 86400)
+        seconds = 86400;
+    TickType_t period = seconds * 1000 / portTICK_PERIOD_MS;
+
+    sensor->busy = false;
+    sensor->sample += period;
+    if ((int32_t)(now - sensor->sample) >= 0)
+        sensor->sample = now + period;
+    sensor->due = sensor->sample;
+    if (sensor->sync)
+        sensor->due += I2C_SYNC_TICKS;
+}
+
+static void run_i2c_sensor(i2c_sensor_t *sensor)
+{
+    int32_t ticks;
+
+    xSemaphoreTake(i2c_sem, portMAX_DELAY);
+    if (sensor->busy) {
+        ticks = sensor->poll();
+    } else {
+        ticks = sensor->start();
+        if (ticks == 0) {
+            sensor->busy = true;
+            ticks = sensor->poll();
+        } else if (ticks > 0) {
+            sensor->busy = true;
+        }
+    }
+    xSemaphoreGive(i2c_sem);
+
+    TickType_t now = xTaskGetTickCount();
+
+    if (ticks > 0) {
+        sensor->due = now + ticks;
+        return;
+    }
+
+    next_i2c_sample(sensor, now);
+
+    if (ticks < 0) {
+        blink_red();
+        return;
+    }
+
+    sensor->log();
+    blink_green();
+}
+
+static void i2c_sensors_task(void *pvParameters)
+{
+    /* Detect the sensors, dropping those not available. */
+    i2c_sensor_t **link = &i2c_sensors;
+    while (*link) {
+        i2c_sensor_t *sensor = *link;
+        xSemaphoreTake(i2c_sem, portMAX_DELAY);
+        bool available = sensor->init();
+        xSemaphoreGive(i2c_sem);
+        if (available) {
+            sensor->busy = false;
+            sensor->sample = xTaskGetTickCount();
+            next_i2c_sample(sensor, sensor->sample);
+            if (sensor->sync)
+                i2c_sync = true;
+            link = &sensor->next;
+        } else {
+            *link = sensor->next;
+        }
+    }
+
+    if (!i2c_sensors)
+        vTaskDelete(NULL);
+
+    bool frame = false;
+
+    for (;;) {
+        i2c_sensor_t *sensor;
+        for (sensor = i2c_sensors; sensor; sensor = sensor->next) {
+            TickType_t now = xTaskGetTickCount();
+            if ((int32_t)(now - sensor->due) >= 0 ||
+                (sensor->sync && !sensor->busy && frame &&
+                 (int32_t)(now - sensor->sample) >= 0)) {
+                run_i2c_sensor(sensor);
+            }
+        }
+
+        /* Wait for the next due sensor. */
+        TickType_t now = xTaskGetTickCount();
+        int32_t wait = INT32_MAX;
+        for (sensor = i2c_sensors; sensor; sensor = sensor->next) {
+            int32_t ticks = (int32_t)(sensor->due - now);
+            if (ticks < wait)
+                wait = ticks;
+        }
+        frame = wait > 0 && ulTaskNotifyTake(pdTRUE, wait) > 0;
+    }
+}
+
+void init_i2c_sensors()
+{
+    xTaskCreate(&i2c_sensors_task, "I2C sensors", 288, NULL, 11, &i2c_sensors_task_handle);
+}
@@ -23,4 +23,34 @@
 
 extern SemaphoreHandle_t i2c_sem;
 
+/*
+ * An I2C sensor driver, run by the I2C task, see i2c.c. The callbacks other
+ * than the log callback are called with the i2c_sem held.
+ */
+typedef struct i2c_sensor {
+    /* Detect and initialize the sensor, returning false if not available. */
+    bool (*init)(void);
+    /* Start a measurement, returning the ticks to wait before polling it, or
+     * a negative value on failure. */
+    int32_t (*start)(void);
+    /* Poll the measurement, returning zero when complete, the ticks to wait
+     * before polling again, or a negative value on failure. */
+    int32_t (*poll)(void);
+    /* Log the completed measurement. */
+    void (*log)(void);
+    /* The sampling period parameter, in seconds. This is read for each sample
+     * so that it can be changed at run time. */
+    uint32_t *period;
+    /* Start the sample at the next PMS frame, within I2C_SYNC_TICKS. */
+    bool sync;
+    /* The scheduler state. */
+    bool busy;
+    TickType_t due;
+    TickType_t sample;
+    struct i2c_sensor *next;
+} i2c_sensor_t;
+
 void init_i2c();
+void add_i2c_sensor(i2c_sensor_t *sensor);
+void init_i2c_sensors();
+void i2c_note_pms_frame();
@@ -23,103 +23,377 @@
 #include <sys/types.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <esp/uart.h>
+#include <esp/interrupts.h>
+#include <esp/gpio.h>
 #include <stdio.h>
 #include <espressif/esp_system.h>
+#include <common_macros.h>
+#include <xtensa_ops.h>
+#include <stdout_redirect.h>
 #include "FreeRTOS.h"
 #include "task.h"
+#include "semphr.h"
 
 #include "buffer.h"
 #include "leds.h"
 #include "config.h"
+#include "i2c.h"
+#include "aggregate.h"
+#include "bits.h"
 
 
 
-static uint8_t mygetc()
+/*
+ * The frames are assembled by the UART receive interrupt handler, and the task
+ * is woken once per frame with a valid checksum rather than reading each byte
+ * through the stdin driver. A small ring of frames decouples the handler from
+ * the task. The handler only writes to the head frame, which is never a frame
+ * being read by the task. A second sensor on a software UART has its own ring,
+ * see below.
+ */
+#define PMS_FRAME_MAX_SIZE (4 + 0x1c)
+#define PMS_NUM_FRAMES 4
+
+typedef struct {
+    uint8_t frames[PMS_NUM_FRAMES][PMS_FRAME_MAX_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    /* Frame assembly state, only accessed by the producer. */
+    uint32_t len;
+    uint32_t size;
+    /* Error counts, and the count last noted by the task. */
+    volatile uint32_t checksum_errors;
+    volatile uint32_t overruns;
+    uint32_t last_checksum_errors;
+    TaskHandle_t task;
+} pms_frames_t;
+
+static pms_frames_t pms_uart_frames;
+
+static void IRAM pms_frame_byte(pms_frames_t *frames, uint8_t ch)
 {
-    uint8_t ch;
-    while (1) {
-        if (read(0, (void*)&ch, 1)) {
-            return ch;
+    uint8_t *frame = frames->frames[frames->head];
+    uint32_t len = frames->len;
+
+    /* Search for the "BM" header, and check the length. */
+    if (len == 0) {
+        if (ch != 'B')
+            return;
+    } else if (len == 1) {
+        if (ch != 'M') {
+            frames->len = ch == 'B' ? 1 : 0;
+            return;
+        }
+    } else if (len == 3) {
+        uint16_t length = frame[2] << 8 | ch;
+        if (length != 0x14 && length != 0x1c) {
+            frames->len = 0;
+            return;
         }
+        frames->size = 4 + length;
     }
-}
 
+    frame[len++] = ch;
+    if (len < 4 || len < frames->size) {
+        frames->len = len;
+        return;
+    }
 
-/*
- * Variable bit length encoding support.
- */
-static uint8_t outbuf[256];
-static int noutbits;
-static uint32_t outbits;
-static int outlen;
+    /* A complete frame, check the checksum which covers the header too. */
+    frames->len = 0;
+    uint16_t checksum = 0;
+    uint32_t i;
+    for (i = 0; i < len - 2; i++)
+        checksum += frame[i];
+    if (checksum != (frame[len - 2] << 8 | frame[len - 1])) {
+        frames->checksum_errors++;
+        return;
+    }
+
+    uint32_t next = frames->head + 1;
+    if (next >= PMS_NUM_FRAMES)
+        next = 0;
+    if (next == frames->tail) {
+        /* The task has fallen behind, drop this frame. */
+        frames->overruns++;
+        return;
+    }
+    frames->head = next;
+}
 
-static void emitbits(uint32_t bits, uint8_t nbits)
+static void IRAM pms_uart_rx_handler(void *arg)
 {
-    outbits |= bits << noutbits;
-    noutbits += nbits;
-    while (noutbits >= 8) {
-        outbuf[outlen++] = (unsigned char) (outbits & 0xFF);
-        outbits >>= 8;
-        noutbits -= 8;
+    pms_frames_t *frames = &pms_uart_frames;
+    uint32_t head = frames->head;
+
+    while (FIELD2VAL(UART_STATUS_RXFIFO_COUNT, UART(0).STATUS) > 0) {
+        pms_frame_byte(frames, UART(0).FIFO & 0xff);
+    }
+    UART(0).INT_CLEAR = UART_INT_CLEAR_RXFIFO_FULL | UART_INT_CLEAR_RXFIFO_TIMEOUT;
+
+    if (frames->head != head && frames->task) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(frames->task, &woken);
+        portEND_SWITCHING_ISR(woken);
     }
 }
 
-static void init_outbuf()
+static void init_pms_uart()
 {
-    outlen = 0;
-    noutbits = 0;
-    outbits = 0;
+    /* Interrupt when a full frame is in the FIFO, or after a short gap at the
+     * end of a frame. */
+    UART(0).CONF1 = SET_FIELD(UART(0).CONF1, UART_CONF1_RXFIFO_FULL_THRESHOLD,
+                              PMS_FRAME_MAX_SIZE);
+    UART(0).CONF1 = SET_FIELD(UART(0).CONF1, UART_CONF1_RX_TOUT_THRESHOLD, 2) |
+        UART_CONF1_RX_TOUT_ENABLE;
+    UART(0).INT_CLEAR = 0x1ff;
+    UART(0).INT_ENABLE = UART_INT_ENABLE_RXFIFO_FULL | UART_INT_ENABLE_RXFIFO_TIMEOUT;
+    _xt_isr_attach(INUM_UART, pms_uart_rx_handler, NULL);
+    _xt_isr_unmask(1 << INUM_UART);
 }
 
 /*
- * Variable length encoded value for the PMS*003 events.
+ * A second sensor on a software UART receiver, on a GPIO. The GPIO interrupt
+ * handler only notes the cycle count and the new level of each edge in a ring,
+ * at most ten short interrupts per byte, and the bytes are decoded from the
+ * edge times by the task of the second sensor, which runs a few times per
+ * frame. The bit positions are timed from the start bit edge so the interrupt
+ * latency does not accumulate over a byte. A byte ending in one bits has no
+ * edge at its end, so it is completed when the next start bit arrives or
+ * after a timeout.
+ *
+ * A 32 byte frame has up to 320 edges, and the ring holds two frames so that
+ * the task can be delayed by a frame time without losing edges. If the ring
+ * overruns anyway then the edges lost are counted and the position of the gap
+ * noted, and the decoder discards the partial frame and waits for the line to
+ * idle before the next start bit, resynchronizing on the next "BM" header.
+ * The ring is only allocated when the second sensor is configured.
  */
+#define PMS_SOFT_NUM_EDGES 640
+#define PMS_SOFT_BAUD 9600
+#define PMS_SOFT_POLL_TICKS (10 / portTICK_PERIOD_MS)
+
+static pms_frames_t pms_soft_frames;
+static uint32_t *pms_soft_edges;
+static volatile uint32_t pms_soft_edges_head = 0;
+static volatile uint32_t pms_soft_edges_tail = 0;
+static volatile uint32_t pms_soft_edge_overruns = 0;
+/* The ring index of the first edge after lost edges, or PMS_SOFT_NUM_EDGES if
+ * none. */
+static volatile uint32_t pms_soft_edges_gap = PMS_SOFT_NUM_EDGES;
+static uint32_t pms_soft_last_edge_overruns = 0;
+
+/* Byte decoding state, only accessed by the task. */
+static uint32_t pms_soft_bit_cycles;
+static bool pms_soft_in_byte = false;
+static uint32_t pms_soft_start;
+static uint32_t pms_soft_bit;
+static uint32_t pms_soft_level;
+static uint32_t pms_soft_byte;
+static bool pms_soft_framing_error;
+/* Waiting for the line to idle after lost edges, and the time of the last
+ * edge seen meanwhile. */
+static bool pms_soft_resync = false;
+static uint32_t pms_soft_last_edge;
+
+static inline uint32_t pms_soft_ccount()
+{
+    uint32_t ccount;
+    RSR(ccount, ccount);
+    return ccount;
+}
 
-static void emit_var_int(int32_t v)
+static void IRAM pms_soft_edge_handler(uint8_t gpio_num)
 {
-    if (v == 0) {
-        /* 0 -> '1' */
-        emitbits(1, 1);
+    /* The level is noted in the low bit of the time. */
+    uint32_t edge = (pms_soft_ccount() & ~1) | gpio_read(gpio_num);
+    uint32_t head = pms_soft_edges_head;
+    uint32_t next = (head + 1) % PMS_SOFT_NUM_EDGES;
+
+    if (next == pms_soft_edges_tail) {
+        /* The next edge stored follows the lost edges. */
+        pms_soft_edge_overruns++;
+        pms_soft_edges_gap = head;
         return;
     }
+    pms_soft_edges[head] = edge;
+    pms_soft_edges_head = next;
+
+    /* Wake the task on the first edge after it has emptied the ring. */
+    if (head == pms_soft_edges_tail && pms_soft_frames.task) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(pms_soft_frames.task, &woken);
+        portEND_SWITCHING_ISR(woken);
+    }
+}
+
+/* Decode the bits of the current byte up to the bit position end, which have
+ * the current level. The start bit is position 0, the data bits are 1 to 8 lsb
+ * first, and the stop bit is position 9. */
+static void pms_soft_bits(uint32_t end)
+{
+    while (pms_soft_bit < end && pms_soft_bit < 10) {
+        if (pms_soft_bit >= 1 && pms_soft_bit <= 8) {
+            if (pms_soft_level)
+                pms_soft_byte |= 1 << (pms_soft_bit - 1);
+        } else if (pms_soft_level != (pms_soft_bit == 9)) {
+            pms_soft_framing_error = true;
+        }
+        pms_soft_bit++;
+    }
 
-    emitbits(0, 1);
+    if (pms_soft_bit >= 10) {
+        pms_soft_in_byte = false;
+        if (pms_soft_framing_error)
+            pms_soft_frames.checksum_errors++;
+        else
+            pms_frame_byte(&pms_soft_frames, pms_soft_byte);
+    }
+}
 
-    /* The sign bit. */
-    if (v < 0) {
-        emitbits(1, 1);
-        v = -v;
-    } else {
-        emitbits(0, 1);
+static void pms_soft_edge(uint32_t edge)
+{
+    uint32_t level = edge & 1;
+
+    if (pms_soft_resync) {
+        /* A falling edge after a high level for at least a byte time is a
+         * start bit. */
+        uint32_t last = pms_soft_last_edge;
+        pms_soft_last_edge = edge;
+        if (level || !(last & 1) || edge - last < 10 * pms_soft_bit_cycles)
+            return;
+        pms_soft_resync = false;
     }
 
-    if (v == 1) {
-        /* +1 -> '001'
-         * -1 -> '011'
-         */
-        emitbits(1, 1);
-        return;
+    if (pms_soft_in_byte) {
+        uint32_t cycles = edge - pms_soft_start;
+        pms_soft_bits((cycles + pms_soft_bit_cycles / 2) / pms_soft_bit_cycles);
     }
 
-    emitbits(0, 1);
+    if (!pms_soft_in_byte) {
+        /* Idle, wait for the falling edge of a start bit. */
+        if (level)
+            return;
+        pms_soft_in_byte = true;
+        pms_soft_start = edge;
+        pms_soft_bit = 0;
+        pms_soft_byte = 0;
+        pms_soft_framing_error = false;
+    }
 
-    if (v < 33) {
-        /* +2 to +32 -> '000 xxxxx'
-         * -2 to -32 -> '010 xxxxx'
-         */
-        emitbits(v - 2, 5);
-        return;
+    pms_soft_level = level;
+}
+
+/* Decode the edges received, and complete a byte that has timed out. */
+static void pms_soft_decode()
+{
+    uint32_t now = pms_soft_ccount();
+    uint32_t tail = pms_soft_edges_tail;
+
+    while (1) {
+        if (tail == pms_soft_edges_gap) {
+            /* Drop the partial byte and frame, and resynchronize. The next
+             * edge is not taken as a start bit. */
+            pms_soft_edges_gap = PMS_SOFT_NUM_EDGES;
+            pms_soft_in_byte = false;
+            pms_soft_frames.len = 0;
+            pms_soft_resync = true;
+            pms_soft_last_edge = 0;
+        }
+        if (tail == pms_soft_edges_head)
+            break;
+        pms_soft_edge(pms_soft_edges[tail]);
+        tail = (tail + 1) % PMS_SOFT_NUM_EDGES;
+        pms_soft_edges_tail = tail;
+    }
+
+    /* The time is sampled first so an edge arriving meanwhile is not timed out
+     * early. */
+    if (pms_soft_in_byte && (int32_t)(now - pms_soft_start) >= (int32_t)(10 * pms_soft_bit_cycles))
+        pms_soft_bits(10);
+}
+
+static void init_pms_soft_uart()
+{
+    pms_soft_bit_cycles = sdk_system_get_cpu_freq() * 1000000 / PMS_SOFT_BAUD;
+    gpio_enable(param_pms2_gpio, GPIO_INPUT);
+    gpio_set_pullup(param_pms2_gpio, true, false);
+    gpio_set_interrupt(param_pms2_gpio, GPIO_INTTYPE_EDGE_ANY, pms_soft_edge_handler);
+}
+
+/* Return the data word i of a frame. */
+static uint16_t pms_word(uint8_t *frame, uint32_t i)
+{
+    return frame[4 + i * 2] << 8 | frame[5 + i * 2];
+}
+
+
+
+/*
+ * Adaptive Golomb-Rice code for the PMS*003 event values.
+ *
+ * Each value is zig-zag mapped to an unsigned value u, and coded with the Rice
+ * parameter k as the quotient u >> k in unary, as that many one bits and a
+ * zero bit, followed by the k low bits of u. A quotient of RICE_ESCAPE or more
+ * is coded as RICE_ESCAPE one bits followed by the value u in 18 bits, or 20
+ * bits for the predicted events which have a larger range.
+ *
+ * The parameter k is adapted per channel to the running mean of the recent
+ * values, as the smallest k for which n << k is not less than the sum a, and
+ * the sum and count are halved when the count reaches RICE_WINDOW. The state
+ * is reset at the start of each new data buffer so that each buffer can be
+ * decoded on its own, and the decoder follows the same adaptation.
+ */
+#define RICE_ESCAPE 12
+#define RICE_WINDOW 16
+#define RICE_INITIAL_SUM 4
+
+/* The largest encoded event: 13 values of up to 32 bits, and 15 bits of the
+ * checksum. */
+#define PMS_EVENT_MAX_SIZE ((13 * (RICE_ESCAPE + 20) + 15 + 7) / 8)
+
+#define PMS_NUM_CHANNELS 13
+
+typedef struct {
+    uint32_t a;
+    uint32_t n;
+} rice_state_t;
+
+static void init_rice_state(rice_state_t *state)
+{
+    uint32_t i;
+    for (i = 0; i < PMS_NUM_CHANNELS; i++) {
+        state[i].a = RICE_INITIAL_SUM;
+        state[i].n = 1;
+    }
+}
+
+static void emit_rice(bitwriter_t *writer, rice_state_t *state, int32_t v,
+                      uint32_t escape_bits)
+{
+    uint32_t u = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+    uint32_t k;
+
+    for (k = 0; (state->n << k) < state->a && k < 16; k++)
+        ;
+
+    uint32_t q = u >> k;
+    if (q < RICE_ESCAPE) {
+        bitwriter_emit_unary(writer, q);
+        bitwriter_emit(writer, u & ((1 << k) - 1), k);
+    } else {
+        bitwriter_emit(writer, (1 << RICE_ESCAPE) - 1, RICE_ESCAPE);
+        bitwriter_emit(writer, u & ((1 << escape_bits) - 1), escape_bits);
+    }
+
+    state->a += u;
+    state->n++;
+    if (state->n >= RICE_WINDOW) {
+        state->a >>= 1;
+        state->n >>= 1;
     }
-    
-    emitbits(0x1f, 5);
-        
-    /* 16 bit unsigned value:
-     *  +33 to 65568 : #x000 11111 xxxx xxxx xxxx xxxx
-     *  -33 to 65568 : #x010 11111 xxxx xxxx xxxx xxxx
-     */
-    v = v - 33;
-    emitbits(v & 0xffff, 16);
 }
 
 static bool pms_available = false;
@@ -158,147 +432,331 @@ bool pms_last_data(uint32_t *counter, uint16_t *pm1a, uint16_t *pm25a, uint16_t
 }
 
 /*
- * The particle counter events are compressed. The prior event values are noted
+ * The particle counter events are compressed. The particle count distributions
+ * are converted to differential values, and the prior event values are noted
  * here to support delta encoding, and initialized to zeros at the start of each
  * new data buffer so that each buffer can be decoded on its own.
+ *
+ * The sample values, in the order they are encoded.
  */
+typedef struct {
+    uint16_t length;
+    uint16_t checksum;
+    int32_t values[PMS_NUM_CHANNELS];
+} pms_sample_t;
 
-static void pms_read_task(void *pvParameters)
+/*
+ * The logging state. Identical consecutive samples are not logged, rather
+ * they are counted and logged as a repeat event when the values change. The
+ * repeat event repeats the last PMS event in the same data buffer, so if the
+ * buffer has changed then the repeated sample is logged again first.
+ */
+#define PMS_MAX_REPEATS 32
+
+typedef struct {
+    /* Added to the event codes, non-zero for the second sensor. */
+    uint32_t code_offset;
+    uint32_t segment;
+    int32_t last[PMS_NUM_CHANNELS];
+    rice_state_t rice[PMS_NUM_CHANNELS];
+    /* The predictor weights for this buffer, the segment they were logged
+     * in, and the statistics for the weights of the next buffer. */
+    int32_t weights[PMS_NUM_CHANNELS];
+    uint32_t weights_segment;
+    int64_t sxy[PMS_NUM_CHANNELS];
+    int64_t sxx[PMS_NUM_CHANNELS];
+    /* The last sample logged, and the count of repeats not yet logged. */
+    bool sample_valid;
+    pms_sample_t sample;
+    uint32_t repeats;
+} pms_log_t;
+
+/*
+ * Optional cross-channel prediction. The channels are correlated within a
+ * sample, so when 'pms_predict' is set the delta of each channel is predicted
+ * from the delta of the channel coded before it in the same sample, as
+ * (w * d + 8) >> 4 using an arithmetic shift, and only the residual is coded.
+ * The weight of each channel is fixed for a buffer, and logged in a weights
+ * event before the first predicted event in the buffer. The weights are the
+ * least squares fit over the samples of the prior buffer, clamped to
+ * [-32, 32] which bounds the residuals to within 20 bits.
+ */
+#define PMS_WEIGHT_SHIFT 4
+#define PMS_WEIGHT_MAX 32
+
+static int32_t pms_predict(int32_t weight, int32_t d)
 {
-    /* Delta encoding state. */
-    uint32_t last_segment = 0;
-    int32_t last_pm1a = 0;
-    int32_t last_pm25ad = 0;
-    int32_t last_pm10ad = 0;
-    int32_t last_pm1b = 0;
-    int32_t last_pm25bd = 0;
-    int32_t last_pm10bd = 0;
-    int32_t last_c1d = 0;
-    int32_t last_c2d = 0;
-    int32_t last_c3d = 0;
-    int32_t last_c4d = 0;
-    int32_t last_c5d = 0;
-    int32_t last_c6 = 0;
-    int32_t last_r1 = 0;
+    return (weight * d + (1 << (PMS_WEIGHT_SHIFT - 1))) >> PMS_WEIGHT_SHIFT;
+}
 
-    for (;;) {
-        /* Search for the "BM" header. */
-        uint8_t c = mygetc();
-        if (c != 'B')
-            continue;
-        
-        c = mygetc();
-        if (c != 'M')
-            continue;
+static void update_pms_weights(pms_log_t *log)
+{
+    uint32_t i;
+    for (i = 0; i < PMS_NUM_CHANNELS; i++) {
+        if (log->sxx[i] > 0) {
+            int64_t sxy = log->sxy[i] << PMS_WEIGHT_SHIFT;
+            int64_t sxx = log->sxx[i];
+            int64_t w = sxy >= 0 ? (sxy + sxx / 2) / sxx : -((-sxy + sxx / 2) / sxx);
+            if (w > PMS_WEIGHT_MAX)
+                w = PMS_WEIGHT_MAX;
+            else if (w < -PMS_WEIGHT_MAX)
+                w = -PMS_WEIGHT_MAX;
+            log->weights[i] = w;
+        }
+        log->sxy[i] = 0;
+        log->sxx[i] = 0;
+    }
+}
 
-        /* Read the length. */
-        uint16_t msb = mygetc();
-        uint8_t lsb = mygetc();
-        uint16_t length = msb << 8 | lsb;
-        if (length != 0x14 && length != 0x1c)
-            continue;
+static void reset_pms_log(pms_log_t *log)
+{
+    uint32_t i;
+    for (i = 0; i < PMS_NUM_CHANNELS; i++)
+        log->last[i] = 0;
+    init_rice_state(log->rice);
+    update_pms_weights(log);
+}
 
-        uint16_t checksum = 143 + msb + lsb;
-
-        msb = mygetc();
-        lsb = mygetc();
-        checksum += msb + lsb;
-        int32_t pm1a = msb << 8 | lsb;
-
-        msb = mygetc();
-        lsb = mygetc();
-        checksum += msb + lsb;
-        int32_t pm25a = msb << 8 | lsb;
-        int32_t pm25ad = pm25a - pm1a;
-
-        msb = mygetc();
-        lsb = mygetc();
-        checksum += msb + lsb;
-        int32_t pm10a = msb << 8 | lsb;
-        int32_t pm10ad = pm10a - pm25a;
-
-        msb = mygetc();
-        lsb = mygetc();
-        checksum += msb + lsb;
-        int32_t pm1b = msb << 8 | lsb;
-
-        msb = mygetc();
-        lsb = mygetc();
-        checksum += msb + lsb;
-        int32_t pm25b = msb << 8 | lsb;
-        int32_t pm25bd = pm25b - pm1b;
-
-        msb = mygetc();
-        lsb = mygetc();
-        checksum += msb + lsb;
-        int32_t pm10b = msb << 8 | lsb;
-        int32_t pm10bd = pm10b - pm25b;
-
-        msb = mygetc();
-        lsb = mygetc();
-        checksum += msb + lsb;
-        int32_t c1 = msb << 8 | lsb;
-
-        msb = mygetc();
-        lsb = mygetc();
-        checksum += msb + lsb;
-        int32_t c2 = msb << 8 | lsb;
-
-        int32_t c1d = c1 - c2;
-
-        int32_t c3 = 0;
-        int32_t c4 = 0;
-        int32_t c5 = 0;
-        int32_t c6 = 0;
-
-        if (length == 0x1c) {
-            msb = mygetc();
-            lsb = mygetc();
-            checksum += msb + lsb;
-            c3 = msb << 8 | lsb;
-
-            msb = mygetc();
-            lsb = mygetc();
-            checksum += msb + lsb;
-            c4 = msb << 8 | lsb;
-
-            msb = mygetc();
-            lsb = mygetc();
-            checksum += msb + lsb;
-            c5 = msb << 8 | lsb;
-
-            msb = mygetc();
-            lsb = mygetc();
-            checksum += msb + lsb;
-            c6 = msb << 8 | lsb;
+/* Log the predictor weights, returning false if the segment has changed. */
+static bool log_pms_weights(pms_log_t *log)
+{
+    uint32_t new_segment = log->segment;
+    uint8_t *buf = dbuf_reserve(&new_segment, DBUF_EVENT_PMS_WEIGHTS + log->code_offset,
+                                PMS_NUM_CHANNELS, 1);
+    if (new_segment != log->segment) {
+        log->segment = new_segment;
+        reset_pms_log(log);
+        return false;
+    }
+
+    if (buf) {
+        uint32_t len = 0;
+        uint32_t i;
+        for (i = 0; i < PMS_NUM_CHANNELS; i++)
+            len = emit_leb128_signed(buf, len, log->weights[i]);
+        dbuf_commit(len);
+    }
+
+    log->weights_segment = log->segment;
+    return true;
+}
+
+static void init_pms_log(pms_log_t *log, uint32_t code_offset)
+{
+    uint32_t i;
+    for (i = 0; i < PMS_NUM_CHANNELS; i++) {
+        log->weights[i] = 0;
+        log->sxy[i] = 0;
+        log->sxx[i] = 0;
+    }
+    log->code_offset = code_offset;
+    log->segment = 0;
+    log->weights_segment = 0xffffffff;
+    log->sample_valid = false;
+    log->repeats = 0;
+    reset_pms_log(log);
+}
+
+/* Encode the sample into buf, of at least PMS_EVENT_MAX_SIZE bytes, returning
+ * its size, and updating the code and predictor state but not the last
+ * values. */
+static uint32_t encode_pms_sample(pms_log_t *log, const pms_sample_t *sample,
+                                  uint8_t *buf)
+{
+    /* Channels 8 to 11 are only in the PMS5003 frames. */
+    uint32_t num_channels = sample->length == 0x1c ? PMS_NUM_CHANNELS : PMS_NUM_CHANNELS - 4;
+
+    /* Variable length encoding, directly into the buffer. */
+    bitwriter_t writer;
+    bitwriter_init(&writer, buf);
+    int32_t prior = 0;
+    uint32_t i;
+    for (i = 0; i < num_channels; i++) {
+        uint32_t channel = i < 8 ? i : i + PMS_NUM_CHANNELS - num_channels;
+        int32_t d = sample->values[channel] - log->last[channel];
+        if (param_pms_predict) {
+            int32_t r = d - pms_predict(log->weights[channel], prior);
+            log->sxy[channel] += (int64_t)prior * d;
+            log->sxx[channel] += (int64_t)prior * prior;
+            emit_rice(&writer, &log->rice[channel], r, 20);
+        } else {
+            emit_rice(&writer, &log->rice[channel], d, 18);
         }
+        prior = d;
+    }
 
-        int32_t c2d = c2 - c3;
+    /* Emit at least eight bits of the device supplied checksum and fill to a
+     * byte boundary with the rest so there will always be at least eight
+     * checksum bits and often more and at most 15 bits. */
+    bitwriter_emit(&writer, sample->checksum & 0x7fff, 15);
 
-        int32_t c3d = 0;
-        int32_t c4d = 0;
-        int32_t c5d = 0;
+    return bitwriter_flush(&writer);
+}
 
-        if (length == 0x1c) {
-            c3d = c3 - c4;
-            c4d = c4 - c5;
-            c5d = c5 - c6;
+static void log_pms_sample(pms_log_t *log, pms_sample_t *sample)
+{
+    while (1) {
+        if (param_pms_predict && log->weights_segment != log->segment &&
+            !log_pms_weights(log)) {
+            continue;
         }
 
-        msb = mygetc();
-        lsb = mygetc();
-        checksum += msb + lsb;
-        int32_t r1 = msb << 8 | lsb;
+        /* Reserve room for the event, and learn of a new segment before
+         * encoding. */
+        int32_t code;
+        if (param_pms_predict)
+            code = sample->length == 0x14 ? DBUF_EVENT_PMS3003_PREDICT : DBUF_EVENT_PMS5003_PREDICT;
+        else
+            code = sample->length == 0x14 ? DBUF_EVENT_PMS3003_RICE : DBUF_EVENT_PMS5003_RICE;
+        code += log->code_offset;
+        uint32_t new_segment = log->segment;
+        uint8_t *buf = dbuf_reserve(&new_segment, code, PMS_EVENT_MAX_SIZE, 1);
+        if (new_segment != log->segment) {
+            /* Moved on to a new buffer. Reset the delta encoding state and
+             * retry. */
+            log->segment = new_segment;
+            reset_pms_log(log);
+            continue;
+        }
 
-        msb = mygetc();
-        lsb = mygetc();
-        uint16_t expected_checksum = msb << 8 | lsb;
+        if (buf)
+            dbuf_commit(encode_pms_sample(log, sample, buf));
+
+        /* Commit the values logged, or discarded if logging is paused in which
+         * case a new segment will follow. Note this is the only task accessing
+         * this state so these updates are synchronized with the last event of
+         * this class append. */
+        memcpy(log->last, sample->values, sizeof(log->last));
+        if (sample != &log->sample)
+            log->sample = *sample;
+        log->sample_valid = true;
+        break;
+    }
+}
 
-        if (checksum != expected_checksum) {
-            blink_red();
+/* Log the pending count of repeats of the last sample logged. */
+static void log_pms_repeats(pms_log_t *log)
+{
+    while (log->repeats) {
+        uint32_t new_segment = log->segment;
+        uint8_t *buf = dbuf_reserve(&new_segment, DBUF_EVENT_PMS_REPEAT + log->code_offset,
+                                    5, 1);
+        if (new_segment != log->segment) {
+            /* Moved on to a new buffer, so log the repeated sample again as
+             * the first of the repeats. */
+            log->segment = new_segment;
+            reset_pms_log(log);
+            log_pms_sample(log, &log->sample);
+            log->repeats--;
             continue;
         }
 
+        if (buf)
+            dbuf_commit(emit_leb128(buf, 0, log->repeats));
+
+        log->repeats = 0;
+    }
+}
+
+/*
+ * The state of each sensor. The aggregation is of the absolute values: pm1a,
+ * pm25a, pm10a, pm1b, pm25b, pm10b, c1 to c6, and r1.
+ */
+typedef struct {
+    pms_frames_t *frames;
+    pms_log_t log;
+    aggregate_t aggregate;
+    aggregate_channel_t aggregate_channels[PMS_NUM_CHANNELS];
+} pms_sensor_t;
+
+static pms_sensor_t pms_sensors[2];
+
+static void init_pms_sensor(pms_sensor_t *sensor, pms_frames_t *frames,
+                            uint32_t code_offset)
+{
+    sensor->frames = frames;
+    init_pms_log(&sensor->log, code_offset);
+    init_aggregate(&sensor->aggregate, DBUF_EVENT_PMS5003 + code_offset,
+                   PMS_NUM_CHANNELS, sensor->aggregate_channels);
+}
+
+/* Blink if there have been more checksum errors. */
+static void pms_note_errors(pms_frames_t *frames)
+{
+    if (frames->checksum_errors != frames->last_checksum_errors) {
+        frames->last_checksum_errors = frames->checksum_errors;
+        blink_red();
+    }
+}
+
+/* Wait up to the given number of ticks for a frame, returning true if one is
+ * available. */
+static bool pms_wait_frame(pms_frames_t *frames, TickType_t ticks)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    while (frames->tail == frames->head) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= ticks)
+            return false;
+        ulTaskNotifyTake(pdTRUE, ticks - elapsed);
+        pms_note_errors(frames);
+    }
+
+    return true;
+}
+
+/* Discard any frames received. Only the task writes the tail, and the head
+ * frame is never one being assembled so this is safe. */
+static void pms_flush_frames(pms_frames_t *frames)
+{
+    frames->tail = frames->head;
+}
+
+/* Parse, log, and release the frame at the tail of the ring. */
+static void pms_handle_frame(pms_sensor_t *sensor)
+{
+    pms_frames_t *frames = sensor->frames;
+    pms_log_t *log = &sensor->log;
+    uint8_t *frame = frames->frames[frames->tail];
+    uint16_t length = frame[2] << 8 | frame[3];
+
+    int32_t pm1a = pms_word(frame, 0);
+    int32_t pm25a = pms_word(frame, 1);
+    int32_t pm10a = pms_word(frame, 2);
+    int32_t pm1b = pms_word(frame, 3);
+    int32_t pm25b = pms_word(frame, 4);
+    int32_t pm10b = pms_word(frame, 5);
+    int32_t c1 = pms_word(frame, 6);
+    int32_t c2 = pms_word(frame, 7);
+
+    int32_t c3 = 0;
+    int32_t c4 = 0;
+    int32_t c5 = 0;
+    int32_t c6 = 0;
+    int32_t r1;
+    uint16_t checksum;
+
+    if (length == 0x1c) {
+        c3 = pms_word(frame, 8);
+        c4 = pms_word(frame, 9);
+        c5 = pms_word(frame, 10);
+        c6 = pms_word(frame, 11);
+        r1 = pms_word(frame, 12);
+        checksum = pms_word(frame, 13);
+    } else {
+        r1 = pms_word(frame, 8);
+        checksum = pms_word(frame, 9);
+    }
+
+    /* Release the frame. */
+    uint32_t tail = frames->tail + 1;
+    if (tail >= PMS_NUM_FRAMES)
+        tail = 0;
+    frames->tail = tail;
+
+    /* Only the first sensor is reported, by pms_last_data(). */
+    if (sensor == &pms_sensors[0]) {
         pms_available = true;
         pms_counter = RTC.COUNTER;
         pms_pm1a = pm1a;
@@ -314,73 +772,206 @@ static void pms_read_task(void *pvParameters)
         pms_c5 = c5;
         pms_c6 = c6;
         pms_r1 = r1;
+        /* Synchronize the I2C sensor samples to this frame. */
+        i2c_note_pms_frame();
+    }
 
-        while (1) {
-            /* Variable length encoding. */
-            init_outbuf();
-            emit_var_int(pm1a - last_pm1a);
-            emit_var_int(pm25ad - last_pm25ad);
-            emit_var_int(pm10ad - last_pm10ad);
-            emit_var_int(pm1b - last_pm1b);
-            emit_var_int(pm25bd - last_pm25bd);
-            emit_var_int(pm10bd - last_pm10bd);
-            emit_var_int(c1d - last_c1d);
-            emit_var_int(c2d - last_c2d);
-            if (length == 0x1c) {
-                emit_var_int(c3d - last_c3d);
-                emit_var_int(c4d - last_c4d);
-                emit_var_int(c5d - last_c5d);
-                emit_var_int(c6 - last_c6);
-            }
-            emit_var_int(r1 - last_r1);
-
-            /* Emit at least eight bits of the device supplied checksum and fill
-             * to a byte boundary with the rest so there will always be at least
-             * eight checksum bits and often more and at most 15 bits. */
-            emitbits(expected_checksum, 15);
-
-            int len = outlen;
-            int32_t code = length == 0x14 ? DBUF_EVENT_PMS3003 : DBUF_EVENT_PMS5003;
-            uint32_t new_segment = dbuf_append(last_segment, code, outbuf, len, 1);
-            if (new_segment == last_segment) {
-                /* Commit the values logged. Note this is the only task
-                 * accessing this state so these updates are synchronized with
-                 * the last event of this class append. */
-                last_pm1a = pm1a;
-                last_pm25ad = pm25ad;
-                last_pm10ad = pm10ad;
-                last_pm1b = pm1b;
-                last_pm25bd = pm25bd;
-                last_pm10bd = pm10bd;
-                last_c1d = c1d;
-                last_c2d = c2d;
-                last_c3d = c3d;
-                last_c4d = c4d;
-                last_c5d = c5d;
-                last_c6 = c6;
-                last_r1 = r1;
-                break;
-            }
-
-            /* Moved on to a new buffer. Reset the delta encoding state and
-             * retry. */
-            last_segment = new_segment;
-            last_pm1a = 0;
-            last_pm25ad = 0;
-            last_pm10ad = 0;
-            last_pm1b = 0;
-            last_pm25bd = 0;
-            last_pm10bd = 0;
-            last_c1d = 0;
-            last_c2d = 0;
-            last_c3d = 0;
-            last_c4d = 0;
-            last_c5d = 0;
-            last_c6 = 0;
-            last_r1 = 0;
-        };
+    int32_t values[PMS_NUM_CHANNELS] = {pm1a, pm25a, pm10a, pm1b, pm25b, pm10b,
+                                        c1, c2, c3, c4, c5, c6, r1};
+    sensor->aggregate.code = length == 0x14 ? DBUF_EVENT_PMS3003 : DBUF_EVENT_PMS5003;
+    sensor->aggregate.code += log->code_offset;
+    aggregate_add(&sensor->aggregate, values);
 
+    if (!aggregate_raw_sample(&sensor->aggregate)) {
         blink_green();
+        return;
+    }
+
+    pms_sample_t sample;
+    sample.length = length;
+    sample.checksum = checksum;
+    sample.values[0] = pm1a;
+    sample.values[1] = pm25a - pm1a;
+    sample.values[2] = pm10a - pm25a;
+    sample.values[3] = pm1b;
+    sample.values[4] = pm25b - pm1b;
+    sample.values[5] = pm10b - pm25b;
+    sample.values[6] = c1 - c2;
+    sample.values[7] = c2 - c3;
+    sample.values[8] = 0;
+    sample.values[9] = 0;
+    sample.values[10] = 0;
+    sample.values[11] = c6;
+    sample.values[12] = r1;
+    if (length == 0x1c) {
+        sample.values[8] = c3 - c4;
+        sample.values[9] = c4 - c5;
+        sample.values[10] = c5 - c6;
+    }
+
+    if (log->sample_valid && log->sample.length == sample.length &&
+        log->sample.checksum == sample.checksum &&
+        memcmp(log->sample.values, sample.values, sizeof(sample.values)) == 0) {
+        /* A repeat, the checksum is implied. */
+        if (++log->repeats >= PMS_MAX_REPEATS)
+            log_pms_repeats(log);
+    } else {
+        log_pms_repeats(log);
+        log_pms_sample(log, &sample);
+    }
+
+    blink_green();
+}
+
+/*
+ * Duty cycling. The sensors accept commands on their RX line, which is the
+ * UART0 TX line, to sleep and wake the fan and to switch to a passive mode in
+ * which a frame is only sent on request. When the 'pms_period' is non-zero the
+ * sensor is woken at the start of each period, the frames are discarded for
+ * the warm-up time while the airflow stabilizes, then a burst of samples is
+ * requested at one second intervals, and then the sensor is put back to sleep
+ * for the rest of the period. The commands are sent again in each cycle in
+ * case one was lost. The state transitions are logged. A second sensor wired
+ * to the same TX line follows the same cycle, and its frames are discarded
+ * outside the sampling state.
+ */
+#define PMS_CMD_MODE 0xe1
+#define PMS_CMD_READ 0xe2
+#define PMS_CMD_SLEEP 0xe4
+
+#define PMS_STATE_SLEEP 0
+#define PMS_STATE_WARMUP 1
+#define PMS_STATE_SAMPLE 2
+
+#define PMS_SAMPLE_INTERVAL (1000 / portTICK_PERIOD_MS)
+
+/*
+ * The debug output is also written to the UART0 TX line, so when duty cycling
+ * stdout is redirected through a writer holding the same mutex as the
+ * commands, and a command is not interleaved with other output. The output is
+ * still received by the sensors, which ignore it as it lacks the "BM" header.
+ */
+static SemaphoreHandle_t pms_tx_sem = NULL;
+static _WriteFunction *pms_stdout_write;
+
+static ssize_t pms_write_stdout(struct _reent *r, int fd, const void *ptr, size_t len)
+{
+    xSemaphoreTake(pms_tx_sem, portMAX_DELAY);
+    ssize_t result = pms_stdout_write(r, fd, ptr, len);
+    xSemaphoreGive(pms_tx_sem);
+    return result;
+}
+
+static void pms_command(uint8_t command, uint16_t data)
+{
+    uint8_t cmd[7] = {'B', 'M', command, data >> 8, data, 0, 0};
+    uint16_t checksum = 0;
+    uint32_t i;
+
+    for (i = 0; i < 5; i++)
+        checksum += cmd[i];
+    cmd[5] = checksum >> 8;
+    cmd[6] = checksum;
+
+    if (pms_tx_sem)
+        xSemaphoreTake(pms_tx_sem, portMAX_DELAY);
+    for (i = 0; i < sizeof(cmd); i++)
+        uart_putc(0, cmd[i]);
+    uart_flush_txfifo(0);
+    if (pms_tx_sem)
+        xSemaphoreGive(pms_tx_sem);
+}
+
+static volatile uint8_t pms_state = PMS_STATE_SAMPLE;
+
+static void log_pms_state(uint8_t state)
+{
+    static uint32_t last_segment = 0;
+
+    pms_state = state;
+
+    while (1) {
+        uint32_t new_segment = dbuf_append(last_segment, DBUF_EVENT_PMS_STATE,
+                                           &state, 1, 1);
+        if (new_segment == last_segment)
+            break;
+        last_segment = new_segment;
+    }
+}
+
+static void pms_read_task(void *pvParameters)
+{
+    pms_sensor_t *sensor = &pms_sensors[0];
+    pms_frames_t *frames = sensor->frames;
+
+    if (!param_pms_period) {
+        /* Active mode, the sensor streams the frames. */
+        for (;;) {
+            pms_wait_frame(frames, portMAX_DELAY);
+            pms_handle_frame(sensor);
+        }
+    }
+
+    TickType_t period = param_pms_period * 1000 / portTICK_PERIOD_MS;
+    TickType_t warmup = param_pms_warmup * 1000 / portTICK_PERIOD_MS;
+
+    for (;;) {
+        TickType_t cycle_start = xTaskGetTickCount();
+
+        log_pms_state(PMS_STATE_WARMUP);
+        pms_command(PMS_CMD_SLEEP, 1);
+        pms_command(PMS_CMD_MODE, 0);
+        vTaskDelay(warmup);
+        pms_flush_frames(frames);
+
+        log_pms_state(PMS_STATE_SAMPLE);
+        TickType_t wake = xTaskGetTickCount();
+        uint32_t i;
+        for (i = 0; i < param_pms_samples; i++) {
+            pms_command(PMS_CMD_READ, 0);
+            if (pms_wait_frame(frames, PMS_SAMPLE_INTERVAL))
+                pms_handle_frame(sensor);
+            vTaskDelayUntil(&wake, PMS_SAMPLE_INTERVAL);
+        }
+        /* Log any repeats now, rather than holding them over the sleep. */
+        log_pms_repeats(&sensor->log);
+
+        pms_command(PMS_CMD_SLEEP, 0);
+        log_pms_state(PMS_STATE_SLEEP);
+        TickType_t elapsed = xTaskGetTickCount() - cycle_start;
+        if (elapsed < period)
+            vTaskDelay(period - elapsed);
+        pms_flush_frames(frames);
+    }
+}
+
+static void pms_soft_read_task(void *pvParameters)
+{
+    pms_sensor_t *sensor = &pms_sensors[1];
+    pms_frames_t *frames = sensor->frames;
+
+    for (;;) {
+        /* Wait for an edge, or poll while a byte is being received. */
+        ulTaskNotifyTake(pdTRUE, pms_soft_in_byte ? PMS_SOFT_POLL_TICKS : portMAX_DELAY);
+        /* Let the edges of a few bytes accumulate. */
+        vTaskDelay(PMS_SOFT_POLL_TICKS);
+        pms_soft_decode();
+        pms_note_errors(frames);
+
+        uint32_t overruns = pms_soft_edge_overruns;
+        if (overruns != pms_soft_last_edge_overruns) {
+            pms_soft_last_edge_overruns = overruns;
+            blink_red();
+        }
+
+        while (frames->tail != frames->head) {
+            if (param_pms_period && pms_state != PMS_STATE_SAMPLE) {
+                pms_flush_frames(frames);
+                log_pms_repeats(&sensor->log);
+                break;
+            }
+            pms_handle_frame(sensor);
+        }
     }
 }
 
@@ -392,6 +983,25 @@ void init_pms()
             sdk_system_uart_swap();
         }
         uart_set_baud(0, 9600);
-        xTaskCreate(&pms_read_task, "PMS reader", 272, NULL, 11, NULL);
+        if (param_pms_period) {
+            pms_tx_sem = xSemaphoreCreateMutex();
+            pms_stdout_write = get_write_stdout();
+            set_write_stdout(pms_write_stdout);
+        }
+        init_pms_sensor(&pms_sensors[0], &pms_uart_frames, 0);
+        xTaskCreate(&pms_read_task, "PMS reader", 272, NULL, 11, &pms_uart_frames.task);
+        init_pms_uart();
+    }
+
+    /* GPIO16 does not support interrupts. */
+    if (param_pms2_gpio < 16) {
+        pms_soft_edges = malloc(PMS_SOFT_NUM_EDGES * sizeof(uint32_t));
+        if (!pms_soft_edges) {
+            printf("Error: no memory for the second PMS sensor\n");
+            return;
+        }
+        init_pms_sensor(&pms_sensors[1], &pms_soft_frames, DBUF_EVENT_PMS_SENSOR2);
+        xTaskCreate(&pms_soft_read_task, "PMS2 reader", 272, NULL, 11, &pms_soft_frames.task);
+        init_pms_soft_uart();
     }
 }
@@ -22,8 +22,10 @@
 #include "espressif/esp_common.h"
 
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <ctype.h>
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -54,14 +56,14 @@ TaskHandle_t post_data_task = NULL;
  * A single buffer is allocated to hold the HTTP data to be sent and it is large
  * enough for the HTTP header plus the content including a signature suffix. The
  * content is located at a fixed position into the buffer and word aligned so
- * the flash data can be copied directly to this buffer. For the computation of
- * a MAC-SHA3 signature the key prefix is copied before the data so the prefix
- * allocation needs to be large enough for this too.
+ * the flash data can be copied directly to this buffer. The MAC-SHA3 signature
+ * is computed by absorbing the content into a copy of the sponge state that
+ * has already absorbed the key, so the key is not copied before the data.
  */
 
 #define SIGNATURE_SIZE 28
 
- /* At least the key_size of 287 bytes, round up gives an alignment 32. */
+ /* Room for the HTTP header, a multiple of 32 to keep the content aligned. */
 #define PREFIX_SIZE 288
 
 /*
@@ -75,13 +77,165 @@ TaskHandle_t post_data_task = NULL;
 #define POST_BUFFER_SIZE (PREFIX_SIZE + 4 + 4 + 4 + 4 + CHUNK_SIZE + SIGNATURE_SIZE)
 static uint8_t *post_buf;
 
+/*
+ * The MAC-SHA3 sponge state after absorbing the key. This is computed once and
+ * cloned for each post, avoiding absorbing the key for every post.
+ */
+static Keccak_SpongeInstance *post_key_sponge;
+
 #define MAX_HOLD_OFF_TIME 1800000 /* 30 minutes */
 
+/*
+ * The connection to the server is kept open between posts, using HTTP/1.1
+ * persistent connections, so that a backlog of chunks can be pushed without a
+ * TCP handshake and teardown per chunk. The server response content is
+ * delimited by its Content-Length so the end of a response is known without
+ * waiting for the server to close the connection.
+ */
+
+/* Open a connection to the server, returning the socket or -1 on failure. */
+static int post_connect()
+{
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+
+    int err = getaddrinfo(param_web_server, param_web_port, &hints, &res);
+    if (err != 0 || res == NULL) {
+        if (res)
+            freeaddrinfo(res);
+        return -1;
+    }
+
+    int s = socket(res->ai_family, res->ai_socktype, 0);
+    if (s < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    /* Route via the station interface, which is always en0. */
+    const struct ifreq ifreq = { "en0" };
+    setsockopt(s, SOL_SOCKET, SO_BINDTODEVICE, &ifreq, sizeof(ifreq));
+
+    const struct timeval timeout = { 60, 0 }; /* 60 second timeout */
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (connect(s, res->ai_addr, res->ai_addrlen) != 0) {
+        close(s);
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    freeaddrinfo(res);
+    return s;
+}
+
+/*
+ * Close the connection. Wait briefly for the server to close its end, while
+ * consuming any excess input to avoid a connection reset.
+ */
+static void post_close(int s)
+{
+    const struct timeval timeout5 = { 5, 0 }; /* 5 second timeout */
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout5, sizeof(timeout5));
+    size_t len;
+    for (len = 0; len < 4096; ) {
+        char buf[32];
+        int res = read(s, buf, sizeof(buf));
+        if (res <= 0) break;
+        len += res;
+    }
+
+    close(s);
+}
+
+/*
+ * Buffered reading of the server response, to avoid a read call per byte.
+ */
+typedef struct {
+    int s;
+    int start;
+    int end;
+    uint8_t buf[128];
+} recv_state_t;
+
+/* Return the next byte of the response, or -1 on an error or end of file. */
+static int recv_byte(recv_state_t *rs)
+{
+    if (rs->start >= rs->end) {
+        int r = read(rs->s, rs->buf, sizeof(rs->buf));
+        if (r <= 0)
+            return -1;
+        rs->start = 0;
+        rs->end = r;
+    }
+    return rs->buf[rs->start++];
+}
+
+/*
+ * Read the response status line and headers, noting the content length, or -1
+ * if not given, and if the connection can be kept open. Returns false if the
+ * end of the headers is not found.
+ */
+static bool recv_headers(recv_state_t *rs, int32_t *content_length,
+                         bool *keep_alive)
+{
+    char line[48];
+    int len = 0;
+    bool status_line = true;
+
+    *content_length = -1;
+    *keep_alive = true;
+
+    while (1) {
+        int c = recv_byte(rs);
+        if (c < 0)
+            return false;
+        if (c == '\r')
+            continue;
+        if (c != '\n') {
+            /* Only the start of the lines is needed, truncate long lines. */
+            if (len < sizeof(line) - 1)
+                line[len++] = tolower(c);
+            continue;
+        }
+
+        line[len] = 0;
+        if (len == 0) {
+            /* End of the headers. */
+            return true;
+        }
+
+        if (status_line) {
+            /* A HTTP/1.0 server closes the connection by default. */
+            if (!strncmp(line, "http/1.0", 8))
+                *keep_alive = false;
+            status_line = false;
+        } else if (!strncmp(line, "content-length:", 15)) {
+            *content_length = strtol(&line[15], NULL, 10);
+        } else if (!strncmp(line, "connection:", 11)) {
+            if (strstr(&line[11], "close"))
+                *keep_alive = false;
+        }
+        len = 0;
+    }
+}
+
 static void post_data(void *pvParameters)
 {
     uint32_t last_segment = 0;
     uint32_t last_recv_sec = 0;
 
+    /* The connection to the server, or -1 if not connected. */
+    int s = -1;
+    /* Set once a response has been received on the connection, so that a
+     * failure of the next post might be due to the server having closed it
+     * while idle. */
+    bool s_reused = false;
+
     /*
      * A retry hold-off time in msec. Reset to zero upon a success and otherwise
      * increased on each retry. This is intended avoid loading the network and
@@ -126,62 +280,33 @@ static void post_data(void *pvParameters)
              * close to the time posted as possible and it can not be patched in
              * just before sending as it is part of the signed message.
              */
-            
-            while (1) {
-                uint8_t connect_status = sdk_wifi_station_get_connect_status();
-                if (connect_status == STATION_GOT_IP)
-                    break;
-                vTaskDelay(1000 / portTICK_PERIOD_MS);
-            }
-
-            /*
-             * Notifty wificfg to disable the AP interface on the next restart
-             * if that option is enabled.
-             */
-            wificfg_got_sta_connect();
-
-            const struct addrinfo hints = {
-                .ai_family = AF_INET,
-                .ai_socktype = SOCK_STREAM,
-            };
-            struct addrinfo *res;
-
-            int err = getaddrinfo(param_web_server, param_web_port, &hints, &res);
-            if (err != 0 || res == NULL) {
-                if (res)
-                    freeaddrinfo(res);
-                continue;
-            }
-
-            int s = socket(res->ai_family, res->ai_socktype, 0);
             if (s < 0) {
-                freeaddrinfo(res);
-                continue;
-            }
-
-            /* Route via the station interface, which is always en0. */
-            const struct ifreq ifreq = { "en0" };
-            setsockopt(s, SOL_SOCKET, SO_BINDTODEVICE, &ifreq, sizeof(ifreq));
+                while (1) {
+                    uint8_t connect_status = sdk_wifi_station_get_connect_status();
+                    if (connect_status == STATION_GOT_IP)
+                        break;
+                    vTaskDelay(1000 / portTICK_PERIOD_MS);
+                }
 
-            const struct timeval timeout = { 60, 0 }; /* 60 second timeout */
-            setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-            setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                /*
+                 * Notifty wificfg to disable the AP interface on the next
+                 * restart if that option is enabled.
+                 */
+                wificfg_got_sta_connect();
 
-            if (connect(s, res->ai_addr, res->ai_addrlen) != 0) {
-                close(s);
-                freeaddrinfo(res);
-                continue;
+                s = post_connect();
+                if (s < 0)
+                    continue;
+                s_reused = false;
             }
 
-            freeaddrinfo(res);
-
-
             /* Delay this allocation, to avoid using this memory unless a
              * connection is possible. */
             if (!post_buf) {
                 post_buf = malloc(POST_BUFFER_SIZE);
                 if (!post_buf) {
                     close(s);
+                    s = -1;
                     continue;
                 }
             }
@@ -293,8 +418,13 @@ static void post_data(void *pvParameters)
             } while (size == 0);
 
             if (size == 0) {
+                /* Caught up, so close the connection rather than holding it
+                 * open while waiting for more data. The prior response has
+                 * been consumed and the server was asked to keep the
+                 * connection alive, so do not wait for it to close its end. */
                 clear_maybe_buffer_to_post();
                 close(s);
+                s = -1;
                 break;
             }
 
@@ -325,20 +455,21 @@ static void post_data(void *pvParameters)
             post_buf[PREFIX_SIZE + 15] = index_size_pushed >> 24;
 
             /*
-             * Firstly use the prefix area for the key to implement MAC-SHA3.
+             * Sign the content using MAC-SHA3, continuing from the keyed
+             * sponge state.
              */
-            memcpy(&post_buf[PREFIX_SIZE - param_key_size], param_sha3_key, param_key_size);
-            FIPS202_SHA3_224(&post_buf[PREFIX_SIZE - param_key_size],
-                             param_key_size + 16 + size,
-                             &post_buf[PREFIX_SIZE + 16 + size]);
+            Keccak_SpongeInstance sponge;
+            Keccak_SpongeClone(&sponge, post_key_sponge);
+            Keccak_SpongeAbsorb(&sponge, &post_buf[PREFIX_SIZE], 16 + size);
+            FIPS202_SHA3_224_Final(&sponge, &post_buf[PREFIX_SIZE + 16 + size]);
 
             /*
-             * Next use the prefix area for the HTTP header.
+             * Use the prefix area for the HTTP header.
              */
             uint32_t header_size = snprintf((char *)post_buf, PREFIX_SIZE,
                                             "POST %s HTTP/1.1\r\n"
                                             "Host: %s:%s\r\n"
-                                            "Connection: close\r\n"
+                                            "Connection: keep-alive\r\n"
                                             "Content-Type: application/octet-stream\r\n"
                                             "Content-Length: %d\r\n"
                                             "\r\n", param_web_path, param_web_server,
@@ -351,192 +482,181 @@ static void post_data(void *pvParameters)
                 post_buf[PREFIX_SIZE - j - 1] = post_buf[header_size - j - 1];
 
             /*
-             * Data ready to send.
+             * Data ready to send. A failure on a kept open connection, usually
+             * seen when reading the response headers, might be due to the
+             * server having closed it while idle, so retry once now on a new
+             * connection before counting it as a failure and holding off.
              */
-            if (write(s, &post_buf[PREFIX_SIZE - header_size],
-                      header_size + 16 + size + SIGNATURE_SIZE) < 0) {
+            recv_state_t rs;
+            int32_t content_length;
+            bool keep_alive;
+            while (1) {
+                if (write(s, &post_buf[PREFIX_SIZE - header_size],
+                          header_size + 16 + size + SIGNATURE_SIZE) >= 0) {
+                    rs.s = s;
+                    rs.start = 0;
+                    rs.end = 0;
+                    if (recv_headers(&rs, &content_length, &keep_alive))
+                        break;
+                }
                 close(s);
+                s = -1;
+                if (!s_reused)
+                    break;
+                s_reused = false;
+                s = post_connect();
+                if (s < 0)
+                    break;
+            }
+            if (s < 0)
                 continue;
+            s_reused = true;
+
+            /* Read the response content. Accept larger responses, for future
+             * extension, but only the start is used. If there is no
+             * content-length then read to the end and close the connection. */
+            uint8_t recv_buf[20];
+            int32_t end = 0;
+            if (content_length < 0) {
+                content_length = 4096;
+                keep_alive = false;
+            }
+            while (end < content_length) {
+                int c = recv_byte(&rs);
+                if (c < 0) {
+                    keep_alive = false;
+                    break;
+                }
+                if (end < sizeof(recv_buf))
+                    recv_buf[end] = c;
+                end++;
             }
 
-            char recv_buf[128];
-            int r;
-            /* Search for the end of the response headers */
-            int end = 0;
-            int headers_end = 0;
-            int i;
-            do {
-                r = read(s, recv_buf + end, 127 - end);
-                if (r > 0) {
-                    end += r;
-                    if (end >= 4) {
-                        for (i = 0; i < end - 4; i++) {
-                            if (recv_buf[i + 0] == '\r' &&
-                                recv_buf[i + 1] == '\n' &&
-                                recv_buf[i + 2] == '\r' &&
-                                recv_buf[i + 3] == '\n') {
-                                headers_end = i + 4;
+            /* There is a magic number that indicates a successful response
+             * which is checked. */
+            if (end >= 20) {
+                uint32_t recv_magic = recv_buf[0] |
+                    (recv_buf[1] << 8) |
+                    (recv_buf[2] << 16) |
+                    (recv_buf[3] << 24);
+                uint32_t recv_sec = recv_buf[4] |
+                    (recv_buf[5] << 8) |
+                    (recv_buf[6] << 16) |
+                    (recv_buf[7] << 24);
+                uint32_t recv_usec = recv_buf[8] |
+                    (recv_buf[9] << 8) |
+                    (recv_buf[10] << 16) |
+                    (recv_buf[11] << 24);
+                uint32_t recv_index = recv_buf[12] |
+                    (recv_buf[13] << 8) |
+                    (recv_buf[14] << 16) |
+                    (recv_buf[15] << 24);
+                uint32_t recv_size = recv_buf[16] |
+                    (recv_buf[17] << 8) |
+                    (recv_buf[18] << 16) |
+                    (recv_buf[19] << 24);
+
+                uint32_t magic = param_sensor_id ^ time;
+                if (recv_magic == magic) {
+                    /*
+                     * Update the clock using the server response time.
+                     */
+                    ds3231_note_time(recv_sec);
+
+                    /* Log the server time in it's response. This gives time
+                     * stamps to the events logged to help synchronize the RTC
+                     * counter to the real time. While the server could log the
+                     * times to synchronize to the RTC counter, this gives some
+                     * resilience against server data loss and allows the
+                     * sectors recorded to stand on their own.
+                     *
+                     * The event time-stamp is close enough to the received
+                     * time, and includes the posted time too to allow matching
+                     * with the server recorded times and also to give the
+                     * round-trip time to send and receive the post which might
+                     * help estimate the accuracy. Re-use the post_buf to build
+                     * this event.
+                     *
+                     * Skip logging this event if there was another POST event
+                     * logged in the last 60 seconds. This limits the storage
+                     * space used when a lot of sectors are posted one after the
+                     * other, and one every 60 seconds seems adequate for the
+                     * purpose of synchronizing the times.
+                     *
+                     */
+                    if (recv_sec > last_recv_sec + 60) {
+                        post_buf[PREFIX_SIZE + 0] = time;
+                        post_buf[PREFIX_SIZE + 1] = time >>  8;
+                        post_buf[PREFIX_SIZE + 2] = time >> 16;
+                        post_buf[PREFIX_SIZE + 3] = time >> 24;
+
+                        post_buf[PREFIX_SIZE + 4] = recv_sec;
+                        post_buf[PREFIX_SIZE + 5] = recv_sec >>  8;
+                        post_buf[PREFIX_SIZE + 6] = recv_sec >> 16;
+                        post_buf[PREFIX_SIZE + 7] = recv_sec >> 24;
+
+                        post_buf[PREFIX_SIZE + 8] = recv_usec;
+                        post_buf[PREFIX_SIZE + 9] = recv_usec >>  8;
+                        post_buf[PREFIX_SIZE + 10] = recv_usec >> 16;
+                        post_buf[PREFIX_SIZE + 11] = recv_usec >> 24;
+
+                        while (1) {
+                            uint32_t new_segment = dbuf_append(last_segment,
+                                                               DBUF_EVENT_POST_TIME,
+                                                               &post_buf[PREFIX_SIZE],
+                                                               12, 0);
+                            if (new_segment == last_segment) {
+                                last_recv_sec = recv_sec;
                                 break;
                             }
+                            last_segment = new_segment;
                         }
-                        if (headers_end)
-                            break;
-                        /* Keep the last three bytes as they might have
-                         * contained part of the end of the headers. */
-                        for (i = 0; i < 3; i++)
-                            recv_buf[i] = recv_buf[end - 3 + i];
-                        end = 3;
                     }
-                }
-            } while (r > 0);
-
-            if (headers_end) {
-                /* Shift down. */
-                end -= headers_end;
-                for (i = 0; i < end; i++)
-                    recv_buf[i] = recv_buf[headers_end + i];
-                /* Keep reading the body. */
-                while (end < 20) {
-                    r = read(s, recv_buf + end, 127 - end);
-                    if (r < 0)
-                        break;
-                    end += r;
-                };
-
-                /* Accept larger responses, for future extension. There is a
-                 * magic number that indicates a successful response which is
-                 * checked. */
-                if (end >= 20) {
-                    uint32_t recv_magic = recv_buf[0] |
-                        (recv_buf[1] << 8) |
-                        (recv_buf[2] << 16) |
-                        (recv_buf[3] << 24);
-                    uint32_t recv_sec = recv_buf[4] |
-                        (recv_buf[5] << 8) |
-                        (recv_buf[6] << 16) |
-                        (recv_buf[7] << 24);
-                    uint32_t recv_usec = recv_buf[8] |
-                        (recv_buf[9] << 8) |
-                        (recv_buf[10] << 16) |
-                        (recv_buf[11] << 24);
-                    uint32_t recv_index = recv_buf[12] |
-                        (recv_buf[13] << 8) |
-                        (recv_buf[14] << 16) |
-                        (recv_buf[15] << 24);
-                    uint32_t recv_size = recv_buf[16] |
-                        (recv_buf[17] << 8) |
-                        (recv_buf[18] << 16) |
-                        (recv_buf[19] << 24);
-
-                    uint32_t magic = param_sensor_id ^ time;
-                    if (recv_magic == magic) {
-                        /*
-                         * Update the clock using the server response time.
-                         */
-                        ds3231_note_time(recv_sec);
-
-                        /* Log the server time in it's response. This gives time
-                         * stamps to the events logged to help synchronize the
-                         * RTC counter to the real time. While the server could
-                         * log the times to synchronize to the RTC counter, this
-                         * gives some resilience against server data loss and
-                         * allows the sectors recorded to stand on their own.
-                         *
-                         * The event time-stamp is close enough to the received
-                         * time, and includes the posted time too to allow
-                         * matching with the server recorded times and also to
-                         * give the round-trip time to send and receive the post
-                         * which might help estimate the accuracy. Re-use the
-                         * post_buf to build this event.
-                         *
-                         * Skip logging this event if there was another POST
-                         * event logged in the last 60 seconds. This limits the
-                         * storage space used when a lot of sectors are posted
-                         * one after the other, and one every 60 seconds seems
-                         * adequate for the purpose of synchronizing the times.
-                         *
-                         */
-                        if (recv_sec > last_recv_sec + 60) {
-                            post_buf[PREFIX_SIZE + 0] = time;
-                            post_buf[PREFIX_SIZE + 1] = time >>  8;
-                            post_buf[PREFIX_SIZE + 2] = time >> 16;
-                            post_buf[PREFIX_SIZE + 3] = time >> 24;
-
-                            post_buf[PREFIX_SIZE + 4] = recv_sec;
-                            post_buf[PREFIX_SIZE + 5] = recv_sec >>  8;
-                            post_buf[PREFIX_SIZE + 6] = recv_sec >> 16;
-                            post_buf[PREFIX_SIZE + 7] = recv_sec >> 24;
-
-                            post_buf[PREFIX_SIZE + 8] = recv_usec;
-                            post_buf[PREFIX_SIZE + 9] = recv_usec >>  8;
-                            post_buf[PREFIX_SIZE + 10] = recv_usec >> 16;
-                            post_buf[PREFIX_SIZE + 11] = recv_usec >> 24;
-
-                            while (1) {
-                                uint32_t new_segment = dbuf_append(last_segment,
-                                                                   DBUF_EVENT_POST_TIME,
-                                                                   &post_buf[PREFIX_SIZE],
-                                                                   12, 0);
-                                if (new_segment == last_segment) {
-                                    last_recv_sec = recv_sec;
-                                    break;
-                                }
-                                last_segment = new_segment;
-                            }
-                        }
 
-                        /* The server response is used to set the buffer indexes
-                         * known to have been received. This allows the server
-                         * to request data be re-sent, or to skip over data
-                         * already received when restarted.
-                         */
-                        if (recv_index != index_being_pushed) {
-                            if (recv_index > index_being_pushed &&
-                                index_being_pushed_next_index == 0xffffffff) {
-                                /* Looks like a bad request from the server for
-                                 * an index beyond those stored on the
-                                 * device. Need to catch this or the device will
-                                 * continue sending data back and not stop.
-                                 */
-                                index_size_pushed = index_size_being_pushed;
-                            } else {
-                                index_being_pushed = recv_index;
-                                /* Ignore the size in this case, to avoid
-                                 * getting and checking the new index size.
-                                 * The server will move it along again.
-                                 */
-                                index_size_being_pushed = 0;
-                                index_size_pushed = 0;
-                                index_being_pushed_sealed = false;
-                                index_being_pushed_next_index = 0xffffffff;
-                            }
+                    /* The server response is used to set the buffer indexes
+                     * known to have been received. This allows the server to
+                     * request data be re-sent, or to skip over data already
+                     * received when restarted.
+                     */
+                    if (recv_index != index_being_pushed) {
+                        if (recv_index > index_being_pushed &&
+                            index_being_pushed_next_index == 0xffffffff) {
+                            /* Looks like a bad request from the server for an
+                             * index beyond those stored on the device. Need to
+                             * catch this or the device will continue sending
+                             * data back and not stop.
+                             */
+                            index_size_pushed = index_size_being_pushed;
                         } else {
-                            if (recv_size > index_size_being_pushed) {
-                                recv_size = index_size_being_pushed;
-                            }
-                            index_size_pushed = recv_size;
+                            index_being_pushed = recv_index;
+                            /* Ignore the size in this case, to avoid getting
+                             * and checking the new index size.  The server
+                             * will move it along again.
+                             */
+                            index_size_being_pushed = 0;
+                            index_size_pushed = 0;
+                            index_being_pushed_sealed = false;
+                            index_being_pushed_next_index = 0xffffffff;
+                        }
+                    } else {
+                        if (recv_size > index_size_being_pushed) {
+                            recv_size = index_size_being_pushed;
                         }
-                        blink_white();
-                        hold_off_time = 0;
+                        index_size_pushed = recv_size;
                     }
+                    blink_white();
+                    hold_off_time = 0;
                 }
             }
 
             /*
-             * At this point the server is expected to close the connection, so
-             * wait briefly for it to do so before giving up. While here consume
-             * any excess input to avoid a connection reset.
+             * Keep the connection open for the next post unless the server
+             * has asked to close it.
              */
-            const struct timeval timeout5 = { 5, 0 }; /* 5 second timeout */
-            setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout5, sizeof(timeout5));
-            size_t len;
-            for (len = 0; len < 4096; len++) {
-                char c;
-                int res = read(s, &c, 1);
-                if (res != 1) break;
+            if (!keep_alive) {
+                post_close(s);
+                s = -1;
             }
-
-            close(s);
         }
     }
 }
@@ -550,6 +670,15 @@ void init_post()
         if (mode != STATION_MODE && mode != STATIONAP_MODE) {
             return;
         }
-        xTaskCreate(&post_data, "OAQ Push", 448, NULL, 1, &post_data_task);
+        post_key_sponge = malloc(sizeof(Keccak_SpongeInstance));
+        if (!post_key_sponge) {
+            return;
+        }
+        FIPS202_SHA3_224_Initialize(post_key_sponge);
+        Keccak_SpongeAbsorb(post_key_sponge, param_sha3_key, param_key_size);
+        /* The unrolled Keccak permutation, called when signing a post, has a
+         * frame about 616 bytes larger than the readable implementation, so
+         * the stack has 160 words above the 448 words used before. */
+        xTaskCreate(&post_data, "OAQ Push", 608, NULL, 1, &post_data_task);
     }
 }
@@ -0,0 +1,340 @@
+/*
+ * Adaptive binary range coder for the buffer event streams.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * A buffer is coded a byte at a time, each byte as eight binary decisions on a
+ * tree of adaptive probabilities, msb first. The tree used depends on the
+ * position in the event stream, which is parsed as it is coded so that the
+ * decoder can follow the same parse from the bytes already decoded. The data
+ * bytes of each event code are modelled separately as the values have quite
+ * different distributions.
+ *
+ * The coder is the carry-less LZMA style coder, with 11 bit probabilities
+ * adapting with a shift of 5. The model is reset for each buffer so each
+ * stands alone.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "rc.h"
+
+#define RC_PROB_BITS 11
+#define RC_PROB_INIT (1 << (RC_PROB_BITS - 1))
+#define RC_MOVE_BITS 5
+#define RC_TOP (1 << 24)
+
+/*
+ * Event stream parser. The buffer starts with an eight byte index, and then
+ * the events each have a leb128 header, either the code and format followed by
+ * the size and the time delta, or if the same code and size as the prior event
+ * just the format and time delta. These are followed by the event data. In a
+ * buffer with the times predicted, flagged by its first event, the time is
+ * omitted when bit 1 of the format is set.
+ */
+#define RC_STATE_INDEX 0
+#define RC_STATE_HEADER 1
+#define RC_STATE_SIZE 2
+#define RC_STATE_TIME 3
+#define RC_STATE_DATA 4
+
+typedef struct {
+    uint32_t state;
+    uint32_t count;
+    uint32_t value;
+    uint32_t shift;
+    uint32_t code;
+    uint32_t size;
+    uint32_t format;
+    bool time_predict;
+} rc_parser_t;
+
+static void rc_parser_init(rc_parser_t *parser)
+{
+    parser->state = RC_STATE_INDEX;
+    parser->count = 0;
+    parser->value = 0;
+    parser->shift = 0;
+    parser->code = 0;
+    parser->size = 0;
+    parser->format = 0;
+    parser->time_predict = false;
+}
+
+static uint32_t rc_context(rc_parser_t *parser)
+{
+    switch (parser->state) {
+    case RC_STATE_INDEX:
+        return 0;
+    case RC_STATE_HEADER:
+        return parser->count == 0 ? 1 : 2;
+    case RC_STATE_SIZE:
+    case RC_STATE_TIME:
+        return 2;
+    default:
+        return 3 + parser->code % RC_CODE_CONTEXTS;
+    }
+}
+
+/* Accumulate a leb128 value, returning true on the last byte. */
+static bool rc_parse_leb128(rc_parser_t *parser, uint8_t byte)
+{
+    if (parser->shift < 32)
+        parser->value |= (uint32_t)(byte & 0x7f) << parser->shift;
+    parser->shift += 7;
+    parser->count++;
+    return (byte & 0x80) == 0;
+}
+
+static void rc_parse_next(rc_parser_t *parser, uint32_t state)
+{
+    parser->state = state;
+    parser->count = 0;
+    parser->value = 0;
+    parser->shift = 0;
+}
+
+static void rc_parse(rc_parser_t *parser, uint8_t byte)
+{
+    switch (parser->state) {
+    case RC_STATE_INDEX:
+        if (++parser->count >= 8)
+            rc_parse_next(parser, RC_STATE_HEADER);
+        break;
+    case RC_STATE_HEADER:
+        if (rc_parse_leb128(parser, byte)) {
+            if (parser->value & 1) {
+                parser->code = parser->value >> 2;
+                parser->format = parser->value & 2;
+                if (parser->code == DBUF_EVENT_TIME_PREDICT)
+                    parser->time_predict = true;
+                rc_parse_next(parser, RC_STATE_SIZE);
+            } else {
+                /* Same code and size as the prior event, and the time delta
+                 * is in this value. */
+                rc_parse_next(parser, parser->size ? RC_STATE_DATA : RC_STATE_HEADER);
+            }
+        }
+        break;
+    case RC_STATE_SIZE:
+        if (rc_parse_leb128(parser, byte)) {
+            parser->size = parser->value;
+            if (parser->time_predict && parser->format)
+                rc_parse_next(parser, parser->size ? RC_STATE_DATA : RC_STATE_HEADER);
+            else
+                rc_parse_next(parser, RC_STATE_TIME);
+        }
+        break;
+    case RC_STATE_TIME:
+        if (rc_parse_leb128(parser, byte)) {
+            rc_parse_next(parser, parser->size ? RC_STATE_DATA : RC_STATE_HEADER);
+        }
+        break;
+    default:
+        if (++parser->count >= parser->size)
+            rc_parse_next(parser, RC_STATE_HEADER);
+        break;
+    }
+}
+
+static void rc_model_init(rc_model_t *model)
+{
+    uint32_t i, j;
+    for (i = 0; i < RC_NUM_CONTEXTS; i++)
+        for (j = 0; j < 256; j++)
+            model->probs[i][j] = RC_PROB_INIT;
+}
+
+
+typedef struct {
+    uint64_t low;
+    uint32_t range;
+    uint8_t cache;
+    uint32_t cache_size;
+    uint8_t *dst;
+    uint32_t dst_size;
+    uint32_t len;
+} rc_encoder_t;
+
+static void rc_shift_low(rc_encoder_t *enc)
+{
+    if ((uint32_t)enc->low < 0xff000000 || (enc->low >> 32) != 0) {
+        uint8_t carry = enc->low >> 32;
+        uint8_t byte = enc->cache;
+        do {
+            if (enc->len < enc->dst_size)
+                enc->dst[enc->len] = byte + carry;
+            enc->len++;
+            byte = 0xff;
+        } while (--enc->cache_size != 0);
+        enc->cache = enc->low >> 24;
+    }
+    enc->cache_size++;
+    enc->low = (enc->low & 0x00ffffff) << 8;
+}
+
+static void rc_encode_bit(rc_encoder_t *enc, uint16_t *prob, uint32_t bit)
+{
+    uint32_t bound = (enc->range >> RC_PROB_BITS) * *prob;
+
+    if (bit == 0) {
+        enc->range = bound;
+        *prob += ((1 << RC_PROB_BITS) - *prob) >> RC_MOVE_BITS;
+    } else {
+        enc->low += bound;
+        enc->range -= bound;
+        *prob -= *prob >> RC_MOVE_BITS;
+    }
+
+    while (enc->range < RC_TOP) {
+        enc->range <<= 8;
+        rc_shift_low(enc);
+    }
+}
+
+/*
+ * Compress the buffer of size bytes, returning the compressed size, or zero if
+ * it does not fit in dst_size bytes.
+ */
+uint32_t rc_compress(rc_model_t *model, const uint8_t *src, uint32_t size,
+                     uint8_t *dst, uint32_t dst_size)
+{
+    rc_encoder_t enc;
+    enc.low = 0;
+    enc.range = 0xffffffff;
+    enc.cache = 0;
+    enc.cache_size = 1;
+    enc.dst = dst;
+    enc.dst_size = dst_size;
+    enc.len = 0;
+
+    rc_parser_t parser;
+    rc_parser_init(&parser);
+    rc_model_init(model);
+
+    uint32_t i;
+    for (i = 0; i < size && enc.len <= dst_size; i++) {
+        uint16_t *probs = model->probs[rc_context(&parser)];
+        uint32_t byte = src[i];
+        uint32_t m = 1;
+        int32_t bit;
+        for (bit = 7; bit >= 0; bit--) {
+            uint32_t b = (byte >> bit) & 1;
+            rc_encode_bit(&enc, &probs[m], b);
+            m = (m << 1) | b;
+        }
+        rc_parse(&parser, byte);
+    }
+
+    for (i = 0; i < 5; i++)
+        rc_shift_low(&enc);
+
+    return enc.len <= dst_size ? enc.len : 0;
+}
+
+/*
+ * Decompress size bytes into dst. The source may be truncated of trailing
+ * ones, as read from the flash. Returns false if the data does not end on an
+ * event boundary, which indicates corrupt data.
+ */
+bool rc_decompress(rc_model_t *model, const uint8_t *src, uint32_t src_size,
+                   uint8_t *dst, uint32_t size)
+{
+    uint32_t pos = 0;
+    uint32_t range = 0xffffffff;
+    uint32_t code = 0;
+    uint32_t i;
+
+    /* The first byte is always zero. */
+    for (i = 0; i < 5; i++)
+        code = (code << 8) | (pos < src_size ? src[pos++] : 0xff);
+
+    rc_parser_t parser;
+    rc_parser_init(&parser);
+    rc_model_init(model);
+
+    for (i = 0; i < size; i++) {
+        uint16_t *probs = model->probs[rc_context(&parser)];
+        uint32_t m = 1;
+        while (m < 0x100) {
+            uint16_t *prob = &probs[m];
+            uint32_t bound = (range >> RC_PROB_BITS) * *prob;
+            if (code < bound) {
+                range = bound;
+                *prob += ((1 << RC_PROB_BITS) - *prob) >> RC_MOVE_BITS;
+                m = m << 1;
+            } else {
+                code -= bound;
+                range -= bound;
+                *prob -= *prob >> RC_MOVE_BITS;
+                m = (m << 1) | 1;
+            }
+            if (range < RC_TOP) {
+                range <<= 8;
+                code = (code << 8) | (pos < src_size ? src[pos++] : 0xff);
+            }
+        }
+        dst[i] = m;
+        rc_parse(&parser, m);
+    }
+
+    return parser.state == RC_STATE_HEADER;
+}
+
+/*
+ * Unpack a packed flash sector of 4096 bytes, decompressing each of its
+ * buffers into buf, also of 4096 bytes, and passing it to the function.
+ * Returns the number of buffers unpacked, stopping at the first chunk that
+ * does not decode, or -1 if the sector is not packed.
+ */
+int32_t rc_unpack_sector(rc_model_t *model, const uint8_t *sector, uint8_t *buf,
+                         rc_buffer_fn fn, void *arg)
+{
+    uint32_t index = sector[0] | sector[1] << 8 | sector[2] << 16 | (uint32_t)sector[3] << 24;
+    uint32_t inverse = sector[4] | sector[5] << 8 | sector[6] << 16 | (uint32_t)sector[7] << 24;
+
+    /* The event header is a single leb128 byte holding the code and the
+     * format, then the zero size and time. */
+    if (index != (inverse ^ 0xffffffff) ||
+        sector[8] != (DBUF_EVENT_RC_SECTOR << 2 | 1) ||
+        sector[9] != 0 || sector[10] != 0) {
+        return -1;
+    }
+
+    uint32_t offset = RC_SECTOR_HEADER_SIZE;
+    int32_t count = 0;
+    while (offset + RC_CHUNK_HEADER_SIZE <= RC_SECTOR_FOOTER_OFFSET) {
+        const uint8_t *chunk = sector + offset;
+        uint32_t coded = chunk[0] | chunk[1] << 8;
+        uint32_t size = chunk[2] | chunk[3] << 8;
+        if (coded == 0xffff)
+            break;
+        offset += RC_CHUNK_HEADER_SIZE;
+        if (coded > RC_SECTOR_FOOTER_OFFSET - offset || size > 4096 ||
+            !rc_decompress(model, sector + offset, coded, buf, size)) {
+            break;
+        }
+        fn(arg, buf, size);
+        count++;
+        offset += coded;
+    }
+
+    return count;
+}
@@ -0,0 +1,52 @@
+/*
+ * Adaptive binary range coder for the buffer event streams.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * This has no dependencies on the SDK so the same code can decode the streams
+ * on a host.
+ */
+
+/*
+ * The byte contexts: the buffer index header, the first byte of an event
+ * header, the other event header bytes, and the event data bytes with one
+ * context per event code modulo RC_CODE_CONTEXTS. The model is allocated
+ * while enabled, and is kept small at 3.5KB.
+ */
+#define RC_CODE_CONTEXTS 4
+#define RC_NUM_CONTEXTS (3 + RC_CODE_CONTEXTS)
+
+typedef struct {
+    uint16_t probs[RC_NUM_CONTEXTS][256];
+} rc_model_t;
+
+/*
+ * The packed flash sectors, see flash.c. The sector header is the index, its
+ * inverse, and a DBUF_EVENT_RC_SECTOR event with no data.
+ */
+#define RC_SECTOR_HEADER_SIZE 11
+#define RC_CHUNK_HEADER_SIZE 4
+#define RC_SECTOR_FOOTER_OFFSET (4096 - 4)
+
+typedef void (*rc_buffer_fn)(void *arg, const uint8_t *buf, uint32_t size);
+
+uint32_t rc_compress(rc_model_t *model, const uint8_t *src, uint32_t size,
+                     uint8_t *dst, uint32_t dst_size);
+bool rc_decompress(rc_model_t *model, const uint8_t *src, uint32_t src_size,
+                   uint8_t *dst, uint32_t size);
+int32_t rc_unpack_sector(rc_model_t *model, const uint8_t *sector, uint8_t *buf,
+                         rc_buffer_fn fn, void *arg);
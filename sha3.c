@@ -272,6 +272,126 @@ void KeccakF1600_StatePermute(void *state)
     }
 }
 
+/*
+================================================================
+An unrolled implementation of the Keccak-f[1600] permutation, for
+performance on 32-bit cores. The round constants and rotation offsets
+are precomputed, the lane indexes are constants, and the state is held
+in local lanes for all the rounds. It is bit-exact with the readable
+implementation above, which can be selected instead by building with
+KECCAK_UNROLLED defined to 0.
+================================================================
+*/
+
+#ifndef KECCAK_UNROLLED
+#define KECCAK_UNROLLED 1
+#endif
+
+#if KECCAK_UNROLLED
+
+static const tKeccakLane KeccakF1600_RoundConstants[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL,
+    0x800000000000808aULL, 0x8000000080008000ULL,
+    0x000000000000808bULL, 0x0000000080000001ULL,
+    0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008aULL, 0x0000000000000088ULL,
+    0x0000000080008009ULL, 0x000000008000000aULL,
+    0x000000008000808bULL, 0x800000000000008bULL,
+    0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL,
+    0x000000000000800aULL, 0x800000008000000aULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL,
+    0x0000000080000001ULL, 0x8000000080008008ULL,
+};
+
+static void KeccakF1600_StatePermuteUnrolled(void *state)
+{
+    tKeccakLane A[25], B[25], C[5], D[5];
+    unsigned int round, i;
+
+    for(i=0; i<25; i++)
+        A[i] = readLane(i, 0);
+
+    for(round=0; round<24; round++) {
+        /* θ step */
+        C[0] = A[0] ^ A[5] ^ A[10] ^ A[15] ^ A[20];
+        C[1] = A[1] ^ A[6] ^ A[11] ^ A[16] ^ A[21];
+        C[2] = A[2] ^ A[7] ^ A[12] ^ A[17] ^ A[22];
+        C[3] = A[3] ^ A[8] ^ A[13] ^ A[18] ^ A[23];
+        C[4] = A[4] ^ A[9] ^ A[14] ^ A[19] ^ A[24];
+        D[0] = C[4] ^ ROL64(C[1], 1);
+        D[1] = C[0] ^ ROL64(C[2], 1);
+        D[2] = C[1] ^ ROL64(C[3], 1);
+        D[3] = C[2] ^ ROL64(C[4], 1);
+        D[4] = C[3] ^ ROL64(C[0], 1);
+
+        /* ρ and π steps, with the θ effect added */
+        B[0] = A[0] ^ D[0];
+        B[10] = ROL64(A[1] ^ D[1], 1);
+        B[20] = ROL64(A[2] ^ D[2], 62);
+        B[5] = ROL64(A[3] ^ D[3], 28);
+        B[15] = ROL64(A[4] ^ D[4], 27);
+        B[16] = ROL64(A[5] ^ D[0], 36);
+        B[1] = ROL64(A[6] ^ D[1], 44);
+        B[11] = ROL64(A[7] ^ D[2], 6);
+        B[21] = ROL64(A[8] ^ D[3], 55);
+        B[6] = ROL64(A[9] ^ D[4], 20);
+        B[7] = ROL64(A[10] ^ D[0], 3);
+        B[17] = ROL64(A[11] ^ D[1], 10);
+        B[2] = ROL64(A[12] ^ D[2], 43);
+        B[12] = ROL64(A[13] ^ D[3], 25);
+        B[22] = ROL64(A[14] ^ D[4], 39);
+        B[23] = ROL64(A[15] ^ D[0], 41);
+        B[8] = ROL64(A[16] ^ D[1], 45);
+        B[18] = ROL64(A[17] ^ D[2], 15);
+        B[3] = ROL64(A[18] ^ D[3], 21);
+        B[13] = ROL64(A[19] ^ D[4], 8);
+        B[14] = ROL64(A[20] ^ D[0], 18);
+        B[24] = ROL64(A[21] ^ D[1], 2);
+        B[9] = ROL64(A[22] ^ D[2], 61);
+        B[19] = ROL64(A[23] ^ D[3], 56);
+        B[4] = ROL64(A[24] ^ D[4], 14);
+
+        /* χ step */
+        A[0] = B[0] ^ ((~B[1]) & B[2]);
+        A[1] = B[1] ^ ((~B[2]) & B[3]);
+        A[2] = B[2] ^ ((~B[3]) & B[4]);
+        A[3] = B[3] ^ ((~B[4]) & B[0]);
+        A[4] = B[4] ^ ((~B[0]) & B[1]);
+        A[5] = B[5] ^ ((~B[6]) & B[7]);
+        A[6] = B[6] ^ ((~B[7]) & B[8]);
+        A[7] = B[7] ^ ((~B[8]) & B[9]);
+        A[8] = B[8] ^ ((~B[9]) & B[5]);
+        A[9] = B[9] ^ ((~B[5]) & B[6]);
+        A[10] = B[10] ^ ((~B[11]) & B[12]);
+        A[11] = B[11] ^ ((~B[12]) & B[13]);
+        A[12] = B[12] ^ ((~B[13]) & B[14]);
+        A[13] = B[13] ^ ((~B[14]) & B[10]);
+        A[14] = B[14] ^ ((~B[10]) & B[11]);
+        A[15] = B[15] ^ ((~B[16]) & B[17]);
+        A[16] = B[16] ^ ((~B[17]) & B[18]);
+        A[17] = B[17] ^ ((~B[18]) & B[19]);
+        A[18] = B[18] ^ ((~B[19]) & B[15]);
+        A[19] = B[19] ^ ((~B[15]) & B[16]);
+        A[20] = B[20] ^ ((~B[21]) & B[22]);
+        A[21] = B[21] ^ ((~B[22]) & B[23]);
+        A[22] = B[22] ^ ((~B[23]) & B[24]);
+        A[23] = B[23] ^ ((~B[24]) & B[20]);
+        A[24] = B[24] ^ ((~B[20]) & B[21]);
+
+        /* ι step */
+        A[0] ^= KeccakF1600_RoundConstants[round];
+    }
+
+    for(i=0; i<25; i++)
+        writeLane(i, 0, A[i]);
+}
+
+#define KeccakF1600_Permute KeccakF1600_StatePermuteUnrolled
+#else
+#define KeccakF1600_Permute KeccakF1600_StatePermute
+#endif
+
 /*
 ================================================================
 A readable and compact implementation of the Keccak sponge functions
@@ -280,6 +400,7 @@ that use the Keccak-f[1600] permutation.
 */
 
 #include <string.h>
+#include "sha3.h"
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 void Keccak(unsigned int rate, unsigned int capacity, const unsigned char *input, unsigned long long int inputByteLen, unsigned char delimitedSuffix, unsigned char *output, unsigned long long int outputByteLen)
@@ -304,7 +425,7 @@ void Keccak(unsigned int rate, unsigned int capacity, const unsigned char *input
         inputByteLen -= blockSize;
 
         if (blockSize == rateInBytes) {
-            KeccakF1600_StatePermute(state);
+            KeccakF1600_Permute(state);
             blockSize = 0;
         }
     }
@@ -314,11 +435,11 @@ void Keccak(unsigned int rate, unsigned int capacity, const unsigned char *input
     state[blockSize] ^= delimitedSuffix;
     /* If the first bit of padding is at position rate-1, we need a whole new block for the second bit of padding */
     if (((delimitedSuffix & 0x80) != 0) && (blockSize == (rateInBytes-1)))
-        KeccakF1600_StatePermute(state);
+        KeccakF1600_Permute(state);
     /* Add the second bit of padding */
     state[rateInBytes-1] ^= 0x80;
     /* Switch to the squeezing phase */
-    KeccakF1600_StatePermute(state);
+    KeccakF1600_Permute(state);
 
     /* === Squeeze out all the output blocks === */
     while(outputByteLen > 0) {
@@ -328,6 +449,93 @@ void Keccak(unsigned int rate, unsigned int capacity, const unsigned char *input
         outputByteLen -= blockSize;
 
         if (outputByteLen > 0)
-            KeccakF1600_StatePermute(state);
+            KeccakF1600_Permute(state);
     }
 }
+
+/*
+================================================================
+A streaming interface to the Keccak sponge functions. The message may be
+absorbed in pieces, and the sponge state may be cloned after absorbing a
+common prefix, such as a MAC key, with each clone then used to complete a
+different message.
+================================================================
+*/
+
+/**
+  * Initialize the sponge, returning zero on success or one if the rate and
+  * capacity are not valid for Keccak-f[1600].
+  */
+int Keccak_SpongeInitialize(Keccak_SpongeInstance *instance, unsigned int rate, unsigned int capacity)
+{
+    if (((rate + capacity) != 1600) || ((rate % 8) != 0))
+        return 1;
+
+    memset(instance->state, 0, sizeof(instance->state));
+    instance->rateInBytes = rate/8;
+    instance->byteIOIndex = 0;
+    return 0;
+}
+
+void Keccak_SpongeAbsorb(Keccak_SpongeInstance *instance, const unsigned char *input, unsigned int inputByteLen)
+{
+    unsigned int blockSize;
+    unsigned int i;
+
+    while(inputByteLen > 0) {
+        blockSize = MIN(inputByteLen, instance->rateInBytes - instance->byteIOIndex);
+        for(i=0; i<blockSize; i++)
+            instance->state[instance->byteIOIndex + i] ^= input[i];
+        input += blockSize;
+        inputByteLen -= blockSize;
+        instance->byteIOIndex += blockSize;
+
+        if (instance->byteIOIndex == instance->rateInBytes) {
+            KeccakF1600_Permute(instance->state);
+            instance->byteIOIndex = 0;
+        }
+    }
+}
+
+void Keccak_SpongeClone(Keccak_SpongeInstance *instance, const Keccak_SpongeInstance *source)
+{
+    memcpy(instance, source, sizeof(Keccak_SpongeInstance));
+}
+
+void Keccak_SpongeSqueeze(Keccak_SpongeInstance *instance, unsigned char delimitedSuffix, unsigned char *output, unsigned int outputByteLen)
+{
+    unsigned int rateInBytes = instance->rateInBytes;
+    unsigned int blockSize = instance->byteIOIndex;
+    UINT8 *state = instance->state;
+
+    /* === Do the padding and switch to the squeezing phase === */
+    state[blockSize] ^= delimitedSuffix;
+    if (((delimitedSuffix & 0x80) != 0) && (blockSize == (rateInBytes-1)))
+        KeccakF1600_Permute(state);
+    state[rateInBytes-1] ^= 0x80;
+    KeccakF1600_Permute(state);
+
+    /* === Squeeze out all the output blocks === */
+    while(outputByteLen > 0) {
+        blockSize = MIN(outputByteLen, rateInBytes);
+        memcpy(output, state, blockSize);
+        output += blockSize;
+        outputByteLen -= blockSize;
+
+        if (outputByteLen > 0)
+            KeccakF1600_Permute(state);
+    }
+}
+
+/**
+  *  Functions to compute SHA3-224 on a message absorbed in pieces.
+  */
+void FIPS202_SHA3_224_Initialize(Keccak_SpongeInstance *instance)
+{
+    Keccak_SpongeInitialize(instance, 1152, 448);
+}
+
+void FIPS202_SHA3_224_Final(Keccak_SpongeInstance *instance, unsigned char *output)
+{
+    Keccak_SpongeSqueeze(instance, 0x06, output, 28);
+}
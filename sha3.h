@@ -1 +1,19 @@
 extern void FIPS202_SHA3_224(const unsigned char *input, unsigned int inputByteLen, unsigned char *output);
+
+/*
+ * Streaming sponge state. The state may be cloned after absorbing a common
+ * prefix, such as a MAC key, to avoid absorbing it again for each message.
+ */
+typedef struct {
+    unsigned char state[200];
+    unsigned int rateInBytes;
+    unsigned int byteIOIndex;
+} Keccak_SpongeInstance;
+
+int Keccak_SpongeInitialize(Keccak_SpongeInstance *instance, unsigned int rate, unsigned int capacity);
+void Keccak_SpongeAbsorb(Keccak_SpongeInstance *instance, const unsigned char *input, unsigned int inputByteLen);
+void Keccak_SpongeClone(Keccak_SpongeInstance *instance, const Keccak_SpongeInstance *source);
+void Keccak_SpongeSqueeze(Keccak_SpongeInstance *instance, unsigned char delimitedSuffix, unsigned char *output, unsigned int outputByteLen);
+
+void FIPS202_SHA3_224_Initialize(Keccak_SpongeInstance *instance);
+void FIPS202_SHA3_224_Final(Keccak_SpongeInstance *instance, unsigned char *output);
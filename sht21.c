@@ -36,6 +36,9 @@
 #include "buffer.h"
 #include "i2c.h"
 #include "leds.h"
+#include "config.h"
+#include "aggregate.h"
+#include "delta.h"
 
 
 
@@ -73,6 +76,30 @@ typedef enum
 } sht2x_addr;
 
 
+/*
+ * The resolutions, indexed by the 'sht2x_resolution' parameter, with their
+ * maximum conversion times in msec.
+ */
+static const struct {
+    uint8_t user_reg;
+    uint8_t t_conversion_ms;
+    uint8_t rh_conversion_ms;
+} sht2x_resolutions[] = {
+    {SHT2x_RES_12_14BIT, 85, 29},
+    {SHT2x_RES_8_12BIT, 22, 4},
+    {SHT2x_RES_10_13BIT, 43, 9},
+    {SHT2x_RES_11_11BIT, 11, 15}
+};
+
+#define SHT2X_NUM_RESOLUTIONS (sizeof(sht2x_resolutions) / sizeof(sht2x_resolutions[0]))
+
+/* The interval and limit for polling after the conversion time. */
+#define SHT2X_POLL_MS 10
+#define SHT2X_MAX_POLLS 20
+
+#define SHT2X_TICKS(ms) (((ms) + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS)
+
+
 static bool sht2x_check_crc(uint8_t data[], uint8_t num_bytes, uint8_t checksum)
 {
     uint8_t crc = 0;
@@ -130,8 +157,8 @@ static bool sht2x_soft_reset()
 
     bool result = i2c_write(I2C_BUS, I2C_ADR_W) && i2c_write(I2C_BUS, SOFT_RESET);
     i2c_stop(I2C_BUS);
-    /* Wait until sensor restarted. */
-    sdk_os_delay_us(15000);
+    /* Wait until sensor restarted, yielding. */
+    vTaskDelay(SHT2X_TICKS(15));
 
     return result;
 }
@@ -191,38 +218,41 @@ static bool sht2x_get_serial_number(uint8_t *serial_number)
 }
 
 /*
- * Measure the temperature if temp_rh is 0 and the relative humidity
- * if temp_rh is 1. Return 0 on success and 1 if there is an error.
+ * Trigger a measurement of the temperature if temp_rh is 0 and of the relative
+ * humidity if temp_rh is 1, in the no-hold mode. The bus is released while the
+ * sensor converts.
  */
-static uint8_t sht2x_measure_poll(int temp_rh, uint8_t data[], uint8_t *crc)
+static bool sht2x_trigger(int temp_rh)
 {
     i2c_start(I2C_BUS);
-    if (!i2c_write(I2C_BUS, I2C_ADR_W) ||
-        !i2c_write(I2C_BUS, temp_rh ? TRIG_RH_MEASUREMENT_POLL : TRIG_T_MEASUREMENT_POLL)) {
+    bool result = i2c_write(I2C_BUS, I2C_ADR_W) &&
+        i2c_write(I2C_BUS, temp_rh ? TRIG_RH_MEASUREMENT_POLL : TRIG_T_MEASUREMENT_POLL);
+    i2c_stop(I2C_BUS);
+    return result;
+}
+
+/*
+ * Try reading a triggered measurement. The sensor does not acknowledge the read
+ * until the conversion is complete. Return 1 on success, 0 if not ready, and -1
+ * if there is an error.
+ */
+static int sht2x_read_measurement(uint8_t data[], uint8_t *crc)
+{
+    i2c_start(I2C_BUS);
+    if (!i2c_write(I2C_BUS, I2C_ADR_R)) {
         i2c_stop(I2C_BUS);
-        return 1;
+        return 0;
     }
 
-    int i = 0;
-    int res;
-    do {
-        i2c_start(I2C_BUS);
-        sdk_os_delay_us(10000);
-        res = i2c_write(I2C_BUS, I2C_ADR_R);
-        if (i++ >= 20) {
-            i2c_stop(I2C_BUS);
-            return 1;
-        }
-    } while (res == 0);
-
     data[0] = i2c_read(I2C_BUS, 0);
     data[1] = i2c_read(I2C_BUS, 0);
     *crc = i2c_read(I2C_BUS, 1);
     i2c_stop(I2C_BUS);
-    return sht2x_check_crc(data, 2, *crc);
+    return sht2x_check_crc(data, 2, *crc) ? 1 : -1;
 }
 
-
+
+
 
 static bool sht2x_available = false;
 static uint32_t sht2x_counter = 0;
@@ -244,107 +274,144 @@ bool sht2x_temp_rh(uint32_t *counter, float *temp, float *rh)
     return true;
 }
 
-static void sht2x_read_task(void *pvParameters)
+static aggregate_channel_t sht2x_aggregate_channels[2];
+static aggregate_t sht2x_aggregate;
+
+static delta_channel_t sht2x_delta_channels[2];
+static delta_set_t sht2x_delta;
+
+/* The measurement state, the temperature then the relative humidity. */
+static int sht2x_phase;
+static int sht2x_polls;
+static uint8_t sht2x_data[4];
+static uint8_t sht2x_temp_crc;
+static uint8_t sht2x_rh_crc;
+
+/* The resolution set. */
+static uint8_t sht2x_resolution_set;
+
+static bool sht2x_set_resolution(uint8_t resolution)
 {
-    /* Delta encoding state. */
-    uint32_t last_segment = 0;
-    uint16_t last_temp = 0;
-    uint16_t last_rh = 0;
+    if (resolution >= SHT2X_NUM_RESOLUTIONS)
+        resolution = 0;
 
-    xSemaphoreTake(i2c_sem, portMAX_DELAY);
+    uint8_t user_reg;
+    if (!sht2x_read_user_register(&user_reg))
+        return false;
+
+    user_reg = (user_reg & ~SHT2x_RES_MASK) | sht2x_resolutions[resolution].user_reg;
+    if (!sht2x_write_user_register(user_reg))
+        return false;
 
+    sht2x_resolution_set = resolution;
+    return true;
+}
+
+static bool sht2x_init(void)
+{
     /*
      * Reset the sensor and try reading the serial number to try
      * detecting the sensor.
      */
     bool available = sht2x_soft_reset() &&
-        sht2x_get_serial_number(sht2x_serial_number);
+        sht2x_get_serial_number(sht2x_serial_number) &&
+        sht2x_set_resolution(param_sht2x_resolution);
 
-    /* Set resolution to 12 bit temperature and 14 bit relative humidity. */
-    uint8_t user_reg;
-    if (sht2x_read_user_register(&user_reg)) {
-        user_reg = (user_reg & ~SHT2x_RES_MASK) | SHT2x_RES_12_14BIT;
-        if (!sht2x_write_user_register(user_reg))
-            available = false;
-    } else {
-        available = false;
+    if (!available)
+        return false;
+
+    init_aggregate(&sht2x_aggregate, DBUF_EVENT_SHT2X_TEMP_HUM, 2,
+                   sht2x_aggregate_channels);
+    init_delta_set(&sht2x_delta, DBUF_EVENT_SHT2X_TEMP_HUM, 2,
+                   sht2x_delta_channels);
+    return true;
+}
+
+static int32_t sht2x_start(void)
+{
+    /* Apply a resolution change. */
+    if (param_sht2x_resolution != sht2x_resolution_set &&
+        !sht2x_set_resolution(param_sht2x_resolution)) {
+        return -1;
     }
 
-    xSemaphoreGive(i2c_sem);
+    sht2x_phase = 0;
+    sht2x_polls = 0;
+    if (!sht2x_trigger(0))
+        return -1;
+    return SHT2X_TICKS(sht2x_resolutions[sht2x_resolution_set].t_conversion_ms);
+}
 
-    if (!available)
-        vTaskDelete(NULL);
+static int32_t sht2x_poll(void)
+{
+    int res;
+    if (sht2x_phase == 0) {
+        res = sht2x_read_measurement(sht2x_data, &sht2x_temp_crc);
+    } else {
+        res = sht2x_read_measurement(&sht2x_data[2], &sht2x_rh_crc);
+    }
 
-    for (;;) {
-        vTaskDelay(10000 / portTICK_PERIOD_MS);
+    if (res < 0)
+        return -1;
 
-        xSemaphoreTake(i2c_sem, portMAX_DELAY);
+    if (res == 0) {
+        /* Still converting. */
+        if (++sht2x_polls > SHT2X_MAX_POLLS)
+            return -1;
+        return SHT2X_TICKS(SHT2X_POLL_MS);
+    }
 
-        uint8_t data[4];
-        uint8_t temp_crc;
-        if (!sht2x_measure_poll(0, data, &temp_crc)) {
-            xSemaphoreGive(i2c_sem);
-            blink_red();
-            continue;
-        }
+    if (sht2x_phase == 0) {
+        sht2x_phase = 1;
+        sht2x_polls = 0;
+        if (!sht2x_trigger(1))
+            return -1;
+        return SHT2X_TICKS(sht2x_resolutions[sht2x_resolution_set].rh_conversion_ms);
+    }
 
-        uint16_t temp = ((uint16_t) data[0]) << 8 | data[1];
-        temp >>= 2; /* Strip the two low status bits */
+    uint16_t temp = ((uint16_t) sht2x_data[0]) << 8 | sht2x_data[1];
+    temp >>= 2; /* Strip the two low status bits */
 
-        uint8_t rh_crc;
-        if (!sht2x_measure_poll(1, &data[2], &rh_crc)) {
-            xSemaphoreGive(i2c_sem);
-            blink_red();
-            continue;
-        }
+    uint16_t rh = ((uint16_t) sht2x_data[2]) << 8 | sht2x_data[3];
+    rh >>= 2; /* Strip the two low status bits */
 
-        uint16_t rh = ((uint16_t) data[2]) << 8 | data[3];
-        rh >>= 2; /* Strip the two low status bits */
-
-        sht2x_available = true;
-        sht2x_counter = RTC.COUNTER;
-        sht2x_temperature = temp;
-        sht2x_rh = rh;
-
-        xSemaphoreGive(i2c_sem);
-
-        while (1) {
-            uint8_t outbuf[8];
-            /* Delta encoding */
-            int32_t temp_delta = (int32_t)temp - (int32_t)last_temp;
-            uint32_t len = emit_leb128_signed(outbuf, 0, temp_delta);
-            int32_t rh_delta = (int32_t)rh - (int32_t)last_rh;
-            len = emit_leb128_signed(outbuf, len, rh_delta);
-            /* Include the xor of both crcs */
-            outbuf[len++] = temp_crc ^ rh_crc;
-            int32_t code = DBUF_EVENT_SHT2X_TEMP_HUM;
-            uint32_t new_segment = dbuf_append(last_segment, code, outbuf, len, 1);
-            if (new_segment == last_segment) {
-                /*
-                 * Commit the values logged. Note this is the only task
-                 * accessing this state so these updates are synchronized with
-                 * the last event of this class append.
-                 */
-                last_temp = temp;
-                last_rh = rh;
-                break;
-            }
-
-            /* Moved on to a new buffer. Reset the delta encoding state and
-             * retry. */
-            last_segment = new_segment;
-            last_temp = 0;
-            last_rh = 0;
-        };
-
-        blink_green();
-    }
+    sht2x_available = true;
+    sht2x_counter = RTC.COUNTER;
+    sht2x_temperature = temp;
+    sht2x_rh = rh;
+
+    return 0;
 }
 
+/*
+ * Log the measurement. Note this task is the only writer of the measurement
+ * so it can be read without holding the i2c_sem.
+ */
+static void sht2x_log(void)
+{
+    uint16_t temp = sht2x_temperature;
+    uint16_t rh = sht2x_rh;
 
-
+    int32_t values[2] = {temp, rh};
+    aggregate_add(&sht2x_aggregate, values);
+
+    if (!aggregate_raw_sample(&sht2x_aggregate))
+        return;
+
+    /* Include the xor of both crcs */
+    uint8_t crc = sht2x_temp_crc ^ sht2x_rh_crc;
+    log_delta_set(&sht2x_delta, values, &crc, 1);
+}
+
+static i2c_sensor_t sht2x_sensor = {
+    .init = sht2x_init,
+    .start = sht2x_start,
+    .poll = sht2x_poll,
+    .log = sht2x_log,
+    .period = &param_sht2x_period,
+};
 
 void init_sht2x()
 {
-    xTaskCreate(&sht2x_read_task, "sht2x_read_task", 208, NULL, 11, NULL);
+    add_i2c_sensor(&sht2x_sensor);
 }
@@ -0,0 +1,162 @@
+/*
+ * Host benchmark of the PMS*003 event encoding, in counts per frame, for the
+ * byte at a time bit packing and variable length code used before, the same
+ * code on the bit writer, and the Rice code on the bit writer.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The samples are a random walk of PMS5003 values, see test/pmseval.c for the
+ * code sizes. The second case separates the cost of the bit packing from that
+ * of the code.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "test.h"
+#include "../pms.c"
+#include "pms_varint.h"
+
+#define BENCH_SAMPLES 4096
+
+static pms_sample_t samples[BENCH_SAMPLES];
+static uint8_t bench_buf[PMS_EVENT_MAX_SIZE + 8];
+
+/* Keeps the result live. */
+static volatile uint32_t bench_sink;
+
+static void init_samples(void)
+{
+    int32_t values[PMS_NUM_CHANNELS] = { 0 };
+    uint32_t i, j;
+    for (i = 0; i < BENCH_SAMPLES; i++) {
+        pms_sample_t *sample = &samples[i];
+        sample->length = 0x1c;
+        sample->checksum = test_random();
+        for (j = 0; j < PMS_NUM_CHANNELS; j++) {
+            /* Small steps, with an occasional large one. */
+            int32_t step = (int32_t)(test_random() % 9) - 4;
+            if (test_random() % 16 == 0)
+                step *= 64;
+            values[j] += step;
+            if (values[j] < 0)
+                values[j] = -values[j];
+            sample->values[j] = values[j];
+        }
+    }
+}
+
+/* The variable length code on the bit writer. */
+static void bitwriter_emit_var_int(bitwriter_t *writer, int32_t v)
+{
+    if (v == 0) {
+        bitwriter_emit(writer, 1, 1);
+        return;
+    }
+    uint32_t sign = v < 0;
+    if (sign)
+        v = -v;
+    if (v == 1) {
+        bitwriter_emit(writer, sign << 1 | 4, 3);
+        return;
+    }
+    if (v < 33) {
+        bitwriter_emit(writer, (v - 2) << 3 | sign << 1, 8);
+        return;
+    }
+    bitwriter_emit(writer, ((v - 33) & 0xffff) << 8 | 0x1f << 3 | sign << 1, 24);
+}
+
+static uint32_t encode_varint_bitwriter(const int32_t *last, const pms_sample_t *sample,
+                                        uint8_t *buf)
+{
+    bitwriter_t writer;
+    bitwriter_init(&writer, buf);
+    uint32_t i;
+    for (i = 0; i < PMS_NUM_CHANNELS; i++)
+        bitwriter_emit_var_int(&writer, sample->values[i] - last[i]);
+    bitwriter_emit(&writer, sample->checksum & 0x7fff, 15);
+    return bitwriter_flush(&writer);
+}
+
+#define BENCH_VARINT 0
+#define BENCH_VARINT_BITWRITER 1
+#define BENCH_RICE 2
+
+static uint32_t encode_sample(uint32_t code, pms_log_t *log, const pms_sample_t *sample)
+{
+    switch (code) {
+    case BENCH_VARINT:
+        return encode_varint_sample(log->last, sample->values, true, sample->checksum,
+                                    bench_buf);
+    case BENCH_VARINT_BITWRITER:
+        return encode_varint_bitwriter(log->last, sample, bench_buf);
+    default:
+        return encode_pms_sample(log, sample, bench_buf);
+    }
+}
+
+static double bench_encode(uint32_t code)
+{
+    uint64_t best = UINT64_MAX;
+    uint32_t run;
+    for (run = 0; run < BENCH_RUNS; run++) {
+        pms_log_t log;
+        init_pms_log(&log, 0);
+        uint32_t size = 0;
+        uint64_t start = bench_count();
+        uint32_t i;
+        for (i = 0; i < BENCH_SAMPLES; i++) {
+            size += encode_sample(code, &log, &samples[i]);
+            memcpy(log.last, samples[i].values, sizeof(log.last));
+        }
+        uint64_t count = bench_count() - start;
+        if (count < best)
+            best = count;
+        bench_sink = size;
+    }
+    return (double)best / BENCH_SAMPLES;
+}
+
+/* Check that the two var int versions emit the same bits. */
+static void check_varint(void)
+{
+    int32_t last[PMS_NUM_CHANNELS] = { 0 };
+    uint8_t buf[PMS_EVENT_MAX_SIZE + 8];
+    uint32_t i;
+    for (i = 0; i < BENCH_SAMPLES; i++) {
+        uint32_t size = encode_varint_bitwriter(last, &samples[i], buf);
+        uint32_t varint_size = encode_varint_sample(last, samples[i].values, true,
+                                                    samples[i].checksum, bench_buf);
+        CHECK(size == varint_size && memcmp(buf, bench_buf, size) == 0);
+        memcpy(last, samples[i].values, sizeof(last));
+    }
+}
+
+int main(void)
+{
+    init_samples();
+    check_varint();
+
+    double varint = bench_encode(BENCH_VARINT);
+    double varint_bitwriter = bench_encode(BENCH_VARINT_BITWRITER);
+    double rice = bench_encode(BENCH_RICE);
+    printf("bits: var int %.1f, var int on the bit writer %.1f, Rice %.1f %s/frame\n",
+           varint, varint_bitwriter, rice, BENCH_UNIT);
+    return test_report("bits");
+}
@@ -0,0 +1,130 @@
+/*
+ * Host benchmark of the event buffer appends, with several producers
+ * interleaved, and of the room left unused when a buffer is rolled over.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The host tests are single threaded, so the producers take turns, each with
+ * its own segment as the sensor tasks have. The events are appended with
+ * dbuf_append(), which reserves the exact size, or reserved with the worst
+ * case size of a PMS event and committed with a smaller size, as the PMS
+ * encoder does. The buffers are not written to flash, so the oldest is
+ * discarded at each roll over.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "test.h"
+#include "../buffer.c"
+#include "host/flash_emu.h"
+
+#define BENCH_BUFFER_FILE "bench_buffer.bin"
+#define BENCH_PRODUCERS 4
+#define BENCH_EVENTS 1000000
+/* The worst case PMS event, and the range of the sizes committed. */
+#define BENCH_MAX_SIZE 54
+#define BENCH_MIN_SIZE 20
+
+static uint32_t bench_rollovers;
+static uint32_t bench_unused;
+
+static uint32_t bench_size(void)
+{
+    return BENCH_MIN_SIZE + test_random() % (BENCH_MAX_SIZE - BENCH_MIN_SIZE + 1);
+}
+
+/* Note the room left in the head buffer if it was rolled over. */
+static void note_rollover(uint32_t head)
+{
+    if (dbufs_head != head) {
+        bench_rollovers++;
+        bench_unused += DBUF_DATA_SIZE - DBUF_FOOTER_SIZE - dbufs[head].size;
+    }
+}
+
+/* Run the producers in turn, returning the events logged per second. */
+static double bench_events(bool reserve)
+{
+    uint32_t segments[BENCH_PRODUCERS] = { 0 };
+    uint8_t data[BENCH_MAX_SIZE];
+    memset(data, 0x5a, sizeof(data));
+
+    flash_emu_erase_all();
+    user_init();
+    reset_dbuf();
+    bench_rollovers = 0;
+    bench_unused = 0;
+
+    double start = bench_seconds();
+    uint32_t n;
+    for (n = 0; n < BENCH_EVENTS; n++) {
+        uint32_t producer = n % BENCH_PRODUCERS;
+        uint16_t code = 40 + producer;
+        uint32_t size = bench_size();
+        RTC.COUNTER += 100000 / BENCH_PRODUCERS;
+        while (1) {
+            uint32_t head = dbufs_head;
+            uint32_t segment = segments[producer];
+            if (reserve) {
+                uint8_t *buf = dbuf_reserve(&segment, code, BENCH_MAX_SIZE, 1);
+                note_rollover(head);
+                if (buf) {
+                    memcpy(buf, data, size);
+                    dbuf_commit(size);
+                }
+            } else {
+                segment = dbuf_append(segment, code, data, size, 1);
+                note_rollover(head);
+            }
+            if (segment == segments[producer])
+                break;
+            segments[producer] = segment;
+        }
+    }
+    return BENCH_EVENTS / (bench_seconds() - start);
+}
+
+int main(void)
+{
+    if (!flash_emu_open(BENCH_BUFFER_FILE)) {
+        printf("Failed to open %s\n", BENCH_BUFFER_FILE);
+        return 1;
+    }
+
+    const char *names[2] = { "append", "reserve" };
+    uint32_t i;
+    for (i = 0; i < 2; i++) {
+        double best = 0;
+        uint32_t run;
+        for (run = 0; run < BENCH_RUNS; run++) {
+            test_random_state = 2463534242U;
+            double rate = bench_events(i == 1);
+            if (rate > best)
+                best = rate;
+        }
+        printf("buffer: %s %.2f M events/s, %u producers, %.1f bytes unused per buffer\n",
+               names[i], best * 1e-6, BENCH_PRODUCERS,
+               (double)bench_unused / bench_rollovers);
+    }
+
+    flash_emu_close();
+    unlink(BENCH_BUFFER_FILE);
+    return 0;
+}
@@ -0,0 +1,280 @@
+/*
+ * Host benchmark of the push task, posting the flash sectors to a stub server
+ * on the loopback interface, in sectors per second.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The push.c code is included, and the post_data() task loop is run until it
+ * has caught up and waits for a notification. The flash_data() task loop is
+ * run in the same way to write the buffers to flash. The stub server
+ * runs in a thread, and acknowledges each post as received. It can close the
+ * connection after each response, as a server not keeping the connections
+ * alive, or drop a kept alive connection without notice, as a server closing
+ * an idle connection. The latter checks that the push task retries without a
+ * hold off.
+ *
+ * The loopback round trip is much faster than that to a real server, so the
+ * results mainly show the cost of the connections.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "bench.h"
+#include "test.h"
+#include "../push.c"
+#include "host/flash_emu.h"
+
+void user_init(void);
+
+#define BENCH_PUSH_FILE "bench_push.bin"
+#define BENCH_SECTORS 64
+
+void ds3231_note_time(time_t time) {}
+
+/* The server behaviour. */
+#define SERVER_KEEP_ALIVE 0
+#define SERVER_CLOSE 1
+#define SERVER_DROP 2
+/* A kept alive connection is dropped after this number of posts. */
+#define SERVER_DROP_POSTS 16
+
+static int server_socket;
+static volatile uint32_t server_mode;
+static volatile uint32_t server_posts;
+static volatile uint32_t server_connections;
+
+/* Read exactly size bytes, returning false on an error or end of file. */
+static bool server_read(int s, uint8_t *buf, uint32_t size)
+{
+    while (size > 0) {
+        ssize_t r = read(s, buf, size);
+        if (r <= 0)
+            return false;
+        buf += r;
+        size -= r;
+    }
+    return true;
+}
+
+static uint32_t get_word(const uint8_t *buf)
+{
+    return buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+static void put_word(uint8_t *buf, uint32_t v)
+{
+    buf[0] = v;
+    buf[1] = v >> 8;
+    buf[2] = v >> 16;
+    buf[3] = v >> 24;
+}
+
+/* Serve the posts on a connection, returning when it is closed. */
+static void serve_connection(int s)
+{
+    uint32_t posts = 0;
+    while (1) {
+        /* The request headers, only the content length is used. */
+        char headers[512];
+        uint32_t len = 0;
+        while (len < 4 || memcmp(&headers[len - 4], "\r\n\r\n", 4)) {
+            if (len >= sizeof(headers) - 1 || !server_read(s, (uint8_t *)&headers[len], 1))
+                return;
+            len++;
+        }
+        headers[len] = 0;
+        char *length = strstr(headers, "Content-Length:");
+        if (!length)
+            return;
+        uint32_t content_length = strtoul(length + 15, NULL, 10);
+        uint8_t content[POST_BUFFER_SIZE];
+        if (content_length < 16 + SIGNATURE_SIZE || content_length > sizeof(content) ||
+            !server_read(s, content, content_length)) {
+            return;
+        }
+
+        /* Acknowledge the data up to the end of this post. */
+        uint32_t size = content_length - 16 - SIGNATURE_SIZE;
+        uint8_t response[128];
+        int header_size = snprintf((char *)response, sizeof(response) - 20,
+                                   "HTTP/1.1 200 OK\r\n"
+                                   "Content-Length: 20\r\n"
+                                   "%s\r\n", server_mode == SERVER_CLOSE ?
+                                   "Connection: close\r\n" : "");
+        uint8_t *body = &response[header_size];
+        put_word(&body[0], get_word(&content[0]) ^ get_word(&content[4]));
+        put_word(&body[4], 0);
+        put_word(&body[8], 0);
+        put_word(&body[12], get_word(&content[8]));
+        put_word(&body[16], get_word(&content[12]) + size);
+        if (write(s, response, header_size + 20) != header_size + 20)
+            return;
+        server_posts++;
+        posts++;
+
+        if (server_mode == SERVER_CLOSE ||
+            (server_mode == SERVER_DROP && posts >= SERVER_DROP_POSTS)) {
+            return;
+        }
+    }
+}
+
+static void *server_thread(void *arg)
+{
+    while (1) {
+        int s = accept(server_socket, NULL, NULL);
+        if (s < 0)
+            continue;
+        server_connections++;
+        serve_connection(s);
+        close(s);
+    }
+    return NULL;
+}
+
+static bool start_server(void)
+{
+    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0)
+        return false;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    if (bind(server_socket, (struct sockaddr *)&addr, addr_len) != 0 ||
+        listen(server_socket, 4) != 0 ||
+        getsockname(server_socket, (struct sockaddr *)&addr, &addr_len) != 0) {
+        return false;
+    }
+    snprintf(param_web_port, 7, "%u", ntohs(addr.sin_port));
+
+    pthread_t thread;
+    return pthread_create(&thread, NULL, server_thread, NULL) == 0;
+}
+
+static jmp_buf task_done;
+static uint32_t task_wakes;
+static uint32_t task_hold_offs;
+
+/* The task loops do their work after the first wait for a notification, and
+ * are left at the next. Other waits are hold offs. */
+static void task_wait(TickType_t ticks, bool wake)
+{
+    if (wake && task_wakes++ > 0)
+        longjmp(task_done, 1);
+    if (!wake && ticks > 0)
+        task_hold_offs++;
+    host_ticks += ticks;
+}
+
+static void run_task(void (*task)(void *))
+{
+    task_wakes = 0;
+    task_hold_offs = 0;
+    host_wait_hook = task_wait;
+    if (!setjmp(task_done))
+        task(NULL);
+    host_wait_hook = NULL;
+}
+
+/* Log text events for this number of sectors, or just one event, writing the
+ * buffers to flash as they fill, and then the head buffer. */
+static void log_sectors(uint32_t sectors)
+{
+    static uint32_t segment = 0;
+    uint32_t last = dbuf_head_index() + sectors;
+    do {
+        uint32_t head = dbuf_head_index();
+        uint8_t data[100];
+        uint32_t i;
+        for (i = 0; i < sizeof(data); i++)
+            data[i] = 'a' + test_random() % 4;
+        while (1) {
+            uint32_t new_segment = dbuf_append(segment, DBUF_EVENT_TEXT_MESSAGE,
+                                               data, sizeof(data), 1);
+            if (new_segment == segment)
+                break;
+            segment = new_segment;
+        }
+        RTC.COUNTER += 1000;
+        if (dbuf_head_index() != head)
+            run_task(flash_data);
+    } while (dbuf_head_index() < last);
+
+    RTC.COUNTER += 30000000;
+    run_task(flash_data);
+}
+
+static void bench_push(uint32_t mode, const char *name)
+{
+    server_mode = mode;
+    server_posts = 0;
+    server_connections = 0;
+    /* Another event, to flag that there is data to post. */
+    log_sectors(0);
+
+    double start = bench_seconds();
+    run_task(post_data);
+    double seconds = bench_seconds() - start;
+
+    printf("push: %s %.0f sectors/s, %u posts, %u connections, %u hold offs\n",
+           name, BENCH_SECTORS / seconds, server_posts, server_connections,
+           task_hold_offs);
+    CHECK(server_posts >= BENCH_SECTORS * 4096 / CHUNK_SIZE / 2);
+    if (mode == SERVER_DROP)
+        CHECK(task_hold_offs == 0);
+}
+
+int main(void)
+{
+    if (!flash_emu_open(BENCH_PUSH_FILE)) {
+        printf("Failed to open %s\n", BENCH_PUSH_FILE);
+        return 1;
+    }
+    flash_emu_erase_all();
+    user_init();
+    log_sectors(BENCH_SECTORS);
+
+    static uint8_t key[287];
+    param_web_server = "127.0.0.1";
+    param_web_path = "/";
+    param_sensor_id = 1;
+    param_key_size = sizeof(key);
+    param_sha3_key = key;
+    post_key_sponge = malloc(sizeof(Keccak_SpongeInstance));
+    FIPS202_SHA3_224_Initialize(post_key_sponge);
+    Keccak_SpongeAbsorb(post_key_sponge, param_sha3_key, param_key_size);
+
+    if (!start_server()) {
+        printf("Failed to start the server\n");
+        return 1;
+    }
+
+    bench_push(SERVER_CLOSE, "close");
+    bench_push(SERVER_KEEP_ALIVE, "keep-alive");
+    bench_push(SERVER_DROP, "dropped");
+
+    flash_emu_close();
+    unlink(BENCH_PUSH_FILE);
+    return test_report("push");
+}
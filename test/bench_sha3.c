@@ -0,0 +1,66 @@
+/*
+ * Host benchmark of the Keccak-f1600 permutations, comparing the unrolled
+ * permutation with the readable implementation, in cost per byte hashed.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The posts are signed with SHA3-224, with a rate of 144 bytes, so one
+ * permutation is run per 144 bytes posted. The lanes are single registers on a
+ * 64 bit host, so the gain on the 32 bit target is expected to be smaller.
+ */
+
+#include <string.h>
+
+#include "bench.h"
+#include "test.h"
+#include "../sha3.c"
+
+#define BENCH_RATE 144
+#define BENCH_PERMUTATIONS 20000
+
+/* Keeps the result live. */
+static volatile uint8_t bench_sink;
+
+static double bench_permutation(void (*permute)(void *))
+{
+    uint8_t state[200];
+    uint32_t i;
+    for (i = 0; i < sizeof(state); i++)
+        state[i] = test_random();
+
+    uint64_t best = UINT64_MAX;
+    uint32_t run;
+    for (run = 0; run < BENCH_RUNS; run++) {
+        uint64_t start = bench_count();
+        for (i = 0; i < BENCH_PERMUTATIONS; i++)
+            permute(state);
+        uint64_t count = bench_count() - start;
+        if (count < best)
+            best = count;
+    }
+    bench_sink = state[0];
+    return (double)best / BENCH_PERMUTATIONS / BENCH_RATE;
+}
+
+int main(void)
+{
+    double rolled = bench_permutation(KeccakF1600_StatePermute);
+    double unrolled = bench_permutation(KeccakF1600_StatePermuteUnrolled);
+    printf("sha3: rolled %.1f, unrolled %.1f %s/byte, %.2fx\n",
+           rolled, unrolled, BENCH_UNIT, rolled / unrolled);
+    return 0;
+}
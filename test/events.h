@@ -0,0 +1,201 @@
+/*
+ * A parser of the events in a data buffer, for the host tests. This follows
+ * the header formats of emit_event_header() in buffer.c, and the time
+ * prediction. The buffers are taken as the flash writer takes them.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "espressif/esp_common.h"
+#include "../buffer.h"
+
+#define TEST_PREDICT_CODES 64
+
+typedef struct {
+    uint16_t code;
+    uint32_t size;
+    uint32_t time;
+    const uint8_t *data;
+} test_event_t;
+
+typedef struct {
+    const uint8_t *buf;
+    uint32_t size;
+    uint32_t pos;
+    bool error;
+    bool time_predict;
+    uint16_t last_code;
+    uint32_t last_size;
+    uint32_t last_time;
+    uint64_t predict_valid;
+    uint32_t predict_time[TEST_PREDICT_CODES];
+    uint32_t predict_period[TEST_PREDICT_CODES];
+} test_events_t;
+
+static void test_events_reset(test_events_t *events)
+{
+    events->last_code = 0;
+    events->last_size = 0;
+    events->last_time = 0;
+    events->predict_valid = 0;
+}
+
+/* Start parsing a buffer of size bytes, which starts with its index. */
+static void test_events_init(test_events_t *events, const uint8_t *buf, uint32_t size)
+{
+    events->buf = buf;
+    events->size = size;
+    events->pos = 8;
+    events->error = false;
+    events->time_predict = false;
+    test_events_reset(events);
+}
+
+static uint64_t test_events_leb128(test_events_t *events)
+{
+    uint64_t v = 0;
+    uint32_t shift = 0;
+    while (1) {
+        if (events->pos >= events->size || shift > 63) {
+            events->error = true;
+            return 0;
+        }
+        uint8_t byte = events->buf[events->pos++];
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+        if ((byte & 0x80) == 0)
+            return v;
+    }
+}
+
+/* Parse the next event, returning false at the end of the events or on an
+ * error, which is flagged. */
+static bool test_events_next(test_events_t *events, test_event_t *event)
+{
+    if (events->error || events->pos >= events->size ||
+        events->buf[events->pos] == 0xff) {
+        return false;
+    }
+
+    uint64_t v = test_events_leb128(events);
+    uint32_t format = v & 2;
+    uint16_t code;
+    uint32_t size;
+    uint64_t t = 0;
+
+    if (v & 1) {
+        code = v >> 2;
+        if (code == DBUF_EVENT_SEGMENT_START)
+            test_events_reset(events);
+        size = test_events_leb128(events);
+        if (!events->time_predict || format == 0)
+            t = test_events_leb128(events);
+    } else {
+        code = events->last_code;
+        size = events->last_size;
+        t = v >> 2;
+    }
+
+    uint32_t time;
+    if (!events->time_predict) {
+        time = events->last_time + (format ? t << 13 : t);
+    } else {
+        uint32_t predicted = events->last_time;
+        if (code < TEST_PREDICT_CODES && (events->predict_valid & (1ULL << code)))
+            predicted = events->predict_time[code] + events->predict_period[code];
+        if (format) {
+            time = predicted;
+        } else {
+            int64_t e = t & 1 ? -(int64_t)((t + 1) >> 1) : (int64_t)(t >> 1);
+            int32_t error = e & 1 ? (int32_t)(e >> 1) * 0x2000 : (int32_t)(e >> 1);
+            time = predicted + error;
+        }
+    }
+
+    if (events->error || size > events->size - events->pos) {
+        events->error = true;
+        return false;
+    }
+
+    event->code = code;
+    event->size = size;
+    event->time = time;
+    event->data = events->buf + events->pos;
+    events->pos += size;
+
+    events->last_code = code;
+    events->last_size = size;
+    events->last_time = time;
+    if (code < TEST_PREDICT_CODES) {
+        uint64_t bit = 1ULL << code;
+        events->predict_period[code] = (events->predict_valid & bit) ?
+            time - events->predict_time[code] : 0;
+        events->predict_time[code] = time;
+        events->predict_valid |= bit;
+    }
+
+    /* The first event of a buffer may flag the time prediction. */
+    if (code == DBUF_EVENT_TIME_PREDICT && events->pos == 8 + 3)
+        events->time_predict = true;
+
+    return true;
+}
+
+/*
+ * Take the buffers ready to write, passing each buffer to the function once
+ * it is complete. The last buffer taken might be the head buffer, and only
+ * partly filled, so it is only passed on when the next buffer is taken or at
+ * the end.
+ */
+typedef void (*test_buffer_fn)(const uint8_t *buf, uint32_t size);
+
+static uint8_t test_last_buf[4096];
+static uint32_t test_last_size;
+static uint32_t test_last_index = 0xffffffff;
+
+static void test_take_buffers(test_buffer_fn fn)
+{
+    while (1) {
+        uint32_t size, start;
+        uint8_t *buf = get_buffer_to_write(&size, &start);
+        if (!buf)
+            return;
+        uint32_t index = buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+        if (index != test_last_index && test_last_index != 0xffffffff)
+            fn(test_last_buf, test_last_size);
+        memcpy(test_last_buf, buf, size);
+        test_last_size = size;
+        test_last_index = index;
+        note_buffer_written(index, size);
+    }
+}
+
+/* Take all the buffers, including the head buffer which is written after a
+ * delay. */
+static void test_take_all_buffers(test_buffer_fn fn)
+{
+    RTC.COUNTER += 30000000;
+    test_take_buffers(fn);
+    if (test_last_index != 0xffffffff)
+        fn(test_last_buf, test_last_size);
+    test_last_index = 0xffffffff;
+}
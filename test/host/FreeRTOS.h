@@ -0,0 +1,40 @@
+/*
+ * Host build shims for the FreeRTOS definitions used by the code under test.
+ * The tasks are not run, the semaphores are always available, and the tick
+ * count is advanced by the tests, see host.c.
+ */
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define portMAX_DELAY 0xffffffff
+#define portTICK_PERIOD_MS 10
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdMS_TO_TICKS(ms) ((ms) / portTICK_PERIOD_MS)
+#define portYIELD_FROM_ISR() do {} while (0)
+#define portEND_SWITCHING_ISR(x) do { (void)(x); } while (0)
+#define portENTER_CRITICAL() do {} while (0)
+#define portEXIT_CRITICAL() do {} while (0)
+
+/* The tick count, advanced by vTaskDelay() and the tests. */
+extern TickType_t host_ticks;
+
+/* If set, called when a task blocks for up to ticks, or portMAX_DELAY, to run
+ * the rest of the system in its place. The hook advances the tick count, and
+ * may return early after notifying the task if wake is set. A test running a
+ * task loop leaves it with longjmp() from the hook. */
+extern void (*host_wait_hook)(TickType_t ticks, bool wake);
+
+#endif
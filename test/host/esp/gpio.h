@@ -0,0 +1,26 @@
+/*
+ * Host build shims for the GPIO calls. The level read is set by the tests.
+ */
+#ifndef HOST_GPIO_H
+#define HOST_GPIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum { GPIO_INPUT, GPIO_OUTPUT } gpio_direction_t;
+typedef enum {
+    GPIO_INTTYPE_NONE,
+    GPIO_INTTYPE_EDGE_POS,
+    GPIO_INTTYPE_EDGE_NEG,
+    GPIO_INTTYPE_EDGE_ANY
+} gpio_inttype_t;
+
+extern bool host_gpio_level;
+
+void gpio_enable(uint8_t gpio, gpio_direction_t direction);
+void gpio_write(uint8_t gpio, bool set);
+bool gpio_read(uint8_t gpio);
+void gpio_set_pullup(uint8_t gpio, bool enabled, bool enabled_during_sleep);
+void gpio_set_interrupt(uint8_t gpio, gpio_inttype_t type, void (*handler)(uint8_t));
+
+#endif
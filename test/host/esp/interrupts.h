@@ -0,0 +1,16 @@
+/*
+ * Host build shims for the interrupt calls. The handlers are not attached,
+ * rather the tests call them.
+ */
+#ifndef HOST_INTERRUPTS_H
+#define HOST_INTERRUPTS_H
+
+#include <stdint.h>
+
+#define INUM_UART 5
+
+typedef void (*_xt_isr)(void *arg);
+void _xt_isr_attach(uint8_t i, _xt_isr func, void *arg);
+void _xt_isr_unmask(uint32_t unmask);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef HOST_UART_H
+#define HOST_UART_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void uart_set_baud(int uart, int baud);
+int uart_getc_nowait(int uart);
+void uart_putc(int uart, char c);
+void uart_flush_txfifo(int uart);
+
+/* If set, called with each byte sent, for the tests to model the device on
+ * the line. */
+extern void (*host_uart_putc_hook)(int uart, char c);
+
+/* The UART registers, which the tests can load with received bytes. */
+struct host_uart_regs {
+    volatile uint32_t FIFO, INT_RAW, INT_STATUS, INT_ENABLE, INT_CLEAR;
+    volatile uint32_t CLOCK_DIVIDER, AUTOBAUD, STATUS, CONF0, CONF1;
+};
+extern struct host_uart_regs host_uart_regs[2];
+#define UART(i) (host_uart_regs[i])
+
+#define UART_STATUS_RXFIFO_COUNT_M 0xff
+#define UART_STATUS_RXFIFO_COUNT_S 0
+#define UART_CONF1_RXFIFO_FULL_THRESHOLD_M 0x7f
+#define UART_CONF1_RXFIFO_FULL_THRESHOLD_S 0
+#define UART_CONF1_RX_TOUT_THRESHOLD_M 0x7f
+#define UART_CONF1_RX_TOUT_THRESHOLD_S 24
+#define UART_CONF1_RX_TOUT_ENABLE (1 << 31)
+#define UART_INT_ENABLE_RXFIFO_FULL (1 << 0)
+#define UART_INT_ENABLE_RXFIFO_TIMEOUT (1 << 8)
+#define UART_INT_CLEAR_RXFIFO_FULL (1 << 0)
+#define UART_INT_CLEAR_RXFIFO_TIMEOUT (1 << 8)
+
+#define FIELD2VAL(f, r) (((r) >> f##_S) & f##_M)
+#define VAL2FIELD(f, v) (((v) & f##_M) << f##_S)
+#define SET_FIELD(r, f, v) (((r) & ~(f##_M << f##_S)) | VAL2FIELD(f, v))
+
+#endif
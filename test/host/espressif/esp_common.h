@@ -0,0 +1,43 @@
+#ifndef HOST_ESP_COMMON_H
+#define HOST_ESP_COMMON_H
+
+/*
+ * Host build shims for the SDK definitions used by the code under test. The
+ * SPI flash is emulated, see flash_emu.c.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    SPI_FLASH_RESULT_OK,
+    SPI_FLASH_RESULT_ERR,
+    SPI_FLASH_RESULT_TIMEOUT
+} sdk_SpiFlashOpResult;
+
+sdk_SpiFlashOpResult sdk_spi_flash_read(uint32_t addr, uint32_t *buf, uint32_t size);
+sdk_SpiFlashOpResult sdk_spi_flash_write(uint32_t addr, uint32_t *buf, uint32_t size);
+sdk_SpiFlashOpResult sdk_spi_flash_erase_sector(uint16_t sector);
+
+struct host_rtc { volatile uint32_t COUNTER; };
+extern struct host_rtc RTC;
+
+struct sdk_rst_info {
+    uint32_t reason, exccause, epc1, epc2, epc3, excvaddr, depc, rtn_addr;
+};
+struct sdk_rst_info *sdk_system_get_rst_info(void);
+uint32_t sdk_system_rtc_clock_cali_proc(void);
+uint8_t sdk_wifi_get_opmode(void);
+uint8_t sdk_wifi_station_get_connect_status(void);
+void sdk_os_delay_us(uint32_t us);
+uint8_t sdk_system_get_cpu_freq(void);
+void sdk_system_uart_swap(void);
+
+#define STATION_MODE 1
+#define STATIONAP_MODE 3
+#define STATION_GOT_IP 5
+
+#define IRAM
+
+#endif
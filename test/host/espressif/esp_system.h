@@ -0,0 +1 @@
+#include "espressif/esp_common.h"
@@ -0,0 +1,210 @@
+/*
+ * File backed SPI flash emulator for the host builds.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The 4MiB flash is a memory mapped file, so its content persists across runs
+ * and can be inspected with the usual tools. The NOR flash semantics are
+ * enforced: the accesses must be word aligned, a write can only clear bits,
+ * and only a whole 4KiB sector can be erased, to ones.
+ *
+ * Faults can be injected: bad sectors on which the writes fail, leaving the
+ * content unchanged, although they can still be erased; failures of the next
+ * few writes; bit rot; and a power cut after a number of bytes are written,
+ * after which the operations fail until the power is restored, as if the
+ * device restarted.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "espressif/esp_common.h"
+#include "flash_emu.h"
+
+flash_emu_stats_t flash_emu_stats;
+
+static uint8_t *flash_emu;
+static int flash_emu_fd = -1;
+static uint8_t flash_emu_bad[FLASH_EMU_SECTORS];
+static uint32_t flash_emu_write_failures;
+static bool flash_emu_cut_pending;
+static uint32_t flash_emu_cut_bytes;
+static bool flash_emu_off;
+
+/*
+ * Open or create the flash file, which is created erased. Returns false on
+ * failure.
+ */
+bool flash_emu_open(const char *path)
+{
+    flash_emu_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (flash_emu_fd < 0)
+        return false;
+
+    off_t size = lseek(flash_emu_fd, 0, SEEK_END);
+    if (size != FLASH_EMU_SIZE && ftruncate(flash_emu_fd, FLASH_EMU_SIZE) != 0) {
+        close(flash_emu_fd);
+        return false;
+    }
+
+    flash_emu = mmap(NULL, FLASH_EMU_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     flash_emu_fd, 0);
+    if (flash_emu == MAP_FAILED) {
+        close(flash_emu_fd);
+        flash_emu = NULL;
+        return false;
+    }
+
+    if (size < FLASH_EMU_SIZE)
+        memset(flash_emu + size, 0xff, FLASH_EMU_SIZE - size);
+
+    memset(flash_emu_bad, 0, sizeof(flash_emu_bad));
+    memset(&flash_emu_stats, 0, sizeof(flash_emu_stats));
+    flash_emu_write_failures = 0;
+    flash_emu_cut_pending = false;
+    flash_emu_off = false;
+    return true;
+}
+
+void flash_emu_close(void)
+{
+    if (flash_emu) {
+        munmap(flash_emu, FLASH_EMU_SIZE);
+        flash_emu = NULL;
+    }
+    if (flash_emu_fd >= 0) {
+        close(flash_emu_fd);
+        flash_emu_fd = -1;
+    }
+}
+
+/* Direct access to the flash content, for checking and corrupting it. */
+uint8_t *flash_emu_data(void)
+{
+    return flash_emu;
+}
+
+void flash_emu_erase_all(void)
+{
+    memset(flash_emu, 0xff, FLASH_EMU_SIZE);
+}
+
+void flash_emu_set_bad_sector(uint16_t sector, bool bad)
+{
+    flash_emu_bad[sector] = bad;
+}
+
+/* Fail the next count writes, leaving the content unchanged. */
+void flash_emu_fail_next_writes(uint32_t count)
+{
+    flash_emu_write_failures = count;
+}
+
+void flash_emu_rot_bit(uint32_t addr, uint32_t bit)
+{
+    flash_emu[addr] ^= 1 << bit;
+}
+
+/* Cut the power after this number of bytes have been written. */
+void flash_emu_power_cut_after(uint32_t bytes)
+{
+    flash_emu_cut_pending = true;
+    flash_emu_cut_bytes = bytes;
+}
+
+bool flash_emu_powered_off(void)
+{
+    return flash_emu_off;
+}
+
+void flash_emu_power_on(void)
+{
+    flash_emu_cut_pending = false;
+    flash_emu_off = false;
+}
+
+static bool flash_emu_valid(uint32_t addr, uint32_t size)
+{
+    return flash_emu && !flash_emu_off && (addr & 3) == 0 && (size & 3) == 0 &&
+        addr <= FLASH_EMU_SIZE && size <= FLASH_EMU_SIZE - addr;
+}
+
+sdk_SpiFlashOpResult sdk_spi_flash_read(uint32_t addr, uint32_t *buf, uint32_t size)
+{
+    if (!flash_emu_valid(addr, size))
+        return SPI_FLASH_RESULT_ERR;
+
+    flash_emu_stats.reads++;
+    flash_emu_stats.read_bytes += size;
+    memcpy(buf, flash_emu + addr, size);
+    return SPI_FLASH_RESULT_OK;
+}
+
+sdk_SpiFlashOpResult sdk_spi_flash_write(uint32_t addr, uint32_t *buf, uint32_t size)
+{
+    if (!flash_emu_valid(addr, size))
+        return SPI_FLASH_RESULT_ERR;
+
+    flash_emu_stats.writes++;
+    flash_emu_stats.write_bytes += size;
+
+    if (flash_emu_write_failures) {
+        flash_emu_write_failures--;
+        return SPI_FLASH_RESULT_ERR;
+    }
+
+    const uint8_t *src = (const uint8_t *)buf;
+    uint32_t i;
+    for (i = 0; i < size; i++) {
+        uint32_t a = addr + i;
+        if (flash_emu_bad[a / 4096])
+            return SPI_FLASH_RESULT_ERR;
+        if (flash_emu_cut_pending && flash_emu_cut_bytes-- == 0) {
+            flash_emu_off = true;
+            return SPI_FLASH_RESULT_ERR;
+        }
+        /* NOR flash, a write can only clear bits. */
+        flash_emu[a] &= src[i];
+    }
+
+    return SPI_FLASH_RESULT_OK;
+}
+
+sdk_SpiFlashOpResult sdk_spi_flash_erase_sector(uint16_t sector)
+{
+    if (!flash_emu || flash_emu_off || sector >= FLASH_EMU_SECTORS)
+        return SPI_FLASH_RESULT_ERR;
+
+    flash_emu_stats.erases++;
+
+    if (flash_emu_cut_pending) {
+        /* Cut part way through the erase, leaving the sector corrupt. */
+        if (flash_emu_cut_bytes < 4096) {
+            memset(flash_emu + sector * 4096, 0xff, flash_emu_cut_bytes);
+            flash_emu_off = true;
+            return SPI_FLASH_RESULT_ERR;
+        }
+        flash_emu_cut_bytes -= 4096;
+    }
+
+    memset(flash_emu + sector * 4096, 0xff, 4096);
+    return SPI_FLASH_RESULT_OK;
+}
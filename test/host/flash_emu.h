@@ -0,0 +1,45 @@
+/*
+ * File backed SPI flash emulator for the host builds.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ */
+
+#define FLASH_EMU_SIZE (4 * 1024 * 1024)
+#define FLASH_EMU_SECTORS (FLASH_EMU_SIZE / 4096)
+
+typedef struct {
+    uint32_t reads;
+    uint32_t read_bytes;
+    uint32_t writes;
+    uint32_t write_bytes;
+    uint32_t erases;
+} flash_emu_stats_t;
+
+extern flash_emu_stats_t flash_emu_stats;
+
+bool flash_emu_open(const char *path);
+void flash_emu_close(void);
+uint8_t *flash_emu_data(void);
+void flash_emu_erase_all(void);
+
+void flash_emu_set_bad_sector(uint16_t sector, bool bad);
+void flash_emu_fail_next_writes(uint32_t count);
+void flash_emu_rot_bit(uint32_t addr, uint32_t bit);
+void flash_emu_power_cut_after(uint32_t bytes);
+bool flash_emu_powered_off(void);
+void flash_emu_power_on(void);
@@ -0,0 +1,243 @@
+/*
+ * Host build shims for the FreeRTOS and SDK functions used by the code under
+ * test.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The tests are single threaded, so the tasks are not run, the semaphores are
+ * always available, and the notifications are ignored. A test may run a task
+ * loop itself, with the waits passed to host_wait_hook.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "espressif/esp_common.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "sysparam.h"
+#include "esp/uart.h"
+#include "esp/gpio.h"
+#include "esp/interrupts.h"
+#include "xtensa_ops.h"
+#include "stdout_redirect.h"
+
+struct host_rtc RTC;
+TickType_t host_ticks;
+void (*host_wait_hook)(TickType_t ticks, bool wake);
+
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint16_t stack,
+                       void *param, UBaseType_t priority, TaskHandle_t *handle)
+{
+    if (handle)
+        *handle = NULL;
+    return pdPASS;
+}
+
+static void host_wait(TickType_t ticks, bool wake)
+{
+    if (host_wait_hook)
+        host_wait_hook(ticks, wake);
+    else if (ticks != portMAX_DELAY)
+        host_ticks += ticks;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    host_wait(ticks, false);
+}
+
+void vTaskDelayUntil(TickType_t *previous, TickType_t ticks)
+{
+    *previous += ticks;
+    if ((int32_t)(*previous - host_ticks) > 0)
+        host_wait(*previous - host_ticks, false);
+}
+
+void vTaskDelete(TaskHandle_t task) {}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value,
+                              eNotifyAction action, BaseType_t *woken)
+{
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    if (host_wait_hook)
+        host_wait_hook(ticks, true);
+    return 0;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_entry, uint32_t clear_exit,
+                           uint32_t *value, TickType_t ticks)
+{
+    if (host_wait_hook)
+        host_wait_hook(ticks, true);
+    return pdFALSE;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return host_ticks;
+}
+
+void taskYIELD(void) {}
+void taskENTER_CRITICAL(void) {}
+void taskEXIT_CRITICAL(void) {}
+
+static int host_sem;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return &host_sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return &host_sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+    return pdTRUE;
+}
+
+sysparam_status_t sysparam_get_int8(const char *key, int8_t *result)
+{
+    return SYSPARAM_NOTFOUND;
+}
+
+sysparam_status_t sysparam_get_int32(const char *key, int32_t *result)
+{
+    return SYSPARAM_NOTFOUND;
+}
+
+sysparam_status_t sysparam_get_string(const char *key, char **destptr)
+{
+    return SYSPARAM_NOTFOUND;
+}
+
+sysparam_status_t sysparam_get_data(const char *key, uint8_t **destptr,
+                                    uint32_t *actual_length, bool *is_binary)
+{
+    return SYSPARAM_NOTFOUND;
+}
+
+static struct sdk_rst_info host_rst_info;
+
+struct sdk_rst_info *sdk_system_get_rst_info(void)
+{
+    return &host_rst_info;
+}
+
+uint32_t sdk_system_rtc_clock_cali_proc(void)
+{
+    return 0x5000;
+}
+
+uint8_t sdk_wifi_get_opmode(void)
+{
+    return 0;
+}
+
+uint8_t sdk_wifi_station_get_connect_status(void)
+{
+    return STATION_GOT_IP;
+}
+
+void wificfg_got_sta_connect(void) {}
+
+void sdk_os_delay_us(uint32_t us) {}
+
+uint8_t sdk_system_get_cpu_freq(void)
+{
+    return 80;
+}
+
+void sdk_system_uart_swap(void) {}
+
+struct host_uart_regs host_uart_regs[2];
+uint32_t host_ccount;
+bool host_gpio_level = true;
+
+void uart_set_baud(int uart, int baud) {}
+void (*host_uart_putc_hook)(int uart, char c);
+
+void uart_putc(int uart, char c)
+{
+    if (host_uart_putc_hook)
+        host_uart_putc_hook(uart, c);
+}
+
+void uart_flush_txfifo(int uart) {}
+
+static ssize_t host_write_stdout(struct _reent *r, int fd, const void *ptr, size_t len)
+{
+    return write(fd, ptr, len);
+}
+
+static _WriteFunction *host_stdout_write = host_write_stdout;
+
+void set_write_stdout(_WriteFunction *f)
+{
+    host_stdout_write = f ? f : host_write_stdout;
+}
+
+_WriteFunction *get_write_stdout(void)
+{
+    return host_stdout_write;
+}
+
+void gpio_enable(uint8_t gpio, gpio_direction_t direction) {}
+void gpio_write(uint8_t gpio, bool set) {}
+
+bool gpio_read(uint8_t gpio)
+{
+    return host_gpio_level;
+}
+
+void gpio_set_pullup(uint8_t gpio, bool enabled, bool enabled_during_sleep) {}
+void gpio_set_interrupt(uint8_t gpio, gpio_inttype_t type, void (*handler)(uint8_t)) {}
+
+void _xt_isr_attach(uint8_t i, _xt_isr func, void *arg) {}
+void _xt_isr_unmask(uint32_t unmask) {}
@@ -0,0 +1,43 @@
+/*
+ * Host build shims for the initialization called from user_init(). The LEDs,
+ * sensors, and network are not used on the host, so these do nothing. They
+ * are weak, so that a test can link the module it checks in place of a shim.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ */
+
+#include "FreeRTOS.h"
+
+#define HOST_SHIM __attribute__((weak))
+
+HOST_SHIM void init_blink(void) {}
+HOST_SHIM void blink_red(void) {}
+HOST_SHIM void blink_green(void) {}
+HOST_SHIM void blink_blue(void) {}
+HOST_SHIM void blink_white(void) {}
+HOST_SHIM void init_i2c(void) {}
+HOST_SHIM void init_pms(void) {}
+HOST_SHIM void init_sht2x(void) {}
+HOST_SHIM void init_bmp180(void) {}
+HOST_SHIM void init_bme280(void) {}
+HOST_SHIM void init_ds3231(void) {}
+HOST_SHIM void init_i2c_sensors(void) {}
+HOST_SHIM void init_web(void) {}
+HOST_SHIM void init_post(void) {}
+HOST_SHIM TaskHandle_t post_data_task = NULL;
+HOST_SHIM void i2c_note_pms_frame(void) {}
@@ -0,0 +1,13 @@
+#ifndef HOST_I2C_H
+#define HOST_I2C_H
+
+/* Only the device type is needed for the headers included on the host. */
+
+#include <stdint.h>
+
+typedef struct {
+    uint8_t bus;
+    uint8_t addr;
+} i2c_dev_t;
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_LWIP_DNS_H
+#define HOST_LWIP_DNS_H
+
+/* Not used on the host. */
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_LWIP_ERR_H
+#define HOST_LWIP_ERR_H
+
+/* Not used on the host. */
+
+#endif
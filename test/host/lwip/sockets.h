@@ -0,0 +1,15 @@
+#ifndef HOST_LWIP_SOCKETS_H
+#define HOST_LWIP_SOCKETS_H
+
+/* The host sockets have the same API as the lwip sockets. The lwip ifreq
+ * only has the name, as used with SO_BINDTODEVICE. */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+struct ifreq { char ifr_name[16]; };
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_LWIP_SYS_H
+#define HOST_LWIP_SYS_H
+
+/* Not used on the host. */
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef HOST_STDOUT_REDIRECT_H
+#define HOST_STDOUT_REDIRECT_H
+
+#include <sys/types.h>
+
+struct _reent;
+
+typedef ssize_t _WriteFunction(struct _reent *r, int fd, const void *ptr, size_t len);
+
+/* The host stdout is not redirected, the function is only noted for the tests
+ * to call. */
+void set_write_stdout(_WriteFunction *f);
+_WriteFunction *get_write_stdout(void);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef HOST_SYSPARAM_H
+#define HOST_SYSPARAM_H
+
+/* The host build has no parameters stored, so the defaults are used. */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DEFAULT_SYSPARAM_SECTORS 4
+
+typedef enum { SYSPARAM_OK = 0, SYSPARAM_NOTFOUND = -1 } sysparam_status_t;
+
+sysparam_status_t sysparam_get_int8(const char *key, int8_t *result);
+sysparam_status_t sysparam_get_int32(const char *key, int32_t *result);
+sysparam_status_t sysparam_get_string(const char *key, char **destptr);
+/* The size_t of the target is the same type as uint32_t, as the callers
+ * assume, which is not so on a 64 bit host. */
+sysparam_status_t sysparam_get_data(const char *key, uint8_t **destptr,
+                                    uint32_t *actual_length, bool *is_binary);
+sysparam_status_t sysparam_set_int8(const char *key, int8_t value);
+sysparam_status_t sysparam_set_int32(const char *key, int32_t value);
+sysparam_status_t sysparam_set_string(const char *key, const char *value);
+sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value,
+                                    size_t value_len, bool binary);
+
+#endif
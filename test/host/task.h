@@ -0,0 +1,26 @@
+#ifndef HOST_TASK_H
+#define HOST_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef enum { eNoAction, eSetBits, eIncrement } eNotifyAction;
+
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint16_t stack,
+                       void *param, UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previous, TickType_t ticks);
+void vTaskDelete(TaskHandle_t task);
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value,
+                              eNotifyAction action, BaseType_t *woken);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+BaseType_t xTaskNotifyWait(uint32_t clear_entry, uint32_t clear_exit,
+                           uint32_t *value, TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+void taskYIELD(void);
+void taskENTER_CRITICAL(void);
+void taskEXIT_CRITICAL(void);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_WIFICFG_H
+#define HOST_WIFICFG_H
+
+void wificfg_got_sta_connect(void);
+
+#endif
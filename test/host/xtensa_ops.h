@@ -0,0 +1,14 @@
+/*
+ * Host build shims for the special register reads. The cycle count is set by
+ * the tests.
+ */
+#ifndef HOST_XTENSA_OPS_H
+#define HOST_XTENSA_OPS_H
+
+#include <stdint.h>
+
+extern uint32_t host_ccount;
+
+#define RSR(var, reg) do { (var) = host_##reg; } while (0)
+
+#endif
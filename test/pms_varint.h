@@ -0,0 +1,108 @@
+/*
+ * The PMS*003 event code used before the adaptive Rice code, for comparison
+ * with it on the host. The bit packing and the variable length code are as
+ * they were in pms.c.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ */
+
+static uint8_t *outbuf;
+static int noutbits;
+static uint32_t outbits;
+static int outlen;
+
+static void emitbits(uint32_t bits, uint8_t nbits)
+{
+    outbits |= bits << noutbits;
+    noutbits += nbits;
+    while (noutbits >= 8) {
+        outbuf[outlen++] = (unsigned char) (outbits & 0xFF);
+        outbits >>= 8;
+        noutbits -= 8;
+    }
+}
+
+static void init_outbuf(uint8_t *buf)
+{
+    outbuf = buf;
+    outlen = 0;
+    noutbits = 0;
+    outbits = 0;
+}
+
+static void emit_var_int(int32_t v)
+{
+    if (v == 0) {
+        /* 0 -> '1' */
+        emitbits(1, 1);
+        return;
+    }
+
+    emitbits(0, 1);
+
+    /* The sign bit. */
+    if (v < 0) {
+        emitbits(1, 1);
+        v = -v;
+    } else {
+        emitbits(0, 1);
+    }
+
+    if (v == 1) {
+        /* +1 -> '001'
+         * -1 -> '011'
+         */
+        emitbits(1, 1);
+        return;
+    }
+
+    emitbits(0, 1);
+
+    if (v < 33) {
+        /* +2 to +32 -> '000 xxxxx'
+         * -2 to -32 -> '010 xxxxx'
+         */
+        emitbits(v - 2, 5);
+        return;
+    }
+
+    emitbits(0x1f, 5);
+
+    /* 16 bit unsigned value:
+     *  +33 to 65568 : #x000 11111 xxxx xxxx xxxx xxxx
+     *  -33 to 65568 : #x010 11111 xxxx xxxx xxxx xxxx
+     */
+    v = v - 33;
+    emitbits(v & 0xffff, 16);
+}
+
+/* Encode the deltas of the values from the last values, in the channel order
+ * of the pms_sample_t, and the checksum, returning the size. */
+static uint32_t encode_varint_sample(const int32_t *last, const int32_t *values,
+                                     bool pms5003, uint16_t checksum, uint8_t *buf)
+{
+    init_outbuf(buf);
+    uint32_t i;
+    for (i = 0; i < 13; i++) {
+        if (!pms5003 && i >= 8 && i < 12)
+            continue;
+        emit_var_int(values[i] - last[i]);
+    }
+    emitbits(checksum & 0x7fff, 15);
+    return outlen;
+}
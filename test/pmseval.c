@@ -0,0 +1,305 @@
+/*
+ * Evaluate the PMS*003 event code on traces of the sensor frames, comparing
+ * the adaptive Rice code, with and without the cross-channel prediction, and
+ * the variable length code used before it, in bytes per sample and bits per
+ * sample value.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * Usage: pmseval [<trace> ...]
+ *
+ * A trace is the bytes received from a sensor, such as captured from its
+ * serial output at 9600 baud. The frames are found with the frame assembly of
+ * pms.c, and the samples are derived as in pms_handle_frame(). Repeated
+ * samples are not coded, as on the device. Without a trace, a synthetic trace
+ * is used, which is only a check that the tool runs and not representative of
+ * the sensor data.
+ *
+ * The sample event data is counted, not the event headers which are the same
+ * for each code. With the prediction the data of the weights event logged in
+ * each buffer is also counted, with the weights fit over the prior buffer.
+ * Each code is reset when its data would fill a buffer, as on the device.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "test.h"
+#include "../pms.c"
+#include "pms_varint.h"
+
+/* The room for the sample events in a buffer, less the footer and the
+ * segment start events, see buffer.c. */
+#define PMSEVAL_BUFFER_SIZE (4096 - 5 - 8)
+#define PMSEVAL_SYNTHETIC_SAMPLES 20000
+
+/* The state of each code. */
+typedef struct {
+    const char *name;
+    uint32_t bytes;
+    uint32_t buffer_bytes;
+    uint32_t buffers;
+    bool predict;
+    bool weights_logged;
+    int32_t last[PMS_NUM_CHANNELS];
+    pms_log_t log;
+} pmseval_code_t;
+
+#define PMSEVAL_VARINT 0
+#define PMSEVAL_RICE 1
+#define PMSEVAL_PREDICT 2
+#define PMSEVAL_NUM_CODES 3
+
+static pmseval_code_t codes[PMSEVAL_NUM_CODES];
+static uint32_t num_samples;
+static uint32_t num_values;
+static uint32_t num_repeats;
+static bool last_valid;
+static pms_sample_t last_sample;
+
+static void reset_codes(void)
+{
+    uint32_t i;
+    memset(codes, 0, sizeof(codes));
+    codes[PMSEVAL_VARINT].name = "var int";
+    codes[PMSEVAL_RICE].name = "Rice";
+    codes[PMSEVAL_PREDICT].name = "predict";
+    codes[PMSEVAL_PREDICT].predict = true;
+    for (i = 0; i < PMSEVAL_NUM_CODES; i++)
+        init_pms_log(&codes[i].log, 0);
+    num_samples = 0;
+    num_values = 0;
+    num_repeats = 0;
+    last_valid = false;
+}
+
+static void code_sample(pmseval_code_t *code, uint32_t i, const pms_sample_t *sample)
+{
+    uint8_t buf[PMS_EVENT_MAX_SIZE + 8];
+    uint32_t size;
+
+    if (code->buffer_bytes + PMS_EVENT_MAX_SIZE > PMSEVAL_BUFFER_SIZE) {
+        /* A new buffer, the deltas and the code state are reset. */
+        code->buffer_bytes = 0;
+        code->buffers++;
+        code->weights_logged = false;
+        memset(code->last, 0, sizeof(code->last));
+        reset_pms_log(&code->log);
+    }
+
+    if (code->predict && !code->weights_logged) {
+        uint32_t len = 0;
+        uint32_t j;
+        for (j = 0; j < PMS_NUM_CHANNELS; j++)
+            len = emit_leb128_signed(buf, len, code->log.weights[j]);
+        code->bytes += len;
+        code->buffer_bytes += len;
+        code->weights_logged = true;
+    }
+
+    if (i == PMSEVAL_VARINT) {
+        size = encode_varint_sample(code->last, sample->values, sample->length == 0x1c,
+                                    sample->checksum, buf);
+    } else {
+        memcpy(code->log.last, code->last, sizeof(code->last));
+        param_pms_predict = code->predict;
+        size = encode_pms_sample(&code->log, sample, buf);
+    }
+    memcpy(code->last, sample->values, sizeof(code->last));
+    code->bytes += size;
+    code->buffer_bytes += size;
+}
+
+/* The sample of a frame, as in pms_handle_frame(). */
+static void frame_sample(const uint8_t *frame, pms_sample_t *sample)
+{
+    uint16_t length = frame[2] << 8 | frame[3];
+    int32_t v[14];
+    uint32_t i;
+    for (i = 0; i < 14; i++)
+        v[i] = pms_word((uint8_t *)frame, i);
+
+    sample->length = length;
+    memset(sample->values, 0, sizeof(sample->values));
+    sample->values[0] = v[0];
+    sample->values[1] = v[1] - v[0];
+    sample->values[2] = v[2] - v[1];
+    sample->values[3] = v[3];
+    sample->values[4] = v[4] - v[3];
+    sample->values[5] = v[5] - v[4];
+    if (length == 0x1c) {
+        sample->values[6] = v[6] - v[7];
+        sample->values[7] = v[7] - v[8];
+        sample->values[8] = v[8] - v[9];
+        sample->values[9] = v[9] - v[10];
+        sample->values[10] = v[10] - v[11];
+        sample->values[11] = v[11];
+        sample->values[12] = v[12];
+        sample->checksum = v[13];
+    } else {
+        sample->values[6] = v[6] - v[7];
+        sample->values[7] = v[7];
+        sample->values[12] = v[8];
+        sample->checksum = v[9];
+    }
+}
+
+static void note_frame(const uint8_t *frame)
+{
+    pms_sample_t sample;
+    frame_sample(frame, &sample);
+
+    if (last_valid && last_sample.length == sample.length &&
+        last_sample.checksum == sample.checksum &&
+        memcmp(last_sample.values, sample.values, sizeof(sample.values)) == 0) {
+        num_repeats++;
+        return;
+    }
+    last_sample = sample;
+    last_valid = true;
+
+    uint32_t i;
+    for (i = 0; i < PMSEVAL_NUM_CODES; i++)
+        code_sample(&codes[i], i, &sample);
+    num_samples++;
+    num_values += sample.length == 0x1c ? PMS_NUM_CHANNELS : PMS_NUM_CHANNELS - 4;
+}
+
+/* Pass the bytes through the frame assembly, and note the frames. */
+static void note_bytes(const uint8_t *bytes, uint32_t size)
+{
+    pms_frames_t *frames = &pms_uart_frames;
+    uint32_t i;
+    for (i = 0; i < size; i++) {
+        pms_frame_byte(frames, bytes[i]);
+        while (frames->tail != frames->head) {
+            note_frame(frames->frames[frames->tail]);
+            frames->tail = (frames->tail + 1) % PMS_NUM_FRAMES;
+        }
+    }
+}
+
+static void report(const char *name)
+{
+    printf("%s: %u samples, %u repeats\n", name, num_samples, num_repeats);
+    if (num_samples == 0)
+        return;
+    uint32_t i;
+    for (i = 0; i < PMSEVAL_NUM_CODES; i++) {
+        pmseval_code_t *code = &codes[i];
+        printf("  %-10s %6.2f bytes/sample, %5.2f bits/value, %5.1f%% of var int, %u buffers\n",
+               code->name, (double)code->bytes / num_samples,
+               8.0 * code->bytes / num_values,
+               100.0 * code->bytes / codes[PMSEVAL_VARINT].bytes, code->buffers + 1);
+    }
+}
+
+static void put_word(uint8_t *frame, uint32_t i, uint32_t v)
+{
+    if (v > 65535)
+        v = 65535;
+    frame[4 + i * 2] = v >> 8;
+    frame[5 + i * 2] = v;
+}
+
+static int32_t noise(double scale)
+{
+    /* Roughly normal, from the sum of uniform values. */
+    double sum = 0;
+    uint32_t i;
+    for (i = 0; i < 4; i++)
+        sum += (test_random() & 0xffff) / 65536.0 - 0.5;
+    return lround(sum * scale);
+}
+
+/*
+ * A synthetic PMS5003 trace. The concentration follows a random walk, the
+ * size bins are in fixed ratios to it with counting noise, and the PM values
+ * are derived from the counts.
+ */
+static void synthetic_trace(void)
+{
+    double level = 20;
+    uint32_t n;
+    for (n = 0; n < PMSEVAL_SYNTHETIC_SAMPLES; n++) {
+        level += noise(2);
+        if (level < 1)
+            level = 1;
+        else if (level > 500)
+            level = 500;
+        static const double ratios[6] = { 60, 18, 3, 0.8, 0.2, 0.05 };
+        int32_t counts[6];
+        uint32_t i;
+        for (i = 0; i < 6; i++) {
+            double c = level * ratios[i];
+            counts[i] = lround(c) + noise(sqrt(c) * 2);
+            if (counts[i] < 0)
+                counts[i] = 0;
+        }
+        for (i = 5; i > 0; i--)
+            counts[i - 1] += counts[i];
+
+        uint8_t frame[PMS_FRAME_MAX_SIZE];
+        frame[0] = 'B';
+        frame[1] = 'M';
+        frame[2] = 0;
+        frame[3] = 0x1c;
+        uint32_t pm1 = counts[0] / 60, pm25 = pm1 + counts[2] / 10, pm10 = pm25 + counts[4];
+        put_word(frame, 0, pm1);
+        put_word(frame, 1, pm25);
+        put_word(frame, 2, pm10);
+        put_word(frame, 3, pm1 * 2 / 3);
+        put_word(frame, 4, pm25 * 2 / 3);
+        put_word(frame, 5, pm10 * 2 / 3);
+        for (i = 0; i < 6; i++)
+            put_word(frame, 6 + i, counts[i]);
+        put_word(frame, 12, 0x9700);
+        uint16_t checksum = 0;
+        for (i = 0; i < 30; i++)
+            checksum += frame[i];
+        put_word(frame, 13, checksum);
+        note_bytes(frame, 32);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        reset_codes();
+        synthetic_trace();
+        report("synthetic");
+        return 0;
+    }
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        FILE *file = fopen(argv[i], "rb");
+        if (!file) {
+            printf("Failed to open %s\n", argv[i]);
+            return 1;
+        }
+        reset_codes();
+        uint8_t bytes[4096];
+        size_t size;
+        while ((size = fread(bytes, 1, sizeof(bytes), file)) > 0)
+            note_bytes(bytes, size);
+        fclose(file);
+        report(argv[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Host tool to unpack the range coded flash sectors, see flash.c.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * Usage: rcunpack <input> <output>
+ *
+ * The input is a sequence of 4096 byte flash sectors, such as the data
+ * sectors read from a device with the ESP flash tools. Each packed sector is
+ * expanded to the buffers it holds, and each buffer is written as a sector in
+ * the usual format, padded with ones. The other sectors are copied unchanged,
+ * so the output can be read by the same tools as a device without the range
+ * coding enabled.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../buffer.h"
+#include "../rc.h"
+
+static uint32_t rcunpack_buffers = 0;
+
+static void write_buffer(void *arg, const uint8_t *buf, uint32_t size)
+{
+    FILE *out = arg;
+    uint8_t sector[4096];
+    memset(sector, 0xff, sizeof(sector));
+    memcpy(sector, buf, size);
+    fwrite(sector, 1, sizeof(sector), out);
+    rcunpack_buffers++;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <input> <output>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        return 1;
+    }
+    FILE *out = fopen(argv[2], "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to open %s\n", argv[2]);
+        fclose(in);
+        return 1;
+    }
+
+    static rc_model_t model;
+    uint8_t sector[4096];
+    uint8_t buf[4096];
+    uint32_t sectors = 0, packed = 0, failed = 0;
+
+    while (fread(sector, 1, sizeof(sector), in) == sizeof(sector)) {
+        sectors++;
+        int32_t count = rc_unpack_sector(&model, sector, buf, write_buffer, out);
+        if (count < 0) {
+            fwrite(sector, 1, sizeof(sector), out);
+            continue;
+        }
+        packed++;
+        if (count == 0)
+            failed++;
+    }
+
+    fclose(in);
+    fclose(out);
+    fprintf(stderr, "%u sectors, %u packed holding %u buffers, %u not decoded\n",
+            sectors, packed, rcunpack_buffers, failed);
+    return 0;
+}
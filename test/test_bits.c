@@ -0,0 +1,123 @@
+/*
+ * Host tests for the bit writer and reader, checking the round trip of fields
+ * of all widths and unary codes, the byte order, and the overrun detection.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "../bits.h"
+
+#define TEST_NUM_FIELDS 1000
+
+static uint32_t random_bits(uint32_t nbits)
+{
+    if (nbits == 0)
+        return 0;
+    return test_random() >> (32 - nbits);
+}
+
+/* Fields of random widths from 0 to 32 bits, and unary codes, mixed. */
+static void test_round_trip(void)
+{
+    uint32_t n;
+    for (n = 0; n < 100; n++) {
+        static uint32_t values[TEST_NUM_FIELDS], widths[TEST_NUM_FIELDS];
+        static uint8_t buf[TEST_NUM_FIELDS * 4 + 8];
+        uint32_t num_fields = test_random() % TEST_NUM_FIELDS;
+        uint32_t i, total = 0;
+
+        bitwriter_t writer;
+        bitwriter_init(&writer, buf);
+        for (i = 0; i < num_fields; i++) {
+            if (test_random() % 3 == 0) {
+                /* A unary code, flagged by a width above 32. */
+                values[i] = test_random() % 32;
+                widths[i] = 33;
+                bitwriter_emit_unary(&writer, values[i]);
+                total += values[i] + 1;
+            } else {
+                widths[i] = test_random() % 33;
+                values[i] = random_bits(widths[i]);
+                bitwriter_emit(&writer, values[i], widths[i]);
+                total += widths[i];
+            }
+        }
+
+        /* Pad to a byte boundary, as the flush drops a partial byte. */
+        uint32_t pad = (8 - total % 8) % 8;
+        bitwriter_emit(&writer, 0, pad);
+        uint32_t size = bitwriter_flush(&writer);
+        CHECK(size == (total + pad) / 8);
+
+        bitreader_t reader;
+        bitreader_init(&reader, buf, size);
+        for (i = 0; i < num_fields; i++) {
+            if (widths[i] > 32)
+                CHECK(bitreader_read_unary(&reader, 32) == values[i]);
+            else
+                CHECK(bitreader_read(&reader, widths[i]) == values[i]);
+        }
+        CHECK(bitreader_read(&reader, pad) == 0);
+        CHECK(!bitreader_overrun(&reader));
+
+        /* Reading past the end returns zero bits, and is detected. */
+        CHECK(bitreader_read(&reader, 1) == 0);
+        CHECK(bitreader_overrun(&reader));
+    }
+}
+
+/* The bits are packed lsb first, and stored in byte order. */
+static void test_layout(void)
+{
+    uint8_t buf[16];
+    memset(buf, 0xaa, sizeof(buf));
+    bitwriter_t writer;
+    bitwriter_init(&writer, buf);
+    bitwriter_emit(&writer, 1, 1);
+    bitwriter_emit_unary(&writer, 3);
+    bitwriter_emit(&writer, 0x5, 3);
+    bitwriter_emit(&writer, 0x12345678, 32);
+    bitwriter_emit(&writer, 0, 3);
+    /* The final three bits are a partial byte, which is not stored. */
+    CHECK(bitwriter_flush(&writer) == 5);
+    CHECK(buf[0] == (1 | 0x7 << 1 | 0x5 << 5));
+    CHECK(buf[1] == 0x78);
+    CHECK(buf[2] == 0x56);
+    CHECK(buf[3] == 0x34);
+    CHECK(buf[4] == 0x12);
+    CHECK(buf[5] == 0xaa);
+
+    /* The unary read stops at the maximum. */
+    bitreader_t reader;
+    static const uint8_t ones[] = { 0xff, 0xff };
+    bitreader_init(&reader, ones, sizeof(ones));
+    CHECK(bitreader_read_unary(&reader, 12) == 12);
+    CHECK(bitreader_read(&reader, 4) == 0xf);
+    CHECK(!bitreader_overrun(&reader));
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_layout();
+    return test_report("bits");
+}
@@ -0,0 +1,275 @@
+/*
+ * Host tests for the data buffers, checking the round trip of events logged
+ * with the reserve and commit calls through the event headers, with and
+ * without the time prediction.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The buffer.c code is included to test its static functions. The buffers are
+ * taken as the flash writer would, and parsed with the reference parser in
+ * events.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "events.h"
+#include "host/flash_emu.h"
+#include "../buffer.c"
+
+#define TEST_BUFFER_FILE "test_buffer.bin"
+#define TEST_NUM_EVENTS 20000
+#define TEST_MAX_SIZE 40
+
+/* The events logged. The codes are those not used by the buffer code itself,
+ * and some are above the time prediction table. */
+typedef struct {
+    uint16_t code;
+    uint32_t size;
+    uint32_t time;
+    bool low_res_time;
+    uint8_t data[TEST_MAX_SIZE];
+} logged_event_t;
+
+static logged_event_t *logged;
+static uint32_t num_logged;
+static uint32_t num_checked;
+
+static void check_buffer(const uint8_t *buf, uint32_t size)
+{
+    test_events_t events;
+    test_event_t event;
+    test_events_init(&events, buf, size);
+    while (test_events_next(&events, &event)) {
+        if (event.code == DBUF_EVENT_ESP8266_STARTUP ||
+            event.code == DBUF_EVENT_SEGMENT_START ||
+            event.code == DBUF_EVENT_TIME_PREDICT) {
+            continue;
+        }
+        if (num_checked >= num_logged) {
+            CHECK(num_checked < num_logged);
+            return;
+        }
+        logged_event_t *expected = &logged[num_checked++];
+        CHECK(event.code == expected->code);
+        CHECK(event.size == expected->size);
+        CHECK(memcmp(event.data, expected->data, event.size) == 0);
+        if (expected->low_res_time)
+            CHECK(expected->time - event.time < 0x2000);
+        else
+            CHECK(event.time == expected->time);
+    }
+    CHECK(!events.error);
+}
+
+static uint16_t random_code(void)
+{
+    static const uint16_t codes[] = { 1, 2, 5, 6, 9, 10, 19, 21, 40, 70, 100, 200 };
+    return codes[test_random() % (sizeof(codes) / sizeof(codes[0]))];
+}
+
+/* Log events with a mix of repeated codes and sizes, which use the compact
+ * header, reservations larger than the final size, which move the data down to
+ * meet the header, and periodic and random times, some exact and some
+ * truncated. */
+static void log_events(void)
+{
+    static uint32_t segment = 0;
+    uint16_t code = random_code();
+    uint32_t size = 0;
+    uint32_t n;
+
+    for (n = 0; n < TEST_NUM_EVENTS; n++) {
+        if (test_random() % 4 == 0) {
+            code = random_code();
+            size = test_random() % (TEST_MAX_SIZE + 1);
+        }
+        uint32_t r = test_random() % 4;
+        if (r == 0)
+            RTC.COUNTER += 0x2000 * (test_random() % 100);
+        else if (r == 1)
+            RTC.COUNTER += 1000 * (code % 7);
+        else if (r == 2)
+            RTC.COUNTER += test_random() % 100000;
+
+        logged_event_t *event = &logged[num_logged];
+        event->code = code;
+        event->size = size;
+        event->low_res_time = test_random() % 2;
+        uint32_t i;
+        for (i = 0; i < size; i++)
+            event->data[i] = test_random();
+        uint32_t max_size = size + test_random() % 4 * 100;
+
+        while (1) {
+            uint8_t *buf = dbuf_reserve(&segment, code, max_size, event->low_res_time);
+            if (buf) {
+                memcpy(buf, event->data, size);
+                /* Bytes past the final size are cleared. */
+                if (max_size > size)
+                    buf[size] = 0;
+                dbuf_commit(size);
+                break;
+            }
+        }
+        event->time = RTC.COUNTER;
+        num_logged++;
+
+        test_take_buffers(check_buffer);
+    }
+
+    test_take_all_buffers(check_buffer);
+    CHECK(num_checked == num_logged);
+}
+
+static void test_events(uint8_t time_predict)
+{
+    flash_emu_erase_all();
+    user_init();
+    param_time_predict = time_predict;
+    reset_dbuf();
+    num_logged = 0;
+    num_checked = 0;
+    log_events();
+}
+
+static uint32_t full_buffers;
+
+/* A full buffer ends at least one byte before the flash footer. */
+static void check_full_buffer(const uint8_t *buf, uint32_t size)
+{
+    check_buffer(buf, size);
+    CHECK(size < DBUF_DATA_SIZE - 4);
+    if (size == DBUF_DATA_SIZE - DBUF_FOOTER_SIZE)
+        full_buffers++;
+}
+
+static void log_sized_event(uint16_t code, uint32_t size)
+{
+    static uint32_t segment = 0;
+    logged_event_t *event = &logged[num_logged++];
+    event->code = code;
+    event->size = size;
+    event->time = RTC.COUNTER;
+    event->low_res_time = false;
+    memset(event->data, code, size);
+    while (dbuf_append(segment, code, event->data, size, 0) != segment)
+        segment = current_segment;
+}
+
+/*
+ * Fill buffers to exactly the limit, with the last event sized to fill the
+ * room left, and check the limit leaves a byte of ones before the footer. The
+ * codes alternate so that the full headers are used, as reserved.
+ */
+static void test_full_buffer(void)
+{
+    flash_emu_erase_all();
+    user_init();
+    param_time_predict = 0;
+    reset_dbuf();
+    num_logged = 0;
+    num_checked = 0;
+    full_buffers = 0;
+
+    uint32_t n;
+    for (n = 0; n < 4; n++) {
+        dbuf_t *head = &dbufs[dbufs_head];
+        uint32_t limit = DBUF_DATA_SIZE - DBUF_FOOTER_SIZE;
+        uint16_t code = 1;
+        while (limit - head->size > TEST_MAX_SIZE) {
+            /* The headers are three bytes, leaving room for a last event of
+             * at least a header. */
+            code ^= 3;
+            log_sized_event(code, limit - head->size >= TEST_MAX_SIZE + 13 ? TEST_MAX_SIZE : 20);
+        }
+        uint32_t room = limit - head->size;
+        uint32_t size;
+        for (size = 0; size < room; size++) {
+            uint8_t header[15];
+            if (emit_event_header(header, 5, size, RTC.COUNTER, false) + size == room)
+                break;
+        }
+        CHECK(size < room);
+        log_sized_event(5, size);
+        CHECK(head->size == limit);
+        CHECK(head->data[DBUF_DATA_SIZE - 4 - 1] == 0xff);
+        /* The next event rolls over to a new buffer. */
+        log_sized_event(6, 0);
+        CHECK(head != &dbufs[dbufs_head]);
+        test_take_buffers(check_full_buffer);
+    }
+
+    test_take_all_buffers(check_full_buffer);
+    CHECK(num_checked == num_logged);
+    CHECK(full_buffers == 4);
+}
+
+/*
+ * An append is reserved exactly, so a repeated event fits in the room left for
+ * its compact header, where the largest header would not fit. The time does
+ * not advance, so the full headers are three bytes and the compact headers one.
+ */
+static void test_exact_append(void)
+{
+    flash_emu_erase_all();
+    user_init();
+    param_time_predict = 0;
+    reset_dbuf();
+    num_logged = 0;
+    num_checked = 0;
+
+    /* After the segment start, and at the time of the last event. */
+    log_sized_event(6, 0);
+    dbuf_t *head = &dbufs[dbufs_head];
+    uint32_t limit = DBUF_DATA_SIZE - DBUF_FOOTER_SIZE;
+    /* Leave room for the second event, with a full header, and a whole number
+     * of repeats. */
+    uint32_t room = limit - head->size - 3 - (3 + 20);
+    log_sized_event(7, room % 21);
+    CHECK((limit - head->size - 23) % 21 == 0);
+    while (head->size < limit && head == &dbufs[dbufs_head])
+        log_sized_event(7, 20);
+    CHECK(head == &dbufs[dbufs_head]);
+    CHECK(head->size == limit);
+    uint8_t header[15];
+    CHECK(emit_event_header(header, 7, 20, RTC.COUNTER, false) + 20 > 21);
+
+    test_take_all_buffers(check_buffer);
+    CHECK(num_checked == num_logged);
+}
+
+int main(void)
+{
+    if (!flash_emu_open(TEST_BUFFER_FILE)) {
+        printf("Failed to open %s\n", TEST_BUFFER_FILE);
+        return 1;
+    }
+    logged = malloc(TEST_NUM_EVENTS * sizeof(logged_event_t));
+
+    test_events(0);
+    test_events(1);
+    test_full_buffer();
+    test_exact_append();
+
+    free(logged);
+    flash_emu_close();
+    unlink(TEST_BUFFER_FILE);
+    return test_report("buffer");
+}
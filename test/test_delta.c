@@ -0,0 +1,264 @@
+/*
+ * Host tests for the delta encoded sensor events, checking the round trip of
+ * the channel values in the plain format and in the DBUF_EVENT_DELTA_SET
+ * format with the delta and the delta-of-delta residuals.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The sets are logged across many buffers, so each mode is checked on the
+ * first and second values of many segments, which are coded differently.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "events.h"
+#include "host/flash_emu.h"
+#include "../delta.c"
+
+void user_init(void);
+
+#define TEST_DELTA_FILE "test_delta.bin"
+#define TEST_NUM_SETS 5000
+/* All the mask bits are used. */
+#define TEST_NUM_CHANNELS 32
+#define TEST_CODE DBUF_EVENT_SHT2X_TEMP_HUM
+
+/* The channels by their index modulo four: constant, steadily increasing, a
+ * random walk, and random jumps over the full range. */
+#define TEST_CONSTANT 0
+#define TEST_STEADY 1
+
+typedef struct {
+    int32_t values[TEST_NUM_CHANNELS];
+    uint8_t extra;
+} logged_set_t;
+
+static logged_set_t *logged;
+static uint32_t num_logged;
+static uint32_t num_decoded;
+
+/* The decoding state, and counts of the cases checked. */
+static uint8_t test_mode;
+static int32_t last[TEST_NUM_CHANNELS];
+static int32_t last_delta[TEST_NUM_CHANNELS];
+static uint32_t count;
+static uint32_t num_first;
+static uint32_t num_second;
+static uint32_t num_elided;
+
+static void reset_decoder(void)
+{
+    memset(last, 0, sizeof(last));
+    memset(last_delta, 0, sizeof(last_delta));
+    count = 0;
+}
+
+static uint32_t read_leb128(test_event_t *event, uint32_t *pos)
+{
+    uint32_t v = 0;
+    uint32_t shift = 0;
+    uint8_t byte;
+    do {
+        if (*pos >= event->size) {
+            CHECK(*pos < event->size);
+            return 0;
+        }
+        byte = event->data[(*pos)++];
+        if (shift < 32)
+            v |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return v;
+}
+
+/* Signed leb128, sign extended from the last byte. */
+static int32_t read_leb128_signed(test_event_t *event, uint32_t *pos)
+{
+    int64_t v = 0;
+    uint32_t shift = 0;
+    uint8_t byte;
+    do {
+        if (*pos >= event->size) {
+            CHECK(*pos < event->size);
+            return 0;
+        }
+        byte = event->data[(*pos)++];
+        v |= (int64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80 && shift < 63);
+    if (byte & 0x40)
+        v -= (int64_t)1 << shift;
+    return (int32_t)v;
+}
+
+static void decode_set(test_event_t *event)
+{
+    uint32_t pos = 0;
+    int32_t deltas[TEST_NUM_CHANNELS];
+    uint32_t i;
+
+    if (event->code == TEST_CODE) {
+        CHECK(test_mode == 0);
+        for (i = 0; i < TEST_NUM_CHANNELS; i++) {
+            /* Channel 0 is unsigned, as a time. */
+            deltas[i] = i == 0 ? read_leb128(event, &pos) : read_leb128_signed(event, &pos);
+        }
+    } else {
+        CHECK(test_mode != 0);
+        uint32_t code = read_leb128(event, &pos);
+        bool delta2 = code & 1;
+        CHECK(code >> 1 == TEST_CODE);
+        CHECK(delta2 == (test_mode > 1));
+        uint32_t mask = read_leb128(event, &pos);
+        for (i = 0; i < TEST_NUM_CHANNELS; i++) {
+            int32_t residual = 0;
+            if (mask & (1u << i)) {
+                residual = read_leb128_signed(event, &pos);
+                CHECK(residual != 0);
+            }
+            deltas[i] = residual;
+            if (delta2 && count > 1)
+                deltas[i] = (uint32_t)residual + (uint32_t)last_delta[i];
+        }
+
+        /* The unchanging channels after the first value, and the steady
+         * channels after the second value with the delta-of-delta, are
+         * elided from the mask. */
+        for (i = 0; i < TEST_NUM_CHANNELS; i++) {
+            if ((count > 0 && i % 4 == TEST_CONSTANT) ||
+                (delta2 && count > 1 && i % 4 == TEST_STEADY)) {
+                CHECK((mask & (1u << i)) == 0);
+                num_elided++;
+            }
+        }
+    }
+
+    /* The extra byte follows the channels. */
+    CHECK(pos + 1 == event->size);
+    if (num_decoded >= num_logged) {
+        CHECK(num_decoded < num_logged);
+        return;
+    }
+    logged_set_t *expected = &logged[num_decoded++];
+    CHECK(event->data[pos] == expected->extra);
+
+    for (i = 0; i < TEST_NUM_CHANNELS; i++) {
+        last_delta[i] = deltas[i];
+        last[i] = (uint32_t)last[i] + (uint32_t)deltas[i];
+        CHECK(last[i] == expected->values[i]);
+    }
+    if (count == 0)
+        num_first++;
+    else if (count == 1)
+        num_second++;
+    count++;
+}
+
+static void decode_buffer(const uint8_t *buf, uint32_t size)
+{
+    test_events_t events;
+    test_event_t event;
+    test_events_init(&events, buf, size);
+    reset_decoder();
+    while (test_events_next(&events, &event)) {
+        if (event.code == DBUF_EVENT_SEGMENT_START)
+            reset_decoder();
+        else if (event.code == TEST_CODE || event.code == DBUF_EVENT_DELTA_SET)
+            decode_set(&event);
+    }
+    CHECK(!events.error);
+}
+
+static void test_delta_sets(uint8_t mode)
+{
+    flash_emu_erase_all();
+    user_init();
+    param_delta_mode = mode;
+    reset_dbuf();
+    test_mode = mode;
+    num_logged = 0;
+    num_decoded = 0;
+    num_first = 0;
+    num_second = 0;
+    num_elided = 0;
+
+    delta_channel_t channels[TEST_NUM_CHANNELS];
+    delta_set_t set;
+    memset(channels, 0, sizeof(channels));
+    channels[0].flags = DELTA_UNSIGNED;
+    init_delta_set(&set, TEST_CODE, TEST_NUM_CHANNELS, channels);
+
+    int32_t values[TEST_NUM_CHANNELS];
+    uint32_t i;
+    for (i = 0; i < TEST_NUM_CHANNELS; i++)
+        values[i] = test_random();
+
+    uint32_t n;
+    for (n = 0; n < TEST_NUM_SETS; n++) {
+        logged_set_t *set_logged = &logged[num_logged++];
+        for (i = 0; i < TEST_NUM_CHANNELS; i++) {
+            switch (i % 4) {
+            case TEST_CONSTANT:
+                break;
+            case TEST_STEADY:
+                values[i] += i;
+                break;
+            case 2:
+                values[i] += (int32_t)(test_random() % 21) - 10;
+                break;
+            default:
+                if (test_random() % 8 == 0)
+                    values[i] = test_random();
+                break;
+            }
+        }
+        memcpy(set_logged->values, values, sizeof(values));
+        set_logged->extra = test_random();
+        RTC.COUNTER += 1000000;
+        log_delta_set(&set, values, &set_logged->extra, 1);
+        test_take_buffers(decode_buffer);
+    }
+
+    test_take_all_buffers(decode_buffer);
+    CHECK(num_decoded == num_logged);
+    /* Several segments, each with a first and second value. */
+    CHECK(num_first > 1);
+    CHECK(num_second == num_first);
+    if (mode)
+        CHECK(num_elided > 0);
+}
+
+int main(void)
+{
+    if (!flash_emu_open(TEST_DELTA_FILE)) {
+        printf("Failed to open %s\n", TEST_DELTA_FILE);
+        return 1;
+    }
+    logged = malloc(TEST_NUM_SETS * sizeof(logged_set_t));
+
+    test_delta_sets(0);
+    test_delta_sets(1);
+    test_delta_sets(2);
+
+    free(logged);
+    flash_emu_close();
+    unlink(TEST_DELTA_FILE);
+    return test_report("delta");
+}
@@ -0,0 +1,474 @@
+/*
+ * Host tests for the flash sector ring, run on the file backed flash emulator
+ * with injected faults.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The flash.c code is included to test its static functions, and is linked
+ * with buffer.c which fills the buffers. A restart is emulated by calling
+ * user_init() again, which recovers the ring head from the flash.
+ *
+ * The flash operation counts are reported, as a base for measuring the wear
+ * and bus time of changes to the flash code.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "../flash.c"
+#include "host/flash_emu.h"
+
+void user_init(void);
+
+#define TEST_FLASH_FILE "test_flash.bin"
+
+/* Restart, and seal the head sector as the flash task does after its start-up
+ * delay. Nothing is written at start-up. */
+static void restart(void)
+{
+    flash_emu_power_on();
+    uint32_t writes = flash_emu_stats.writes;
+    user_init();
+    CHECK(flash_emu_stats.writes == writes);
+    rc_fill = 0;
+    seal_start_sector();
+}
+
+/* Log a text event, compressible as text is, returning false if the power was
+ * cut. */
+static bool log_event(void)
+{
+    static uint32_t segment = 0;
+    uint8_t data[100];
+    uint32_t i;
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = 'a' + test_random() % 4;
+
+    while (1) {
+        uint32_t new_segment = dbuf_append(segment, DBUF_EVENT_TEXT_MESSAGE,
+                                           data, sizeof(data), 1);
+        if (new_segment == segment)
+            break;
+        segment = new_segment;
+    }
+
+    RTC.COUNTER += 1000;
+    host_ticks += 1;
+    return !flash_emu_powered_off();
+}
+
+/* Log events for about this number of buffers, writing them to flash as they
+ * fill, and returning false if the power was cut. */
+static bool log_buffers(uint32_t buffers)
+{
+    uint32_t last = dbuf_head_index() + buffers;
+    while (dbuf_head_index() < last) {
+        uint32_t i;
+        for (i = 0; i < 8; i++) {
+            if (!log_event())
+                return false;
+        }
+        write_buffers_to_flash();
+        if (flash_emu_powered_off())
+            return false;
+    }
+
+    /* Flush the head buffer, which is written after a delay. */
+    RTC.COUNTER += 30000000;
+    write_buffers_to_flash();
+    return !flash_emu_powered_off();
+}
+
+static void reset_sector_index(void)
+{
+    uint32_t i;
+    for (i = 0; i < BUFFER_FLASH_NUM_SECTORS; i++)
+        sector_index[i] = SECTOR_INDEX_UNKNOWN;
+    sector_index_largest = 0;
+}
+
+/* The binary search reads, from the probes, the successor check, and a run of
+ * erased sectors past the head of a ring not yet filled. */
+#define TEST_SEARCH_READS (4 * 10 + FLASH_ERASED_SECTORS)
+/* And a fall back to the full scan. */
+#define TEST_SCAN_READS (TEST_SEARCH_READS + BUFFER_FLASH_NUM_SECTORS)
+
+/* The binary search finds the same head as the full scan, reading at most
+ * max_reads sector indexes. */
+static void check_head_search(uint32_t max_reads)
+{
+    uint16_t scan_sector, find_sector;
+    uint32_t scan_index, find_index;
+    reset_sector_index();
+    int scan_found = scan_most_recent_sector(&scan_sector, &scan_index);
+    reset_sector_index();
+    uint32_t reads = flash_reads;
+    int find_found = find_most_recent_sector(&find_sector, &find_index);
+    reads = flash_reads - reads;
+    CHECK(reads <= max_reads);
+    CHECK(scan_found == find_found);
+    if (scan_found && find_found) {
+        CHECK(scan_sector == find_sector);
+        CHECK(scan_index == find_index);
+    }
+}
+
+/* The fill length of each sector, from the footer or not, is the size without
+ * the trailing ones, so the footer was written correctly. */
+static void check_sector_fills(void)
+{
+    uint8_t *flash = flash_emu_data();
+    uint16_t sector;
+    reset_sector_index();
+    for (sector = BUFFER_FLASH_FIRST_SECTOR;
+         sector < BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS;
+         sector++) {
+        uint32_t index, fill;
+        if (!get_sector_index(sector, &index))
+            continue;
+        CHECK(get_sector_fill(sector, &fill));
+        uint32_t size = FLASH_FOOTER_OFFSET;
+        while (size > 0 && flash[sector * 4096 + size - 1] == 0xff)
+            size--;
+        CHECK(fill == size);
+    }
+}
+
+/* Every sector before the head of the ring has been sealed. */
+static void check_sealed(uint32_t buffers)
+{
+    uint16_t sector = flash_sector;
+    uint32_t i;
+    for (i = 0; i < buffers; i++) {
+        if (--sector < BUFFER_FLASH_FIRST_SECTOR)
+            sector = BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS - 1;
+        uint32_t index, fill;
+        if (get_sector_index(sector, &index))
+            CHECK(read_sector_footer(sector, &fill));
+    }
+}
+
+static void test_empty(void)
+{
+    flash_emu_erase_all();
+    restart();
+    CHECK(dbuf_head_index() == 0);
+    check_head_search(TEST_SEARCH_READS);
+}
+
+/* The head index is recovered after a restart, also after the ring wraps. */
+static void test_restart(void)
+{
+    flash_emu_erase_all();
+    restart();
+
+    uint32_t n;
+    for (n = 0; n < 4; n++) {
+        CHECK(log_buffers(n == 2 ? BUFFER_FLASH_NUM_SECTORS : 50));
+        uint32_t last = dbuf_head_index();
+        restart();
+        CHECK(dbuf_head_index() == last + 1);
+        check_head_search(TEST_SEARCH_READS);
+        check_sealed(40);
+    }
+    check_sector_fills();
+}
+
+/* A run of bad sectors longer than the search probe, within the ring and at
+ * the position of a binary search probe. These are erased, and followed by a
+ * larger index, so the search might fall back to the full scan. */
+static void test_bad_sectors(void)
+{
+    flash_emu_erase_all();
+    restart();
+    CHECK(log_buffers(BUFFER_FLASH_NUM_SECTORS + 20));
+
+    uint16_t first_bad = BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS / 8;
+    uint32_t i;
+    for (i = 0; i < 3 * FLASH_PROBE_SECTORS; i++)
+        flash_emu_set_bad_sector(first_bad + i, true);
+    CHECK(log_buffers(BUFFER_FLASH_NUM_SECTORS / 8 + 20));
+    uint32_t last = dbuf_head_index();
+    restart();
+    CHECK(dbuf_head_index() == last + 1);
+    check_head_search(TEST_SCAN_READS);
+
+    /* And with the head just before the bad sectors. */
+    flash_emu_erase_all();
+    restart();
+    CHECK(log_buffers(BUFFER_FLASH_NUM_SECTORS + 20));
+    CHECK(log_buffers(first_bad - flash_sector - 2));
+    last = dbuf_head_index();
+    restart();
+    CHECK(dbuf_head_index() == last + 1);
+    check_head_search(TEST_SCAN_READS);
+
+    for (i = 0; i < 3 * FLASH_PROBE_SECTORS; i++)
+        flash_emu_set_bad_sector(first_bad + i, false);
+}
+
+/* Failed writes are retried at the next sector. */
+static void test_write_failures(void)
+{
+    flash_emu_erase_all();
+    restart();
+    uint32_t n;
+    for (n = 0; n < 20; n++) {
+        CHECK(log_buffers(10));
+        flash_emu_fail_next_writes(1 + n % 3);
+    }
+    CHECK(log_buffers(10));
+    uint32_t last = dbuf_head_index();
+    restart();
+    CHECK(dbuf_head_index() == last + 1);
+    check_head_search(TEST_SEARCH_READS);
+    check_sector_fills();
+}
+
+/* Power cuts at many points through the writes. The head is recovered, and
+ * the head sector at the cut is sealed at the restart. */
+static void test_power_cuts(void)
+{
+    flash_emu_erase_all();
+    restart();
+    CHECK(log_buffers(BUFFER_FLASH_NUM_SECTORS - 10));
+
+    uint32_t n;
+    for (n = 0; n < 100; n++) {
+        flash_emu_power_cut_after(test_random() % 20000);
+        if (log_buffers(30))
+            flash_emu_power_cut_after(0xffffffff);
+        uint16_t head = flash_sector;
+        restart();
+        check_head_search(TEST_SEARCH_READS);
+        uint32_t index, fill;
+        if (get_sector_index(head, &index) && flash_sector != head)
+            CHECK(read_sector_footer(head, &fill));
+    }
+    check_sector_fills();
+}
+
+/* A corrupt sector index is skipped. */
+static void test_bit_rot(void)
+{
+    flash_emu_erase_all();
+    restart();
+    CHECK(log_buffers(BUFFER_FLASH_NUM_SECTORS + 100));
+
+    uint32_t n;
+    for (n = 0; n < 20; n++) {
+        uint16_t sector = BUFFER_FLASH_FIRST_SECTOR + test_random() % BUFFER_FLASH_NUM_SECTORS;
+        flash_emu_rot_bit(sector * 4096 + test_random() % 8, test_random() % 8);
+        reset_sector_index();
+        uint32_t index;
+        CHECK(!get_sector_index(sector, &index));
+        restart();
+        check_head_search(TEST_SEARCH_READS);
+        CHECK(log_buffers(5));
+    }
+}
+
+/* A sector that was not sealed, with data in the last word that decodes as a
+ * footer, is not taken to be sealed. */
+static void test_false_footer(void)
+{
+    flash_emu_erase_all();
+    restart();
+    CHECK(log_buffers(3));
+
+    uint16_t sector = BUFFER_FLASH_FIRST_SECTOR + 100;
+    uint8_t buf[4096];
+    uint32_t i;
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = test_random() | 1;
+    uint32_t fill = 2000;
+    uint32_t footer = fill | (fill ^ 0xffff) << 16;
+    memcpy(buf + FLASH_FOOTER_OFFSET, &footer, 4);
+    flash_erase_sector(sector);
+    flash_write(sector * 4096, (uint32_t *)buf, sizeof(buf));
+    CHECK(!read_sector_footer(sector, &fill));
+
+    /* The same fill with ones following it is accepted. */
+    memset(buf + 2000, 0xff, FLASH_FOOTER_OFFSET - 2000);
+    flash_erase_sector(sector);
+    flash_write(sector * 4096, (uint32_t *)buf, sizeof(buf));
+    CHECK(read_sector_footer(sector, &fill) && fill == 2000);
+}
+
+/*
+ * A full sector has a byte of ones between its data and the footer, so a raw
+ * decoder stops before the footer. A sector written before the footer was
+ * used, with data up to the footer, is not sealed and its fill is found by
+ * the scan.
+ */
+static void test_full_sector(void)
+{
+    flash_emu_erase_all();
+    restart();
+    CHECK(log_buffers(3));
+
+    uint16_t sector = BUFFER_FLASH_FIRST_SECTOR + 100;
+    uint32_t fills[] = { FLASH_DATA_END, FLASH_FOOTER_OFFSET };
+    uint32_t n;
+    for (n = 0; n < 2; n++) {
+        uint8_t buf[4096];
+        memset(buf, 0xff, sizeof(buf));
+        uint32_t i, index = 1000 + n;
+        for (i = 0; i < 4; i++) {
+            buf[i] = index >> (i * 8);
+            buf[4 + i] = ~index >> (i * 8);
+        }
+        for (i = 8; i < fills[n]; i++)
+            buf[i] = test_random() & 0x7f;
+        flash_erase_sector(sector);
+        flash_write(sector * 4096, (uint32_t *)buf, sizeof(buf));
+
+        reset_sector_index();
+        seal_flash_sector(sector);
+        uint8_t *data = flash_emu_data() + sector * 4096;
+        uint32_t fill;
+        if (fills[n] == FLASH_DATA_END) {
+            CHECK(read_sector_footer(sector, &fill) && fill == FLASH_DATA_END);
+            CHECK(data[FLASH_DATA_END] == 0xff);
+        } else {
+            CHECK(!read_sector_footer(sector, &fill));
+            CHECK(memcmp(data + FLASH_FOOTER_OFFSET, buf + FLASH_FOOTER_OFFSET, 4) == 0);
+        }
+        reset_sector_index();
+        CHECK(get_sector_fill(sector, &fill) && fill == fills[n]);
+    }
+}
+
+/* Log the same events from the same start, for comparing the buffers. */
+static void restart_events(void)
+{
+    flash_emu_erase_all();
+    test_random_state = 2463534242U;
+    RTC.COUNTER = 0;
+    host_ticks = 0;
+    restart();
+}
+
+#define TEST_RC_BUFFERS 120
+
+/* Log the buffers in steps, failing a write after every other step. */
+static void log_rc_test_buffers(void)
+{
+    uint32_t n;
+    for (n = 0; n < 10; n++) {
+        CHECK(log_buffers((TEST_RC_BUFFERS - 10) / 10));
+        if (n & 1)
+            flash_emu_fail_next_writes(1);
+    }
+}
+
+static uint8_t *rc_test_buffers;
+static uint32_t rc_test_first_index;
+static uint32_t rc_test_matched;
+
+static void rc_test_compare(void *arg, const uint8_t *buf, uint32_t size)
+{
+    uint32_t index = buf[0] | buf[1] << 8 | buf[2] << 16 | buf[3] << 24;
+    if (index < rc_test_first_index || index >= rc_test_first_index + TEST_RC_BUFFERS)
+        return;
+    uint8_t *expected = rc_test_buffers + (index - rc_test_first_index) * 4096;
+    CHECK(size == buffer_fill(expected, FLASH_FOOTER_OFFSET));
+    CHECK(memcmp(buf, expected, size) == 0);
+    rc_test_matched++;
+}
+
+/* The packed sectors unpack to the same buffers as written without the range
+ * coding, also after write failures, and hold more than one buffer. */
+static void test_rc_sectors(void)
+{
+    rc_test_buffers = malloc(TEST_RC_BUFFERS * 4096);
+    memset(rc_test_buffers, 0xff, TEST_RC_BUFFERS * 4096);
+
+    restart_events();
+    rc_test_first_index = dbuf_head_index();
+    log_rc_test_buffers();
+    uint16_t sector;
+    for (sector = BUFFER_FLASH_FIRST_SECTOR;
+         sector < BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS;
+         sector++) {
+        uint32_t index;
+        if (get_sector_index(sector, &index) && index >= rc_test_first_index &&
+            index < rc_test_first_index + TEST_RC_BUFFERS) {
+            uint8_t *buf = rc_test_buffers + (index - rc_test_first_index) * 4096;
+            memcpy(buf, flash_emu_data() + sector * 4096, FLASH_FOOTER_OFFSET);
+        }
+    }
+
+    rc_model = malloc(sizeof(rc_model_t));
+    set_buffer_rc(true);
+    restart_events();
+    log_rc_test_buffers();
+
+    uint32_t packed = 0;
+    rc_test_matched = 0;
+    for (sector = BUFFER_FLASH_FIRST_SECTOR;
+         sector < BUFFER_FLASH_FIRST_SECTOR + BUFFER_FLASH_NUM_SECTORS;
+         sector++) {
+        uint8_t buf[4096];
+        if (rc_unpack_sector(rc_model, flash_emu_data() + sector * 4096, buf,
+                             rc_test_compare, NULL) > 0) {
+            packed++;
+        }
+    }
+    /* All but the head buffer, which is not written. */
+    CHECK(rc_test_matched + 1 >= dbuf_head_index() - rc_test_first_index);
+    CHECK(packed > 0 && packed * 2 < rc_test_matched);
+    check_head_search(TEST_SEARCH_READS);
+
+    /* The head is recovered from a packed sector. */
+    uint32_t last = dbuf_head_index();
+    restart();
+    CHECK(dbuf_head_index() == last);
+
+    set_buffer_rc(false);
+    free(rc_model);
+    rc_model = NULL;
+    free(rc_test_buffers);
+}
+
+int main(void)
+{
+    if (!flash_emu_open(TEST_FLASH_FILE)) {
+        printf("Failed to open %s\n", TEST_FLASH_FILE);
+        return 1;
+    }
+
+    test_empty();
+    test_restart();
+    test_bad_sectors();
+    test_write_failures();
+    test_power_cuts();
+    test_bit_rot();
+    test_false_footer();
+    test_full_sector();
+    test_rc_sectors();
+
+    printf("flash: %u reads of %u bytes, %u writes of %u bytes, %u erases\n",
+           flash_emu_stats.reads, flash_emu_stats.read_bytes,
+           flash_emu_stats.writes, flash_emu_stats.write_bytes,
+           flash_emu_stats.erases);
+
+    flash_emu_close();
+    unlink(TEST_FLASH_FILE);
+    return test_report("flash");
+}
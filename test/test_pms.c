@@ -0,0 +1,840 @@
+/*
+ * Host tests for the PMS*003 sensor code: the frame assembly, the software
+ * UART receiver of the second sensor, the Rice coded events and the
+ * predictor, and the duty cycle.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ * The pms.c code is included to test its static functions. The interrupt
+ * handlers are called directly, with the received levels and cycle counts set
+ * in the shims. The events are decoded with the bit reader, following the
+ * adaptation of the encoder.
+ */
+
+#include <setjmp.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "events.h"
+#include "host/flash_emu.h"
+#include "../pms.c"
+
+void user_init(void);
+
+#define TEST_PMS_FILE "test_pms.bin"
+#define TEST_NUM_SAMPLES 5000
+
+/* Make a PMS3003 or PMS5003 frame with random values, returning its size. */
+static uint32_t make_sized_frame(uint8_t *frame, uint16_t length, bool most_edges)
+{
+    uint32_t i, size = 4 + length;
+    frame[0] = 'B';
+    frame[1] = 'M';
+    frame[2] = 0;
+    frame[3] = length;
+    for (i = 4; i < size - 2; i++)
+        frame[i] = most_edges && i > 5 ? 0x55 : test_random();
+    uint16_t checksum = 0;
+    for (i = 0; i < size - 2; i++)
+        checksum += frame[i];
+    frame[size - 2] = checksum >> 8;
+    frame[size - 1] = checksum;
+    return size;
+}
+
+/* Make a PMS5003 frame with random values, or with the data bytes 0x55 which
+ * have the most edges after the first value, returning its size. */
+static uint32_t make_frame(uint8_t *frame, bool most_edges)
+{
+    return make_sized_frame(frame, 0x1c, most_edges);
+}
+
+/* Pop a frame from the ring, returning false if it is empty or the frame does
+ * not match. */
+static bool pop_frame(pms_frames_t *frames, uint8_t *expected, uint32_t size)
+{
+    if (frames->tail == frames->head)
+        return false;
+    bool match = memcmp(frames->frames[frames->tail], expected, size) == 0;
+    frames->tail = (frames->tail + 1) % PMS_NUM_FRAMES;
+    return match;
+}
+
+static void send_bytes(pms_frames_t *frames, const uint8_t *bytes, uint32_t size)
+{
+    uint32_t i;
+    for (i = 0; i < size; i++)
+        pms_frame_byte(frames, bytes[i]);
+}
+
+/* Garbage with no "BM" header, except some with an invalid length, and not
+ * ending within a header. */
+static void send_garbage(pms_frames_t *frames)
+{
+    uint8_t garbage[100];
+    uint32_t i, size = test_random() % sizeof(garbage);
+    for (i = 0; i < size; i++) {
+        garbage[i] = test_random();
+        if (garbage[i] == 'M' && i > 0 && garbage[i - 1] == 'B')
+            garbage[i] = 0;
+    }
+    if (size >= 4 && test_random() % 2) {
+        i = test_random() % (size - 3);
+        garbage[i] = 'B';
+        garbage[i + 1] = 'M';
+        garbage[i + 2] = test_random() | 1;
+        garbage[i + 3] = test_random();
+    }
+    send_bytes(frames, garbage, size);
+    if (size > 0 && garbage[size - 1] == 'B')
+        pms_frame_byte(frames, 0);
+}
+
+/*
+ * The frame assembly, fed streams of frames mixed with garbage, partial
+ * frames, and corrupt frames. Only the valid frames are delivered, in order,
+ * and a valid frame is always found unless the bytes before it were taken as
+ * the end of a partial frame.
+ */
+static void test_frame_assembly(void)
+{
+    pms_frames_t *frames = &pms_uart_frames;
+    uint8_t frame[PMS_FRAME_MAX_SIZE];
+    uint32_t n;
+
+    for (n = 0; n < 2000; n++) {
+        uint32_t checksum_errors = frames->checksum_errors;
+        uint32_t size = make_sized_frame(frame, test_random() % 2 ? 0x14 : 0x1c, false);
+
+        switch (test_random() % 4) {
+        case 0:
+            /* A valid frame. */
+            send_bytes(frames, frame, size);
+            CHECK(pop_frame(frames, frame, size));
+            break;
+        case 1:
+            /* Garbage then a valid frame. */
+            send_garbage(frames);
+            send_bytes(frames, frame, size);
+            CHECK(pop_frame(frames, frame, size));
+            break;
+        case 2: {
+            /* A corrupt frame. */
+            uint32_t i = 4 + test_random() % (size - 4);
+            frame[i] ^= 1 << test_random() % 8;
+            send_bytes(frames, frame, size);
+            CHECK(frames->checksum_errors == checksum_errors + 1);
+            break;
+        }
+        default: {
+            /* A partial frame, with at least its header, then a frame which
+             * completes it and is lost, and then a valid frame. */
+            send_bytes(frames, frame, 4 + test_random() % (size - 4));
+            make_frame(frame, false);
+            send_bytes(frames, frame, PMS_FRAME_MAX_SIZE);
+            CHECK(frames->checksum_errors == checksum_errors + 1);
+            CHECK(frames->tail == frames->head);
+            send_garbage(frames);
+            size = make_frame(frame, false);
+            send_bytes(frames, frame, size);
+            CHECK(pop_frame(frames, frame, size));
+            break;
+        }
+        }
+        CHECK(frames->tail == frames->head);
+    }
+
+    /* The frames are dropped when the task falls behind. */
+    uint8_t ring[PMS_NUM_FRAMES + 2][PMS_FRAME_MAX_SIZE];
+    for (n = 0; n < PMS_NUM_FRAMES + 2; n++)
+        send_bytes(frames, ring[n], make_frame(ring[n], false));
+    CHECK(frames->overruns == 3);
+    for (n = 0; n < PMS_NUM_FRAMES - 1; n++)
+        CHECK(pop_frame(frames, ring[n], PMS_FRAME_MAX_SIZE));
+    CHECK(frames->tail == frames->head);
+}
+
+/*
+ * The software UART. The cycle count is the time in the line, with a little
+ * jitter on each edge as the interrupt latency varies.
+ */
+static uint32_t soft_time;
+
+static void soft_level(bool level)
+{
+    if (level != host_gpio_level) {
+        host_gpio_level = level;
+        host_ccount = soft_time + test_random() % (pms_soft_bit_cycles / 8);
+        pms_soft_edge_handler(0);
+    }
+}
+
+static void soft_bytes(uint8_t *bytes, uint32_t size)
+{
+    uint32_t i, bit;
+    for (i = 0; i < size; i++) {
+        uint32_t ch = (bytes[i] | 0x100) << 1;
+        for (bit = 0; bit < 10; bit++) {
+            soft_level((ch >> bit) & 1);
+            soft_time += pms_soft_bit_cycles;
+        }
+    }
+}
+
+static void soft_idle(uint32_t bits)
+{
+    soft_time += bits * pms_soft_bit_cycles;
+}
+
+static void soft_decode(void)
+{
+    host_ccount = soft_time;
+    pms_soft_decode();
+}
+
+static void test_soft_uart(void)
+{
+    pms_frames_t *frames = &pms_soft_frames;
+    pms_soft_edges = malloc(PMS_SOFT_NUM_EDGES * sizeof(uint32_t));
+    pms_soft_bit_cycles = 80 * 1000000 / PMS_SOFT_BAUD;
+    soft_time = 0x80000000;
+    soft_idle(100);
+
+    /* Frames decoded as they arrive. */
+    uint8_t frame[PMS_FRAME_MAX_SIZE];
+    uint32_t n;
+    for (n = 0; n < 20; n++) {
+        uint32_t size = make_frame(frame, false);
+        soft_bytes(frame, size);
+        soft_idle(n & 1 ? 200 : 20);
+        soft_decode();
+        CHECK(pop_frame(frames, frame, size));
+        CHECK(frames->tail == frames->head);
+    }
+    CHECK(frames->checksum_errors == 0);
+    CHECK(pms_soft_edge_overruns == 0);
+
+    /* The ring holds the edges of two frames. */
+    uint8_t frames2[2][PMS_FRAME_MAX_SIZE];
+    for (n = 0; n < 2; n++) {
+        soft_bytes(frames2[n], make_frame(frames2[n], true));
+        soft_idle(20);
+    }
+    soft_decode();
+    CHECK(pms_soft_edge_overruns == 0);
+    CHECK(pop_frame(frames, frames2[0], PMS_FRAME_MAX_SIZE));
+    CHECK(pop_frame(frames, frames2[1], PMS_FRAME_MAX_SIZE));
+
+    /* Overrun the ring in the third frame, and the task catches up in the
+     * middle of the fourth frame. The decoder resynchronizes on the fifth
+     * frame, rather than on an edge within a byte, or appending bytes to the
+     * partial third frame. */
+    uint8_t frames5[5][PMS_FRAME_MAX_SIZE];
+    for (n = 0; n < 5; n++)
+        make_frame(frames5[n], true);
+    for (n = 0; n < 3; n++) {
+        soft_bytes(frames5[n], PMS_FRAME_MAX_SIZE);
+        soft_idle(20);
+    }
+    soft_bytes(frames5[3], 5);
+    CHECK(pms_soft_edge_overruns > 0);
+    soft_decode();
+    CHECK(pop_frame(frames, frames5[0], PMS_FRAME_MAX_SIZE));
+    CHECK(pop_frame(frames, frames5[1], PMS_FRAME_MAX_SIZE));
+    CHECK(frames->tail == frames->head);
+    soft_bytes(frames5[3] + 5, PMS_FRAME_MAX_SIZE - 5);
+    soft_idle(20);
+    soft_bytes(frames5[4], PMS_FRAME_MAX_SIZE);
+    soft_idle(20);
+    soft_decode();
+    CHECK(pop_frame(frames, frames5[4], PMS_FRAME_MAX_SIZE));
+    CHECK(frames->tail == frames->head);
+    CHECK(frames->checksum_errors == 0);
+    free(pms_soft_edges);
+    pms_soft_edges = NULL;
+}
+
+static int32_t read_rice(bitreader_t *reader, rice_state_t *state,
+                         uint32_t escape_bits, bool *escaped)
+{
+    uint32_t k;
+    for (k = 0; (state->n << k) < state->a && k < 16; k++)
+        ;
+
+    uint32_t u;
+    uint32_t q = bitreader_read_unary(reader, RICE_ESCAPE);
+    if (q < RICE_ESCAPE) {
+        u = q << k | bitreader_read(reader, k);
+    } else {
+        u = bitreader_read(reader, escape_bits);
+        *escaped = true;
+    }
+
+    state->a += u;
+    state->n++;
+    if (state->n >= RICE_WINDOW) {
+        state->a >>= 1;
+        state->n >>= 1;
+    }
+    return u & 1 ? -(int32_t)(u >> 1) - 1 : (int32_t)(u >> 1);
+}
+
+static int32_t random_value(int32_t max)
+{
+    return (int32_t)(test_random() % (2 * max + 1)) - max;
+}
+
+/*
+ * The Rice code round trip, with values of all sizes in both escape widths,
+ * including the largest the events need. The values switch between small and
+ * large runs so that the parameter adapts both ways, and the code lengths at
+ * the escape are checked.
+ */
+static void test_rice(void)
+{
+    uint32_t n;
+    for (n = 0; n < 200; n++) {
+        static int32_t values[1000];
+        static uint8_t buf[1000 * 4 + 8];
+        uint32_t escape_bits = n & 1 ? 20 : 18;
+        int32_t max = (1 << (escape_bits - 1)) - 1;
+        uint32_t num_values = 1 + test_random() % 1000;
+        uint32_t i, escapes = 0;
+
+        rice_state_t state[PMS_NUM_CHANNELS];
+        init_rice_state(state);
+        bitwriter_t writer;
+        bitwriter_init(&writer, buf);
+        int32_t scale = 1 + test_random() % 100;
+        for (i = 0; i < num_values; i++) {
+            if (test_random() % 50 == 0)
+                scale = test_random() % 2 ? 1 + test_random() % 100 : max;
+            values[i] = test_random() % 20 == 0 ? random_value(max) : random_value(scale);
+            emit_rice(&writer, &state[0], values[i], escape_bits);
+        }
+        bitwriter_emit(&writer, 0, 7);
+        uint32_t size = bitwriter_flush(&writer);
+
+        init_rice_state(state);
+        bitreader_t reader;
+        bitreader_init(&reader, buf, size);
+        for (i = 0; i < num_values; i++) {
+            bool escaped = false;
+            CHECK(read_rice(&reader, &state[0], escape_bits, &escaped) == values[i]);
+            escapes += escaped;
+        }
+        CHECK(!bitreader_overrun(&reader));
+        CHECK(num_values < 100 || escapes > 0);
+    }
+
+    /* With the initial state k is 2, so 23 is the largest value coded
+     * directly, in 11 one bits, a zero bit and 2 bits, and 24 escapes. */
+    uint8_t buf[16];
+    int32_t escape_values[] = { 23, -24, 24, -25 };
+    uint32_t escape_sizes[] = { 14, 14, 30, 30 };
+    for (n = 0; n < 4; n++) {
+        rice_state_t state[PMS_NUM_CHANNELS];
+        init_rice_state(state);
+        bitwriter_t writer;
+        bitwriter_init(&writer, buf);
+        emit_rice(&writer, &state[0], escape_values[n], 18);
+        CHECK(writer.nbits == escape_sizes[n]);
+    }
+}
+
+/*
+ * The logged samples, decoded from the events. The decoder state is reset at
+ * the start of each buffer and segment, as is the encoder state.
+ */
+static pms_sample_t samples[TEST_NUM_SAMPLES];
+static uint32_t num_logged;
+static uint32_t num_decoded;
+static uint32_t num_escaped;
+static uint32_t num_sample_bytes;
+static uint8_t states[100];
+static uint32_t num_states;
+
+typedef struct {
+    int32_t last[PMS_NUM_CHANNELS];
+    rice_state_t rice[PMS_NUM_CHANNELS];
+    bool weights_valid;
+    int32_t weights[PMS_NUM_CHANNELS];
+} pms_decoder_t;
+
+static void reset_pms_decoder(pms_decoder_t *decoder)
+{
+    memset(decoder->last, 0, sizeof(decoder->last));
+    init_rice_state(decoder->rice);
+    decoder->weights_valid = false;
+}
+
+/* The weights are signed leb128, sign extended from the last byte. */
+static void decode_pms_weights(pms_decoder_t *decoder, test_event_t *event)
+{
+    uint32_t i, pos = 0;
+    for (i = 0; i < PMS_NUM_CHANNELS; i++) {
+        int32_t v = 0;
+        uint32_t shift = 0;
+        uint8_t byte;
+        do {
+            if (pos >= event->size) {
+                CHECK(pos < event->size);
+                return;
+            }
+            byte = event->data[pos++];
+            v |= (int32_t)(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        if (byte & 0x40)
+            v -= 1 << shift;
+        decoder->weights[i] = v;
+    }
+    CHECK(pos == event->size);
+    decoder->weights_valid = true;
+}
+
+static void decode_pms_sample(pms_decoder_t *decoder, test_event_t *event)
+{
+    bool predict = event->code == DBUF_EVENT_PMS3003_PREDICT ||
+        event->code == DBUF_EVENT_PMS5003_PREDICT;
+    uint32_t num_channels = event->code == DBUF_EVENT_PMS3003_RICE ||
+        event->code == DBUF_EVENT_PMS3003_PREDICT ? PMS_NUM_CHANNELS - 4 : PMS_NUM_CHANNELS;
+    CHECK(!predict || decoder->weights_valid);
+
+    num_sample_bytes += event->size;
+    bitreader_t reader;
+    bitreader_init(&reader, event->data, event->size);
+    int32_t prior = 0;
+    uint32_t i;
+    for (i = 0; i < num_channels; i++) {
+        uint32_t channel = i < 8 ? i : i + PMS_NUM_CHANNELS - num_channels;
+        bool escaped = false;
+        int32_t d;
+        if (predict) {
+            d = read_rice(&reader, &decoder->rice[channel], 20, &escaped);
+            d += pms_predict(decoder->weights[channel], prior);
+        } else {
+            d = read_rice(&reader, &decoder->rice[channel], 18, &escaped);
+        }
+        decoder->last[channel] += d;
+        prior = d;
+        num_escaped += escaped;
+    }
+
+    /* The rest of the event is 8 to 15 bits of the checksum. */
+    uint32_t checksum_bits = event->size * 8 - (reader.pos * 8 - reader.nbits);
+    CHECK(checksum_bits >= 8 && checksum_bits <= 15);
+    uint32_t checksum = bitreader_read(&reader, checksum_bits);
+    CHECK(!bitreader_overrun(&reader));
+
+    if (num_decoded >= num_logged) {
+        CHECK(num_decoded < num_logged);
+        return;
+    }
+    pms_sample_t *expected = &samples[num_decoded++];
+    CHECK(checksum == (expected->checksum & ((1 << checksum_bits) - 1)));
+    CHECK(expected->length == (num_channels == PMS_NUM_CHANNELS ? 0x1c : 0x14));
+    for (i = 0; i < num_channels; i++) {
+        uint32_t channel = i < 8 ? i : i + PMS_NUM_CHANNELS - num_channels;
+        CHECK(decoder->last[channel] == expected->values[channel]);
+    }
+}
+
+static void decode_pms_buffer(const uint8_t *buf, uint32_t size)
+{
+    pms_decoder_t decoder;
+    reset_pms_decoder(&decoder);
+    test_events_t events;
+    test_event_t event;
+    test_events_init(&events, buf, size);
+    while (test_events_next(&events, &event)) {
+        switch (event.code) {
+        case DBUF_EVENT_SEGMENT_START:
+            reset_pms_decoder(&decoder);
+            break;
+        case DBUF_EVENT_PMS_STATE:
+            CHECK(event.size == 1);
+            if (num_states < sizeof(states))
+                states[num_states++] = event.data[0];
+            break;
+        case DBUF_EVENT_PMS_WEIGHTS:
+            decode_pms_weights(&decoder, &event);
+            break;
+        case DBUF_EVENT_PMS3003_RICE:
+        case DBUF_EVENT_PMS5003_RICE:
+        case DBUF_EVENT_PMS3003_PREDICT:
+        case DBUF_EVENT_PMS5003_PREDICT:
+            decode_pms_sample(&decoder, &event);
+            break;
+        }
+    }
+    CHECK(!events.error);
+}
+
+/*
+ * Samples logged as the sensor task logs them, and decoded from the buffers.
+ * The channel deltas are correlated, as in the sensor data, with jumps over
+ * the full range of the values which are coded with the escape. Returns the
+ * size of the sample events.
+ */
+static uint32_t test_log_samples(uint16_t length, uint8_t predict)
+{
+    flash_emu_erase_all();
+    user_init();
+    param_pms_predict = predict;
+    reset_dbuf();
+    pms_log_t log;
+    init_pms_log(&log, 0);
+    num_logged = 0;
+    num_decoded = 0;
+    num_escaped = 0;
+    num_sample_bytes = 0;
+
+    int32_t last[PMS_NUM_CHANNELS] = { 0 };
+    uint32_t n;
+    for (n = 0; n < TEST_NUM_SAMPLES; n++) {
+        pms_sample_t *sample = &samples[num_logged++];
+        sample->length = length;
+        sample->checksum = test_random();
+        int32_t common = test_random() % 100 == 0 ? random_value(65535) : random_value(20);
+        uint32_t i;
+        for (i = 0; i < PMS_NUM_CHANNELS; i++) {
+            int32_t v = last[i] + common * (int32_t)(i + 1) / 4 + random_value(3);
+            if (v > 65535)
+                v = 65535;
+            else if (v < -65535)
+                v = -65535;
+            /* The channels not in the PMS3003 frames are zero. */
+            if (length == 0x14 && i >= 8 && i < 11)
+                v = 0;
+            sample->values[i] = last[i] = v;
+        }
+        RTC.COUNTER += 1000000;
+        log_pms_sample(&log, sample);
+        test_take_buffers(decode_pms_buffer);
+    }
+
+    test_take_all_buffers(decode_pms_buffer);
+    CHECK(num_decoded == num_logged);
+    CHECK(num_escaped > 0);
+    if (predict) {
+        uint32_t i;
+        bool weighted = false;
+        for (i = 0; i < PMS_NUM_CHANNELS; i++)
+            weighted |= log.weights[i] != 0;
+        CHECK(weighted);
+    }
+    return num_sample_bytes;
+}
+
+/* The prediction, rounded to nearest with an arithmetic shift, over the full
+ * range of the weights and deltas. */
+static void test_predict(void)
+{
+    int32_t w;
+    for (w = -PMS_WEIGHT_MAX; w <= PMS_WEIGHT_MAX; w++) {
+        uint32_t n;
+        for (n = 0; n < 1000; n++) {
+            int32_t d = n < 100 ? (int32_t)n - 50 : random_value(131070);
+            int64_t x = (int64_t)w * d + 8;
+            int64_t expected = x >= 0 ? x / 16 : -((-x + 15) / 16);
+            CHECK(pms_predict(w, d) == expected);
+        }
+    }
+    CHECK(pms_predict(16, -131070) == -131070);
+    CHECK(pms_predict(8, 1) == 1);
+    CHECK(pms_predict(8, -1) == 0);
+    CHECK(pms_predict(-8, 1) == 0);
+    CHECK(pms_predict(24, -1) == -1);
+}
+
+/*
+ * The weights fit to the statistics of a buffer: deltas in an exact ratio to
+ * their prior give that ratio, including negative ratios which round the same
+ * way, steeper ratios are clamped, and a channel with no statistics keeps its
+ * weight. The statistics are cleared for the next buffer.
+ */
+static void test_weights(void)
+{
+    pms_log_t log;
+    init_pms_log(&log, 0);
+    int32_t ratios[PMS_NUM_CHANNELS] = { 0, 16, -16, 5, -5, 31, -31, 32, -32, 40, -100, 0, 0 };
+    uint32_t i, n;
+    log.weights[11] = 7;
+    log.weights[12] = -3;
+    for (n = 0; n < 200; n++) {
+        int32_t prior = random_value(1000);
+        for (i = 0; i < 11; i++) {
+            int64_t d = (int64_t)ratios[i] * prior;
+            log.sxy[i] += prior * d;
+            log.sxx[i] += (int64_t)prior * prior * 16;
+        }
+        log.sxy[12] += prior;
+    }
+    update_pms_weights(&log);
+    for (i = 0; i < 9; i++)
+        CHECK(log.weights[i] == ratios[i]);
+    CHECK(log.weights[9] == PMS_WEIGHT_MAX);
+    CHECK(log.weights[10] == -PMS_WEIGHT_MAX);
+    CHECK(log.weights[11] == 7);
+    CHECK(log.weights[12] == -3);
+    for (i = 0; i < PMS_NUM_CHANNELS; i++)
+        CHECK(log.sxy[i] == 0 && log.sxx[i] == 0);
+
+    /* A half rounds away from zero, either way. */
+    log.sxy[0] = 1;
+    log.sxx[0] = 32;
+    log.sxy[1] = -1;
+    log.sxx[1] = 32;
+    log.sxy[2] = 1;
+    log.sxx[2] = 33;
+    update_pms_weights(&log);
+    CHECK(log.weights[0] == 1);
+    CHECK(log.weights[1] == -1);
+    CHECK(log.weights[2] == 0);
+}
+
+/* The prediction reduces the size of the correlated samples, and the
+ * predicted events decode. */
+static void test_predictor(void)
+{
+    test_predict();
+    test_weights();
+    uint32_t plain = test_log_samples(0x1c, 0);
+    uint32_t predicted = test_log_samples(0x1c, 1);
+    CHECK(predicted < plain);
+    CHECK(test_log_samples(0x14, 1) > 0);
+}
+
+/*
+ * The duty cycle. The sensor on the UART is modelled: it follows the commands
+ * sent by the task, and when awake sends a frame every second in the active
+ * mode, or shortly after each read request in the passive mode. Some read
+ * requests are lost. The task is run for a number of cycles, and the commands,
+ * and the states and samples logged, are checked against the schedule.
+ */
+#define TEST_PERIOD 60
+#define TEST_WARMUP 10
+#define TEST_SAMPLES 5
+#define TEST_CYCLES 6
+#define TEST_LOST_READ 7
+#define TEST_RESPONSE_TICKS 5
+
+typedef struct {
+    uint8_t command;
+    uint16_t data;
+    TickType_t time;
+} test_command_t;
+
+static struct {
+    bool awake;
+    bool passive;
+    uint8_t cmd[7];
+    uint32_t cmd_len;
+    bool frame_pending;
+    TickType_t frame_time;
+    uint32_t reads;
+    test_command_t commands[100];
+    uint32_t num_commands;
+    TickType_t end;
+    jmp_buf exit;
+} model;
+
+/* The sample logged for a PMS5003 frame, as in pms_handle_frame(). */
+static void frame_sample(uint8_t *frame, pms_sample_t *sample)
+{
+    int32_t v[PMS_NUM_CHANNELS];
+    uint32_t i;
+    for (i = 0; i < PMS_NUM_CHANNELS; i++)
+        v[i] = pms_word(frame, i);
+    sample->length = 0x1c;
+    sample->checksum = pms_word(frame, PMS_NUM_CHANNELS);
+    sample->values[0] = v[0];
+    sample->values[1] = v[1] - v[0];
+    sample->values[2] = v[2] - v[1];
+    sample->values[3] = v[3];
+    sample->values[4] = v[4] - v[3];
+    sample->values[5] = v[5] - v[4];
+    for (i = 6; i < 11; i++)
+        sample->values[i] = v[i] - v[i + 1];
+    sample->values[11] = v[11];
+    sample->values[12] = v[12];
+}
+
+/* Send a frame, which is expected to be logged if the task is sampling. */
+static void model_send_frame(void)
+{
+    uint8_t frame[PMS_FRAME_MAX_SIZE];
+    uint32_t size = make_frame(frame, false);
+    send_bytes(&pms_uart_frames, frame, size);
+    if (pms_state == PMS_STATE_SAMPLE && num_logged < TEST_NUM_SAMPLES)
+        frame_sample(frame, &samples[num_logged++]);
+}
+
+static void model_putc(int uart, char c)
+{
+    CHECK(uart == 0);
+    model.cmd[model.cmd_len++] = c;
+    if (model.cmd_len < sizeof(model.cmd))
+        return;
+    model.cmd_len = 0;
+
+    uint8_t *cmd = model.cmd;
+    uint16_t checksum = 0;
+    uint32_t i;
+    for (i = 0; i < 5; i++)
+        checksum += cmd[i];
+    CHECK(cmd[0] == 'B' && cmd[1] == 'M');
+    CHECK(checksum == (cmd[5] << 8 | cmd[6]));
+
+    uint16_t data = cmd[3] << 8 | cmd[4];
+    if (model.num_commands < sizeof(model.commands) / sizeof(model.commands[0])) {
+        test_command_t *command = &model.commands[model.num_commands++];
+        command->command = cmd[2];
+        command->data = data;
+        command->time = host_ticks;
+    }
+
+    switch (cmd[2]) {
+    case PMS_CMD_SLEEP:
+        /* Wakes in the active mode. */
+        model.awake = data;
+        model.passive = false;
+        model.frame_pending = model.awake;
+        model.frame_time = host_ticks + PMS_SAMPLE_INTERVAL;
+        break;
+    case PMS_CMD_MODE:
+        model.passive = data == 0;
+        model.frame_pending = model.awake && !model.passive;
+        model.frame_time = host_ticks + PMS_SAMPLE_INTERVAL;
+        break;
+    case PMS_CMD_READ:
+        if (model.awake && model.passive && ++model.reads % TEST_LOST_READ) {
+            model.frame_pending = true;
+            model.frame_time = host_ticks + TEST_RESPONSE_TICKS;
+        }
+        break;
+    default:
+        CHECK(false);
+        break;
+    }
+}
+
+static void model_wait(TickType_t ticks, bool wake)
+{
+    CHECK(ticks != portMAX_DELAY);
+    TickType_t until = host_ticks + ticks;
+    while (model.frame_pending && (int32_t)(model.frame_time - until) <= 0) {
+        host_ticks = model.frame_time;
+        model_send_frame();
+        model.frame_pending = model.awake && !model.passive;
+        model.frame_time += PMS_SAMPLE_INTERVAL;
+        if (wake)
+            return;
+    }
+    host_ticks = until;
+    if ((int32_t)(host_ticks - model.end) >= 0)
+        longjmp(model.exit, 1);
+}
+
+static void test_duty_cycle(void)
+{
+    flash_emu_erase_all();
+    user_init();
+    param_pms_period = TEST_PERIOD;
+    param_pms_warmup = TEST_WARMUP;
+    param_pms_samples = TEST_SAMPLES;
+    param_pms_predict = 0;
+    reset_dbuf();
+    num_logged = 0;
+    num_decoded = 0;
+    num_states = 0;
+    memset(&model, 0, sizeof(model));
+
+    /* Frames received in the active mode before the task starts are
+     * discarded. */
+    uint8_t frame[PMS_FRAME_MAX_SIZE];
+    uint32_t n;
+    for (n = 0; n < 2; n++)
+        send_bytes(&pms_uart_frames, frame, make_frame(frame, false));
+    model.awake = true;
+
+    TickType_t period = TEST_PERIOD * 1000 / portTICK_PERIOD_MS;
+    TickType_t warmup = TEST_WARMUP * 1000 / portTICK_PERIOD_MS;
+    TickType_t start = host_ticks;
+    model.end = start + TEST_CYCLES * period;
+    host_wait_hook = model_wait;
+    host_uart_putc_hook = model_putc;
+    if (!setjmp(model.exit))
+        pms_read_task(NULL);
+    host_wait_hook = NULL;
+    host_uart_putc_hook = NULL;
+
+    /* Wake, and switch to the passive mode, at the start of each period, and
+     * read at one second intervals after the warm-up, and then sleep. */
+    CHECK(model.num_commands == TEST_CYCLES * (TEST_SAMPLES + 3));
+    test_command_t *command = model.commands;
+    for (n = 0; n < TEST_CYCLES && command < model.commands + model.num_commands; n++) {
+        TickType_t cycle_start = start + n * period;
+        CHECK(command->command == PMS_CMD_SLEEP && command->data == 1);
+        CHECK(command->time == cycle_start);
+        command++;
+        CHECK(command->command == PMS_CMD_MODE && command->data == 0);
+        CHECK(command->time == cycle_start);
+        command++;
+        uint32_t i;
+        for (i = 0; i < TEST_SAMPLES; i++, command++) {
+            CHECK(command->command == PMS_CMD_READ);
+            CHECK(command->time == cycle_start + warmup + i * PMS_SAMPLE_INTERVAL);
+        }
+        CHECK(command->command == PMS_CMD_SLEEP && command->data == 0);
+        CHECK(command->time == cycle_start + warmup + TEST_SAMPLES * PMS_SAMPLE_INTERVAL);
+        command++;
+    }
+
+    /* The responses are logged, and not the frames before the first cycle. */
+    test_take_all_buffers(decode_pms_buffer);
+    CHECK(model.reads == TEST_CYCLES * TEST_SAMPLES);
+    CHECK(num_logged == model.reads - model.reads / TEST_LOST_READ);
+    CHECK(num_decoded == num_logged);
+
+    CHECK(num_states == TEST_CYCLES * 3);
+    for (n = 0; n < num_states; n++) {
+        static const uint8_t cycle[] = { PMS_STATE_WARMUP, PMS_STATE_SAMPLE, PMS_STATE_SLEEP };
+        CHECK(states[n] == cycle[n % 3]);
+    }
+}
+
+int main(void)
+{
+    if (!flash_emu_open(TEST_PMS_FILE)) {
+        printf("Failed to open %s\n", TEST_PMS_FILE);
+        return 1;
+    }
+
+    test_frame_assembly();
+    test_soft_uart();
+    test_rice();
+    test_log_samples(0x14, 0);
+    test_predictor();
+    test_duty_cycle();
+
+    flash_emu_close();
+    unlink(TEST_PMS_FILE);
+    return test_report("pms");
+}
@@ -0,0 +1,198 @@
+/*
+ * Host tests for the range coder, checking the round trip of event buffers and
+ * of random data, the output size limit, and the packed sector decoding.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "../rc.c"
+
+static rc_model_t model;
+
+static uint32_t emit_test_leb128(uint8_t *buf, uint32_t value)
+{
+    uint32_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = value | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+    return len;
+}
+
+/* Fill a buffer with an index and events with slowly varying data, as logged,
+ * up to the max size, returning its size. */
+static uint32_t make_event_buffer(uint8_t *buf, uint32_t index, uint32_t max)
+{
+    uint32_t i, size = 0;
+    for (i = 0; i < 4; i++)
+        buf[size++] = index >> (i * 8);
+    for (i = 0; i < 4; i++)
+        buf[size++] = ~index >> (i * 8);
+
+    uint32_t value = test_random() & 0xff;
+    while (1) {
+        uint32_t code = 1 + test_random() % 20;
+        uint32_t data_size = test_random() % 24;
+        if (size + 16 + data_size > max)
+            break;
+        size += emit_test_leb128(buf + size, code << 2 | 1);
+        size += emit_test_leb128(buf + size, data_size);
+        size += emit_test_leb128(buf + size, test_random() % 3000);
+        for (i = 0; i < data_size; i++) {
+            value += test_random() % 5 - 2;
+            buf[size++] = value;
+        }
+    }
+    return size;
+}
+
+static void test_event_buffers(void)
+{
+    uint32_t n;
+    for (n = 0; n < 100; n++) {
+        uint8_t buf[4096], coded[4096], decoded[4096];
+        uint32_t size = make_event_buffer(buf, n, 4096);
+        uint32_t coded_size = rc_compress(&model, buf, size, coded, sizeof(coded));
+        CHECK(coded_size > 0 && coded_size < size);
+        CHECK(rc_decompress(&model, coded, coded_size, decoded, size));
+        CHECK(memcmp(buf, decoded, size) == 0);
+    }
+}
+
+/* Random data does not compress, and is rejected when the output is limited
+ * to the input size. */
+static void test_random_data(void)
+{
+    uint32_t n;
+    for (n = 0; n < 20; n++) {
+        uint8_t buf[4096], coded[4096 + 64], decoded[4096];
+        uint32_t size = 1 + test_random() % sizeof(buf);
+        uint32_t i;
+        for (i = 0; i < size; i++)
+            buf[i] = test_random();
+        uint32_t coded_size = rc_compress(&model, buf, size, coded, sizeof(coded));
+        CHECK(coded_size >= size);
+        /* Not ending on an event boundary, so flagged as corrupt. */
+        rc_decompress(&model, coded, coded_size, decoded, size);
+        CHECK(memcmp(buf, decoded, size) == 0);
+        CHECK(rc_compress(&model, buf, size, coded, size) == 0);
+    }
+}
+
+/* The output fits exactly in the compressed size, and not one byte less, and
+ * the bytes past the limit are not written. */
+static void test_size_limit(void)
+{
+    uint32_t n;
+    for (n = 0; n < 20; n++) {
+        uint8_t buf[4096], coded[4096], decoded[4096];
+        uint32_t size = make_event_buffer(buf, n, 4096);
+        uint32_t coded_size = rc_compress(&model, buf, size, coded, sizeof(coded));
+        memset(coded, 0x5a, sizeof(coded));
+        CHECK(rc_compress(&model, buf, size, coded, coded_size) == coded_size);
+        CHECK(coded[coded_size] == 0x5a);
+        CHECK(rc_decompress(&model, coded, coded_size, decoded, size));
+        CHECK(memcmp(buf, decoded, size) == 0);
+        memset(coded, 0x5a, sizeof(coded));
+        CHECK(rc_compress(&model, buf, size, coded, coded_size - 1) == 0);
+        CHECK(coded[coded_size - 1] == 0x5a);
+    }
+}
+
+static uint8_t unpacked[8][4096];
+static uint32_t unpacked_sizes[8];
+static uint32_t unpacked_count;
+
+static void unpack_buffer(void *arg, const uint8_t *buf, uint32_t size)
+{
+    if (unpacked_count < 8) {
+        memcpy(unpacked[unpacked_count], buf, size);
+        unpacked_sizes[unpacked_count] = size;
+    }
+    unpacked_count++;
+}
+
+/* A packed sector is unpacked to its chunks, stopping at the erased space or a
+ * truncated chunk, and a sector in the usual format is rejected. */
+static void test_unpack_sector(void)
+{
+    uint8_t sector[4096], bufs[4][4096], buf[4096];
+    uint32_t sizes[4];
+    uint32_t i;
+
+    memset(sector, 0xff, sizeof(sector));
+    uint32_t index = 1234;
+    for (i = 0; i < 4; i++) {
+        sector[i] = index >> (i * 8);
+        sector[4 + i] = ~index >> (i * 8);
+    }
+    sector[8] = DBUF_EVENT_RC_SECTOR << 2 | 1;
+    sector[9] = 0;
+    sector[10] = 0;
+
+    uint32_t offset = RC_SECTOR_HEADER_SIZE;
+    uint32_t offsets[4];
+    for (i = 0; i < 4; i++) {
+        sizes[i] = make_event_buffer(bufs[i], index + i, 1024);
+        uint8_t *chunk = sector + offset;
+        uint32_t coded = rc_compress(&model, bufs[i], sizes[i], chunk + RC_CHUNK_HEADER_SIZE,
+                                     RC_SECTOR_FOOTER_OFFSET - offset - RC_CHUNK_HEADER_SIZE);
+        CHECK(coded > 0);
+        chunk[0] = coded;
+        chunk[1] = coded >> 8;
+        chunk[2] = sizes[i];
+        chunk[3] = sizes[i] >> 8;
+        offsets[i] = offset;
+        offset += RC_CHUNK_HEADER_SIZE + coded;
+    }
+
+    unpacked_count = 0;
+    CHECK(rc_unpack_sector(&model, sector, buf, unpack_buffer, NULL) == 4);
+    CHECK(unpacked_count == 4);
+    for (i = 0; i < 4; i++) {
+        CHECK(unpacked_sizes[i] == sizes[i]);
+        CHECK(memcmp(unpacked[i], bufs[i], sizes[i]) == 0);
+    }
+
+    /* A last chunk claiming more than the space in the sector is dropped. */
+    uint8_t *last = sector + offsets[3];
+    last[0] = 0xfe;
+    last[1] = 0x0f;
+    unpacked_count = 0;
+    CHECK(rc_unpack_sector(&model, sector, buf, unpack_buffer, NULL) == 3);
+
+    /* The usual format. */
+    sector[8] = DBUF_EVENT_TIME_PREDICT << 2 | 1;
+    CHECK(rc_unpack_sector(&model, sector, buf, unpack_buffer, NULL) < 0);
+    sector[8] = DBUF_EVENT_RC_SECTOR << 2 | 1;
+    sector[4] ^= 1;
+    CHECK(rc_unpack_sector(&model, sector, buf, unpack_buffer, NULL) < 0);
+}
+
+int main(void)
+{
+    test_event_buffers();
+    test_random_data();
+    test_size_limit();
+    test_unpack_sector();
+    return test_report("rc");
+}
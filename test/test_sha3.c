@@ -0,0 +1,108 @@
+/*
+ * Host tests for the SHA3 code, checking the unrolled Keccak-f1600
+ * permutation against the readable implementation and the streaming sponge
+ * against the one shot hash.
+ *
+ * Copyright (C) 2017 OurAirQuality.org
+ *
+ * Licensed under the Apache License, Version 2.0, January 2004 (the
+ * "License"); you may not use this file except in compliance with the
+ * License.  You may obtain a copy of the License at
+ *      http://www.apache.org/licenses/
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE CONTRIBUTORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS WITH THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "../sha3.c"
+
+static void test_permutation(void)
+{
+    uint32_t n;
+    for (n = 0; n < 1000; n++) {
+        uint8_t a[200], b[200];
+        uint32_t i;
+        for (i = 0; i < sizeof(a); i++)
+            a[i] = test_random();
+        memcpy(b, a, sizeof(b));
+        KeccakF1600_StatePermute(a);
+        KeccakF1600_StatePermuteUnrolled(b);
+        CHECK(memcmp(a, b, sizeof(a)) == 0);
+    }
+}
+
+static void test_sha3_224_vectors(void)
+{
+    static const uint8_t empty[28] = {
+        0x6b, 0x4e, 0x03, 0x42, 0x36, 0x67, 0xdb, 0xb7, 0x3b, 0x6e,
+        0x15, 0x45, 0x4f, 0x0e, 0xb1, 0xab, 0xd4, 0x59, 0x7f, 0x9a,
+        0x1b, 0x07, 0x8e, 0x3f, 0x5b, 0x5a, 0x6b, 0xc7 };
+    static const uint8_t abc[28] = {
+        0xe6, 0x42, 0x82, 0x4c, 0x3f, 0x8c, 0xf2, 0x4a, 0xd0, 0x92,
+        0x34, 0xee, 0x7d, 0x3c, 0x76, 0x6f, 0xc9, 0xa3, 0xa5, 0x16,
+        0x8d, 0x0c, 0x94, 0xad, 0x73, 0xb4, 0x6f, 0xdf };
+    uint8_t out[28];
+
+    FIPS202_SHA3_224((const uint8_t *)"", 0, out);
+    CHECK(memcmp(out, empty, sizeof(out)) == 0);
+    FIPS202_SHA3_224((const uint8_t *)"abc", 3, out);
+    CHECK(memcmp(out, abc, sizeof(out)) == 0);
+}
+
+/* A message absorbed in pieces after a cloned key prefix hashes the same as
+ * the one shot hash of the key and message, as used to sign the posts. */
+static void test_sponge_clone(void)
+{
+    uint8_t msg[1000];
+    uint32_t i;
+    for (i = 0; i < sizeof(msg); i++)
+        msg[i] = test_random();
+
+    uint32_t key_size;
+    for (key_size = 0; key_size < 300; key_size += 41) {
+        Keccak_SpongeInstance keyed;
+        FIPS202_SHA3_224_Initialize(&keyed);
+        Keccak_SpongeAbsorb(&keyed, msg, key_size);
+
+        uint32_t size;
+        for (size = key_size; size <= sizeof(msg); size += 97) {
+            Keccak_SpongeInstance sponge;
+            Keccak_SpongeClone(&sponge, &keyed);
+            uint32_t split = key_size + (size - key_size) / 3;
+            Keccak_SpongeAbsorb(&sponge, msg + key_size, split - key_size);
+            Keccak_SpongeAbsorb(&sponge, msg + split, size - split);
+            uint8_t out[28], expected[28];
+            FIPS202_SHA3_224_Final(&sponge, out);
+            FIPS202_SHA3_224(msg, size, expected);
+            CHECK(memcmp(out, expected, sizeof(out)) == 0);
+        }
+    }
+}
+
+static void test_sponge_initialize(void)
+{
+    Keccak_SpongeInstance sponge;
+    CHECK(Keccak_SpongeInitialize(&sponge, 1152, 448) == 0);
+    CHECK(sponge.rateInBytes == 144);
+    CHECK(Keccak_SpongeInitialize(&sponge, 1152, 512) == 1);
+    CHECK(Keccak_SpongeInitialize(&sponge, 1150, 450) == 1);
+}
+
+int main(void)
+{
+    test_sponge_initialize();
+    test_permutation();
+    test_sha3_224_vectors();
+    test_sponge_clone();
+    return test_report("sha3");
+}
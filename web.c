@@ -111,6 +111,12 @@ static int handle_index(int s, wificfg_method method,
         snprintf(buf, len, "<dt>Flash sector</dt><dd>index %u, size %u</dd>", index, size);
         if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
 
+        flash_stats_t flash_stats;
+        get_flash_stats(&flash_stats);
+        snprintf(buf, len, "<dt>Flash usage</dt><dd>%u reads, %u writes, %u erases, %u failures</dd>",
+                 flash_stats.reads, flash_stats.writes, flash_stats.erases, flash_stats.write_failures);
+        if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
+
         if (wificfg_write_string_chunk(s, "<dt>Last measured data:</dt><dd></dd>", buf, len) < 0) return -1;
 
         {
@@ -340,6 +346,34 @@ static int handle_config(int s, wificfg_method method,
         if (logging && wificfg_write_string_chunk(s, "checked", buf, len) < 0) return -1;
         if (wificfg_write_string_chunk(s, http_config_content[11], buf, len) < 0) return -1;
 
+        /* The I2C sensor sampling, as running. */
+        snprintf(buf, len, "%u", param_sht2x_period);
+        if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[12], buf, len) < 0) return -1;
+        if (param_sht2x_resolution == 0 && wificfg_write_string_chunk(s, " selected", buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[13], buf, len) < 0) return -1;
+        if (param_sht2x_resolution == 1 && wificfg_write_string_chunk(s, " selected", buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[14], buf, len) < 0) return -1;
+        if (param_sht2x_resolution == 2 && wificfg_write_string_chunk(s, " selected", buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[15], buf, len) < 0) return -1;
+        if (param_sht2x_resolution == 3 && wificfg_write_string_chunk(s, " selected", buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[16], buf, len) < 0) return -1;
+        snprintf(buf, len, "%u", param_bmp180_period);
+        if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[17], buf, len) < 0) return -1;
+        snprintf(buf, len, "%u", param_bmp180_oversampling);
+        if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[18], buf, len) < 0) return -1;
+        snprintf(buf, len, "%u", param_bme280_period);
+        if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[19], buf, len) < 0) return -1;
+        snprintf(buf, len, "%u", param_bme280_oversampling);
+        if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[20], buf, len) < 0) return -1;
+        snprintf(buf, len, "%u", param_ds3231_period);
+        if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[21], buf, len) < 0) return -1;
+
         char *web_server = NULL;
         sysparam_get_string("oaq_web_server", &web_server);
         if (web_server) {
@@ -348,14 +382,14 @@ static int handle_config(int s, wificfg_method method,
             if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
         }
 
-        if (wificfg_write_string_chunk(s, http_config_content[12], buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[22], buf, len) < 0) return -1;
 
         int32_t web_port = 80;
         sysparam_get_int32("oaq_web_port", &web_port);
         snprintf(buf, len, "%u", web_port);
         if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
 
-        if (wificfg_write_string_chunk(s, http_config_content[13], buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[23], buf, len) < 0) return -1;
 
         char *web_path = NULL;
         sysparam_get_string("oaq_web_path", &web_path);
@@ -367,7 +401,7 @@ static int handle_config(int s, wificfg_method method,
         }
         if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
 
-        if (wificfg_write_string_chunk(s, http_config_content[14], buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[24], buf, len) < 0) return -1;
 
         int32_t sensor_id = 0;
         if (sysparam_get_int32("oaq_sensor_id", &sensor_id) == SYSPARAM_OK) {
@@ -375,7 +409,7 @@ static int handle_config(int s, wificfg_method method,
             if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
         }
 
-        if (wificfg_write_string_chunk(s, http_config_content[15], buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[25], buf, len) < 0) return -1;
 
         uint8_t *sha3_key = NULL;
         size_t actual_length;
@@ -389,7 +423,7 @@ static int handle_config(int s, wificfg_method method,
             }
         }
 
-        if (wificfg_write_string_chunk(s, http_config_content[16], buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[26], buf, len) < 0) return -1;
 
         struct tm time;
         xSemaphoreTake(i2c_sem, portMAX_DELAY);
@@ -402,43 +436,43 @@ static int handle_config(int s, wificfg_method method,
             clock_time -= tz * 60 * 60;
             gmtime_r(&clock_time, &time);
 
-            if (wificfg_write_string_chunk(s, http_config_content[17], buf, len) < 0) return -1;
+            if (wificfg_write_string_chunk(s, http_config_content[27], buf, len) < 0) return -1;
 
             snprintf(buf, len, "%u", time.tm_year + 1900);
             if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
 
-            if (wificfg_write_string_chunk(s, http_config_content[18], buf, len) < 0) return -1;
+            if (wificfg_write_string_chunk(s, http_config_content[28], buf, len) < 0) return -1;
 
             snprintf(buf, len, "%u", time.tm_mon + 1);
             if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
 
-            if (wificfg_write_string_chunk(s, http_config_content[19], buf, len) < 0) return -1;
+            if (wificfg_write_string_chunk(s, http_config_content[29], buf, len) < 0) return -1;
 
             snprintf(buf, len, "%u", time.tm_mday);
             if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
 
-            if (wificfg_write_string_chunk(s, http_config_content[20], buf, len) < 0) return -1;
+            if (wificfg_write_string_chunk(s, http_config_content[30], buf, len) < 0) return -1;
 
             snprintf(buf, len, "%u", time.tm_hour);
             if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
 
-            if (wificfg_write_string_chunk(s, http_config_content[21], buf, len) < 0) return -1;
+            if (wificfg_write_string_chunk(s, http_config_content[31], buf, len) < 0) return -1;
 
             snprintf(buf, len, "%u", time.tm_min);
             if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
 
-            if (wificfg_write_string_chunk(s, http_config_content[22], buf, len) < 0) return -1;
+            if (wificfg_write_string_chunk(s, http_config_content[32], buf, len) < 0) return -1;
 
             snprintf(buf, len, "%u", time.tm_sec);
             if (wificfg_write_string_chunk(s, buf, buf, len) < 0) return -1;
 
-            if (wificfg_write_string_chunk(s, http_config_content[23], buf, len) < 0) return -1;
+            if (wificfg_write_string_chunk(s, http_config_content[33], buf, len) < 0) return -1;
         }
 
         /* Erase flash */
-        if (wificfg_write_string_chunk(s, http_config_content[24], buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[34], buf, len) < 0) return -1;
 
-        if (wificfg_write_string_chunk(s, http_config_content[25], buf, len) < 0) return -1;
+        if (wificfg_write_string_chunk(s, http_config_content[35], buf, len) < 0) return -1;
 
         if (wificfg_write_chunk_end(s) < 0) return -1;
     }
@@ -452,6 +486,13 @@ typedef enum {
     FORM_NAME_I2C_SDA,
     FORM_NAME_TZ,
     FORM_NAME_LOGGING,
+    FORM_NAME_SHT_PERIOD,
+    FORM_NAME_SHT_RES,
+    FORM_NAME_BMP180_PERIOD,
+    FORM_NAME_BMP180_OS,
+    FORM_NAME_BME_PERIOD,
+    FORM_NAME_BME_OS,
+    FORM_NAME_DS3231_PERIOD,
     FORM_NAME_WEB_SERVER,
     FORM_NAME_WEB_PORT,
     FORM_NAME_WEB_PATH,
@@ -483,6 +524,13 @@ static const struct {
     {"oaq_i2c_sda", FORM_NAME_I2C_SDA},
     {"oaq_tz", FORM_NAME_TZ},
     {"oaq_logging", FORM_NAME_LOGGING},
+    {"oaq_sht_period", FORM_NAME_SHT_PERIOD},
+    {"oaq_sht_res", FORM_NAME_SHT_RES},
+    {"oaq_bmp180_period", FORM_NAME_BMP180_PERIOD},
+    {"oaq_bmp180_os", FORM_NAME_BMP180_OS},
+    {"oaq_bme_period", FORM_NAME_BME_PERIOD},
+    {"oaq_bme_os", FORM_NAME_BME_OS},
+    {"oaq_ds3231_period", FORM_NAME_DS3231_PERIOD},
     {"oaq_web_server", FORM_NAME_WEB_SERVER},
     {"oaq_web_port", FORM_NAME_WEB_PORT},
     {"oaq_web_path", FORM_NAME_WEB_PATH},
@@ -779,6 +827,64 @@ static int handle_config_post(int s, wificfg_method method,
                     logging = strtoul(buf, NULL, 10) != 0;
                     break;
                 }
+                /* The I2C sensor sampling is applied now, from the next
+                 * sample. */
+                case FORM_NAME_SHT_PERIOD: {
+                    uint32_t period = strtoul(buf, NULL, 10);
+                    if (period >= 1 && period <= 86400) {
+                        sysparam_set_int32("oaq_sht_period", period);
+                        param_sht2x_period = period;
+                    }
+                    break;
+                }
+                case FORM_NAME_SHT_RES: {
+                    int8_t res = strtoul(buf, NULL, 10);
+                    if (res >= 0 && res <= 3) {
+                        sysparam_set_int8("oaq_sht_res", res);
+                        param_sht2x_resolution = res;
+                    }
+                    break;
+                }
+                case FORM_NAME_BMP180_PERIOD: {
+                    uint32_t period = strtoul(buf, NULL, 10);
+                    if (period >= 1 && period <= 86400) {
+                        sysparam_set_int32("oaq_bmp180_period", period);
+                        param_bmp180_period = period;
+                    }
+                    break;
+                }
+                case FORM_NAME_BMP180_OS: {
+                    int8_t os = strtoul(buf, NULL, 10);
+                    if (os >= 0 && os <= 3) {
+                        sysparam_set_int8("oaq_bmp180_os", os);
+                        param_bmp180_oversampling = os;
+                    }
+                    break;
+                }
+                case FORM_NAME_BME_PERIOD: {
+                    uint32_t period = strtoul(buf, NULL, 10);
+                    if (period >= 1 && period <= 86400) {
+                        sysparam_set_int32("oaq_bme_period", period);
+                        param_bme280_period = period;
+                    }
+                    break;
+                }
+                case FORM_NAME_BME_OS: {
+                    int8_t os = strtoul(buf, NULL, 10);
+                    if (os >= 1 && os <= 5) {
+                        sysparam_set_int8("oaq_bme_os", os);
+                        param_bme280_oversampling = os;
+                    }
+                    break;
+                }
+                case FORM_NAME_DS3231_PERIOD: {
+                    uint32_t period = strtoul(buf, NULL, 10);
+                    if (period >= 1 && period <= 86400) {
+                        sysparam_set_int32("oaq_ds3231_period", period);
+                        param_ds3231_period = period;
+                    }
+                    break;
+                }
                 case FORM_NAME_WEB_SERVER: {
                     sysparam_set_string("oaq_web_server", buf);
                     break;